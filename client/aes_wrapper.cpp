@@ -5,6 +5,7 @@
 #include <filters.h>
 
 #include <stdexcept>
+#include <cstring>
 #include <immintrin.h>	// _rdrand32_step
 
 
@@ -13,7 +14,7 @@ AESWrapper::AESWrapper(const char* key, unsigned int length)
 {
 	if (length != DEFAULT_KEYLENGTH)
 		throw std::length_error("key length must be 32 bytes");
-	memcpy_s(_key, DEFAULT_KEYLENGTH, key, length);
+	std::memcpy(_key, key, length);
 }
 
 AESWrapper::~AESWrapper()
@@ -33,4 +34,17 @@ std::string AESWrapper::encrypt(const char* plain, unsigned int length)
 	stfEncryptor.MessageEnd();
 
 	return cipher;
+}
+
+std::string AESWrapper::decrypt(const char* cipher, unsigned int length, const unsigned char* iv)
+{
+	CryptoPP::AES::Decryption aesDecryption(_key, DEFAULT_KEYLENGTH);
+	CryptoPP::CBC_Mode_ExternalCipher::Decryption cbcDecryption(aesDecryption, iv);
+
+	std::string plain;
+	CryptoPP::StreamTransformationFilter stfDecryptor(cbcDecryption, new CryptoPP::StringSink(plain));
+	stfDecryptor.Put(reinterpret_cast<const CryptoPP::byte*>(cipher), length);
+	stfDecryptor.MessageEnd();
+
+	return plain;
 }
\ No newline at end of file
@@ -15,4 +15,6 @@ public:
 	~AESWrapper();
 
 	std::string encrypt(const char* plain, unsigned int length);
+	// CBC with the given IV (AES::BLOCKSIZE bytes), throws CryptoPP::Exception when the padding is wrong
+	std::string decrypt(const char* cipher, unsigned int length, const unsigned char* iv);
 };
\ No newline at end of file
@@ -0,0 +1,323 @@
+// Microbenchmarks of the client's hot paths, reporting MB/s and time per packet.
+// JSON results for tracking regressions: gyf-bench --benchmark_out=bench.json --benchmark_out_format=json
+#include <benchmark/benchmark.h>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <new>
+#include <random>
+#include <string>
+#include <string_view>
+#include <thread>
+#include "aes_wrapper.h"
+#include "checksum.h"
+#include "crc_handler.h"
+#include "file_chunker.h"
+#include "protocol_handler.h"
+#include "request.h"
+#include "request_pool.h"
+#include "transport.h"
+
+namespace {
+
+	std::atomic<uint64_t> heap_allocations{ 0 };
+
+	std::string random_bytes(size_t size) {
+		std::mt19937_64 generator(size);
+		std::string bytes(size, '\0');
+		for (size_t i = 0; i < size; ++i) {
+			bytes[i] = static_cast<char>(generator());
+		}
+		return bytes;
+	}
+
+	// a file with random content in the temp directory, removed once the benchmark is done
+	class TempFile {
+	private:
+		std::filesystem::path path;
+	public:
+		explicit TempFile(size_t size) : path(std::filesystem::temp_directory_path() / ("gyf_bench_" + std::to_string(size) + ".bin")) {
+			std::ofstream file(path, std::ios::binary);
+			std::string content = random_bytes(size);
+			file.write(content.data(), content.size());
+		}
+		~TempFile() {
+			std::error_code ignored;
+			std::filesystem::remove(path, ignored);
+		}
+		std::string get_path() const {
+			return path.string();
+		}
+	};
+
+	const std::string AES_KEY = random_bytes(AESWrapper::DEFAULT_KEYLENGTH);
+	const std::string CLIENT_ID = random_bytes(RequestHeader::SIZE_CLIENT_ID);
+
+	// time per packet, reported next to the throughput
+	void set_packet_counters(benchmark::State& state, int64_t packets, int64_t bytes) {
+		state.SetItemsProcessed(packets);
+		state.SetBytesProcessed(bytes);
+		state.counters["time_per_packet"] = benchmark::Counter(static_cast<double>(packets), benchmark::Counter::kIsRate | benchmark::Counter::kInvert);
+	}
+
+	void set_allocation_counter(benchmark::State& state, uint64_t allocations) {
+		state.counters["allocs_per_packet"] = benchmark::Counter(static_cast<double>(allocations), benchmark::Counter::kAvgIterations);
+	}
+}
+
+// every heap allocation in the process is counted, so the send path benchmarks can report allocations per packet.
+// The deletes stay out of line: inlined, GCC would pair their free() with operator new and warn (-Wmismatched-new-delete)
+void* operator new(std::size_t size) {
+	heap_allocations.fetch_add(1, std::memory_order_relaxed);
+	if (void* memory = std::malloc(size ? size : 1)) {
+		return memory;
+	}
+	throw std::bad_alloc();
+}
+void* operator new[](std::size_t size) {
+	return operator new(size);
+}
+[[gnu::noinline]] void operator delete(void* memory) noexcept {
+	std::free(memory);
+}
+[[gnu::noinline]] void operator delete(void* memory, std::size_t) noexcept {
+	std::free(memory);
+}
+[[gnu::noinline]] void operator delete[](void* memory) noexcept {
+	std::free(memory);
+}
+[[gnu::noinline]] void operator delete[](void* memory, std::size_t) noexcept {
+	std::free(memory);
+}
+
+static void BM_CRCHandlerMemcrc(benchmark::State& state) {
+	const size_t size = static_cast<size_t>(state.range(0));
+	const std::string data = random_bytes(size);
+	CRCHandler crc_handler;
+	for (auto _ : state) {
+		benchmark::DoNotOptimize(crc_handler.memcrc(data.data(), data.size()));
+	}
+	state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * size));
+}
+BENCHMARK(BM_CRCHandlerMemcrc)->RangeMultiplier(16)->Range(4 << 10, 64 << 20);
+
+// the checksum runs on a std::async thread, so the rate is taken over wall time
+static void BM_CRCHandlerCalculate(benchmark::State& state) {
+	const size_t size = static_cast<size_t>(state.range(0));
+	TempFile file(size);
+	CRCHandler crc_handler;
+	for (auto _ : state) {
+		benchmark::DoNotOptimize(crc_handler.calculate(file.get_path()).get());
+	}
+	state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * size));
+}
+BENCHMARK(BM_CRCHandlerCalculate)->RangeMultiplier(16)->Range(64 << 10, 256 << 20)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+// the file split into segments on up to range(1) threads and the partial CRCs combined, it has to match one thread;
+// the segments run on the pool, so the rate is taken over wall time
+static void BM_CRCHandlerCalculateParallel(benchmark::State& state) {
+	const size_t size = static_cast<size_t>(state.range(0));
+	TempFile file(size);
+	CRCHandler crc_handler(static_cast<unsigned int>(state.range(1)));
+	const unsigned long expected = CRCHandler(1).calculate(file.get_path()).get();
+	for (auto _ : state) {
+		if (crc_handler.calculate(file.get_path()).get() != expected) {
+			state.SkipWithError("the combined CRC differs from the single-threaded one");
+			break;
+		}
+	}
+	state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * size));
+}
+BENCHMARK(BM_CRCHandlerCalculateParallel)
+	->Args({ 64 << 20, 2 })->Args({ 64 << 20, 4 })->Args({ 64 << 20, 8 })
+	->Args({ 256 << 20, 2 })->Args({ 256 << 20, 4 })->Args({ 256 << 20, 8 })
+	->Unit(benchmark::kMillisecond)->UseRealTime();
+
+// merging two partial CRCs, which costs O(log length) multiplications
+static void BM_CRCCoreCombine(benchmark::State& state) {
+	const uint64_t length = static_cast<uint64_t>(state.range(0));
+	uint32_t crc = 0x12345678;
+	for (auto _ : state) {
+		crc = CRCCore::combine(crc, 0x9abcdef0, length);
+		benchmark::DoNotOptimize(crc);
+	}
+}
+BENCHMARK(BM_CRCCoreCombine)->RangeMultiplier(64)->Range(4 << 10, 1ll << 40);
+
+// the in-memory rate of each negotiable checksum, the file read is left out
+template<typename Policy>
+static void BM_ChecksumUpdate(benchmark::State& state) {
+	const size_t size = static_cast<size_t>(state.range(0));
+	const std::string data = random_bytes(size);
+	typename Policy::State checksum;
+	for (auto _ : state) {
+		Policy::start(checksum);
+		Policy::update(checksum, reinterpret_cast<const unsigned char*>(data.data()), data.size());
+		benchmark::DoNotOptimize(Policy::finish(checksum, size));
+	}
+	state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * size));
+}
+BENCHMARK_TEMPLATE(BM_ChecksumUpdate, Checksum::Cksum)->RangeMultiplier(16)->Range(4 << 10, 64 << 20);
+BENCHMARK_TEMPLATE(BM_ChecksumUpdate, Checksum::CRC32C)->RangeMultiplier(16)->Range(4 << 10, 64 << 20);
+#ifdef GYF_HAVE_XXHASH
+BENCHMARK_TEMPLATE(BM_ChecksumUpdate, Checksum::XXH3_64)->RangeMultiplier(16)->Range(4 << 10, 64 << 20);
+#endif
+
+// CRC32C on the slicing-by-8 tables, what machines without SSE4.2 get
+static void BM_CRC32CSoftware(benchmark::State& state) {
+	const size_t size = static_cast<size_t>(state.range(0));
+	const std::string data = random_bytes(size);
+	for (auto _ : state) {
+		benchmark::DoNotOptimize(CRC32CCore::update_software(CRC32CCore::START, reinterpret_cast<const unsigned char*>(data.data()), data.size()));
+	}
+	state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * size));
+}
+BENCHMARK(BM_CRC32CSoftware)->RangeMultiplier(16)->Range(4 << 10, 64 << 20);
+
+static void BM_AESWrapperEncrypt(benchmark::State& state) {
+	const size_t size = static_cast<size_t>(state.range(0));
+	const std::string plain = random_bytes(size);
+	AESWrapper aes_wrapper(AES_KEY.data(), static_cast<unsigned int>(AES_KEY.size()));
+	for (auto _ : state) {
+		benchmark::DoNotOptimize(aes_wrapper.encrypt(plain.data(), static_cast<unsigned int>(plain.size())));
+	}
+	state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * size));
+}
+BENCHMARK(BM_AESWrapperEncrypt)->RangeMultiplier(4)->Range(1 << 10, 16 << 20);
+
+// reading and encrypting the whole file, a block at a time as its chunks are taken
+static void BM_FileChunkerLoad(benchmark::State& state) {
+	const size_t size = static_cast<size_t>(state.range(0));
+	TempFile file(size);
+	for (auto _ : state) {
+		FileChunker chunker(file.get_path(), AES_KEY);
+		while (!chunker.is_finished()) {
+			benchmark::DoNotOptimize(chunker.get_next());
+		}
+	}
+	state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * size));
+}
+BENCHMARK(BM_FileChunkerLoad)->RangeMultiplier(16)->Range(4 << 10, 64 << 20)->Unit(benchmark::kMillisecond);
+
+// one iteration is one chunk, the chunker is rebuilt (untimed) once the file is exhausted
+static void BM_FileChunkerGetNext(benchmark::State& state) {
+	const size_t size = static_cast<size_t>(state.range(0));
+	TempFile file(size);
+	auto chunker = std::make_unique<FileChunker>(file.get_path(), AES_KEY);
+	int64_t bytes = 0;
+	for (auto _ : state) {
+		if (chunker->is_finished()) {
+			state.PauseTiming();
+			chunker = std::make_unique<FileChunker>(file.get_path(), AES_KEY);
+			state.ResumeTiming();
+		}
+		std::string_view chunk = chunker->get_next();
+		bytes += static_cast<int64_t>(chunk.size());
+		benchmark::DoNotOptimize(chunk);
+	}
+	set_packet_counters(state, static_cast<int64_t>(state.iterations()), bytes);
+}
+BENCHMARK(BM_FileChunkerGetNext)->RangeMultiplier(16)->Range(64 << 10, 64 << 20);
+
+// creating the request for a chunk and serializing it, as Client::send_file_chunks does per packet
+static void BM_SendFileRequestCreatePacket(benchmark::State& state) {
+	const size_t chunk_size = static_cast<size_t>(state.range(0));
+	const std::string chunk = random_bytes(chunk_size);
+	const ProtocolHandler& proto_handler = ProtocolHandler::get_instance();
+	uint64_t allocations = heap_allocations.load();
+	for (auto _ : state) {
+		SendFileRequest request = proto_handler.create_send_file_request(
+			CLIENT_ID, SendFileRequest::LARGE_FILES_VERSION, 1 << 20, 1 << 20, 0, 1, 256, "bench.bin", chunk
+		);
+		benchmark::DoNotOptimize(request.create_packet().data());
+	}
+	set_packet_counters(state, static_cast<int64_t>(state.iterations()), static_cast<int64_t>(state.iterations() * chunk_size));
+	set_allocation_counter(state, heap_allocations.load() - allocations);
+}
+BENCHMARK(BM_SendFileRequestCreatePacket)->RangeMultiplier(2)->Range(512, 64 << 10);
+
+// the same through the RequestPool, as Client::send_file_chunks does it: allocs_per_packet should be 0 after warm-up
+static void BM_SendFileRequestPooled(benchmark::State& state) {
+	const size_t chunk_size = static_cast<size_t>(state.range(0));
+	const std::string chunk = random_bytes(chunk_size);
+	const std::string file_name = "bench.bin";
+	const ProtocolHandler& proto_handler = ProtocolHandler::get_instance();
+	RequestPool<SendFileRequest> pool;
+	auto send_one = [&](uint32_t packet_number) {
+		const uint64_t offset = uint64_t(packet_number - 1) * chunk_size;
+		RequestPool<SendFileRequest>::Handle request = pool.acquire(
+			[&]() { return new SendFileRequest(proto_handler.create_send_file_request(CLIENT_ID, SendFileRequest::LARGE_FILES_VERSION, 1 << 20, 1 << 20, offset, packet_number, 256, file_name, chunk)); },
+			[&](SendFileRequest& reused) { reused.reset(CLIENT_ID, SendFileRequest::LARGE_FILES_VERSION, 1 << 20, 1 << 20, offset, packet_number, 256, file_name, chunk); }
+		);
+		benchmark::DoNotOptimize(request->create_packet().data());
+	};
+	send_one(1); // warm-up
+	uint64_t allocations = heap_allocations.load();
+	uint32_t packet_number = 1;
+	for (auto _ : state) {
+		send_one(++packet_number);
+	}
+	set_packet_counters(state, static_cast<int64_t>(state.iterations()), static_cast<int64_t>(state.iterations() * chunk_size));
+	set_allocation_counter(state, heap_allocations.load() - allocations);
+}
+BENCHMARK(BM_SendFileRequestPooled)->RangeMultiplier(2)->Range(512, 64 << 10);
+
+// the raw byte stream to the server, a packet per write, without the encryption and checksum of a real transfer.
+// The server end is accepted the way the mock server does it, on the reading thread: a Unix domain socket end only knows
+// whether it is UNIX or SHM once the client sent something.
+static void BM_TransportStream(benchmark::State& state) {
+	const size_t packet_size = static_cast<size_t>(state.range(0));
+	Transport::Address address;
+	address.kind = static_cast<Transport::Kind>(state.range(1));
+	const char* names[] = { "tcp", "unix", "shm" };
+	state.SetLabel(names[state.range(1)]);
+	const std::string packet = random_bytes(packet_size);
+	boost::asio::io_context io_context;
+	std::function<std::unique_ptr<Transport>()> accept;
+	boost::asio::ip::tcp::acceptor acceptor(io_context, boost::asio::ip::tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0));
+	if (address.kind == Transport::Kind::TCP) {
+		address.host = "127.0.0.1";
+		address.port = acceptor.local_endpoint().port();
+		accept = [&]() { return Transport::accept(acceptor.accept()); };
+	}
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+	address.path = (std::filesystem::temp_directory_path() / "gyf_bench_transport.sock").string();
+	std::filesystem::remove(address.path);
+	boost::asio::local::stream_protocol::acceptor local_acceptor(io_context, boost::asio::local::stream_protocol::endpoint(address.path));
+	if (address.kind != Transport::Kind::TCP) {
+		accept = [&]() { return Transport::accept(local_acceptor.accept()); };
+	}
+#endif
+	if (!accept) {
+		state.SkipWithError("Unix domain sockets are not supported on this platform");
+		return;
+	}
+	std::thread reading([&]() {
+		std::vector<uint8_t> buffer(64 << 10);
+		try {
+			std::unique_ptr<Transport> server = accept();
+			while (true) {
+				server->read_some(buffer.data(), buffer.size());
+			}
+		}
+		catch (const boost::system::system_error&) {
+			// the client end was shut down
+		}
+	});
+	std::unique_ptr<Transport> client = Transport::connect(address);
+	for (auto _ : state) {
+		client->write(reinterpret_cast<const uint8_t*>(packet.data()), packet.size());
+	}
+	client->shutdown();
+	reading.join();
+	std::error_code ignored;
+	std::filesystem::remove(address.path, ignored);
+	set_packet_counters(state, static_cast<int64_t>(state.iterations()), static_cast<int64_t>(state.iterations() * packet_size));
+}
+BENCHMARK(BM_TransportStream)->ArgsProduct({ { 512, 4096 + 288, 64 << 10 }, { 0, 1, 2 } })->UseRealTime();
+
+BENCHMARK_MAIN();
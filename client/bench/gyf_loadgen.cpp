@@ -0,0 +1,480 @@
+// Load generator: simulates many concurrent clients against a running server (python server/main.py) and reports the
+// throughput, latency percentiles and error rate per request code. Every simulated client is a chain of asynchronous
+// steps on one io_context run by a pool of threads; its packets are built by ProtocolHandler and the client's request
+// classes, and the responses read with the same layouts the client uses.
+// usage: gyf-loadgen [--host 127.0.0.1] [--port 1256] [--clients 1000] [--threads N] [--duration 30] [--file-size 16K]
+//                    [--mix register=1,reconnect=2,send=7] [--crc ok=90,bad=5,terminate=5]
+#include <unistd.h>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <boost/asio.hpp>
+#include "checksum.h"
+#include "crypto_manager.h"
+#include "file_chunker.h"
+#include "logger.h"
+#include "metrics.h"
+#include "protocol_handler.h"
+#include "response.h"
+#include "rsa_wrapper.h"
+
+using boost::asio::ip::tcp;
+
+namespace {
+
+	using Clock = std::chrono::steady_clock;
+
+	struct Options {
+		std::string host = "127.0.0.1";
+		uint16_t port = 1256;
+		size_t clients = 1000;
+		unsigned int threads = std::max(1u, std::thread::hardware_concurrency());
+		double duration = 30;
+		size_t file_size = 16 << 10;
+		std::map<std::string, unsigned int> mix = { { "register", 1 }, { "reconnect", 2 }, { "send", 7 } };
+		std::map<std::string, unsigned int> crc = { { "ok", 90 }, { "bad", 5 }, { "terminate", 5 } };
+	};
+
+	size_t parse_size(const std::string& text) {
+		size_t suffix_at = text.find_first_not_of("0123456789");
+		size_t value = std::stoull(text.substr(0, suffix_at));
+		std::string suffix = suffix_at == std::string::npos ? "" : text.substr(suffix_at);
+		if (suffix == "K" || suffix == "k") return value << 10;
+		if (suffix == "M" || suffix == "m") return value << 20;
+		if (suffix.empty()) return value;
+		throw std::invalid_argument("bad size " + text);
+	}
+
+	// "name=weight,name=weight", only the names already in weights are accepted
+	void parse_weights(const std::string& text, std::map<std::string, unsigned int>& weights) {
+		std::map<std::string, unsigned int> parsed;
+		for (auto& [name, weight] : weights) {
+			parsed[name] = 0;
+		}
+		std::istringstream list(text);
+		std::string item;
+		while (std::getline(list, item, ',')) {
+			size_t equals = item.find('=');
+			std::string name = item.substr(0, equals);
+			if (equals == std::string::npos || parsed.count(name) == 0) {
+				throw std::invalid_argument("bad weight " + item);
+			}
+			parsed[name] = static_cast<unsigned int>(std::stoul(item.substr(equals + 1)));
+		}
+		weights = parsed;
+	}
+
+	Options parse_options(int argc, char* argv[]) {
+		Options options;
+		for (int i = 1; i < argc; ++i) {
+			std::string arg = argv[i];
+			auto value = [&]() -> std::string {
+				if (i + 1 >= argc) {
+					throw std::invalid_argument("missing value for " + arg);
+				}
+				return argv[++i];
+			};
+			if (arg == "--host") options.host = value();
+			else if (arg == "--port") options.port = static_cast<uint16_t>(std::stoi(value()));
+			else if (arg == "--clients") options.clients = std::stoull(value());
+			else if (arg == "--threads") options.threads = std::max(1, std::stoi(value()));
+			else if (arg == "--duration") options.duration = std::stod(value());
+			else if (arg == "--file-size") options.file_size = std::max<size_t>(1, parse_size(value()));
+			else if (arg == "--mix") parse_weights(value(), options.mix);
+			else if (arg == "--crc") parse_weights(value(), options.crc);
+			else throw std::invalid_argument("unknown option " + arg);
+		}
+		if (options.mix["register"] + options.mix["reconnect"] + options.mix["send"] == 0 ||
+			options.crc["ok"] + options.crc["bad"] + options.crc["terminate"] == 0) {
+			throw std::invalid_argument("every weight is zero");
+		}
+		return options;
+	}
+
+	// the request codes measured, a request whose response is wrong or missing (or whose connection failed) is an error
+	enum class Op : uint8_t { REGISTER, SEND_PUBLIC_KEY, RECONNECT, SEND_FILE, CRC_OK, CRC_BAD, CRC_TERMINATE, COUNT };
+	constexpr size_t OP_COUNT = static_cast<size_t>(Op::COUNT);
+	constexpr uint16_t OP_CODES[OP_COUNT] = {
+		RegisterRequest::CODE, SendPublicKeyRequest::CODE, ReconnectRequest::CODE, SendFileRequest::CODE,
+		SendCRCStateRequest::CODE_CORRECT, SendCRCStateRequest::CODE_INCORRECT, SendCRCStateRequest::CODE_ELIMINATE
+	};
+	constexpr const char* OP_NAMES[OP_COUNT] = { "register", "public_key", "reconnect", "send_file", "crc_ok", "crc_bad", "crc_terminate" };
+
+	// latencies land in the buckets of Metrics::Histogram, shared by every thread
+	struct OpStats {
+		std::atomic<uint64_t> count{ 0 };
+		std::atomic<uint64_t> errors{ 0 };
+		std::atomic<uint64_t> max_ns{ 0 };
+		std::array<std::atomic<uint64_t>, Metrics::Histogram::BUCKET_COUNT> buckets{};
+	};
+	std::array<OpStats, OP_COUNT> op_stats;
+	std::atomic<uint64_t> file_bytes{ 0 }; // plain bytes of the files the server accepted
+
+	void record(Op op, Clock::time_point started, bool ok) {
+		OpStats& stats = op_stats[static_cast<size_t>(op)];
+		uint64_t ns = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - started).count());
+		stats.count.fetch_add(1, std::memory_order_relaxed);
+		if (!ok) {
+			stats.errors.fetch_add(1, std::memory_order_relaxed);
+		}
+		stats.buckets[Metrics::Histogram::index_of(ns)].fetch_add(1, std::memory_order_relaxed);
+		uint64_t max = stats.max_ns.load(std::memory_order_relaxed);
+		while (ns > max && !stats.max_ns.compare_exchange_weak(max, ns, std::memory_order_relaxed)) {
+		}
+	}
+
+	// what every simulated client shares: one RSA key pair (the server does not care), the file and its cksum
+	struct Shared {
+		Options options;
+		tcp::endpoint endpoint;
+		std::string private_key;
+		std::string public_key;
+		std::string file;
+		uint32_t file_crc = 0;
+		std::atomic<bool> running{ true };
+	};
+
+	std::string decrypt_aes_key(const Shared& shared, std::string_view encrypted) {
+		thread_local RSAPrivateWrapper rsa_private(shared.private_key); // its random pool is not thread safe
+		return rsa_private.decrypt(encrypted.data(), static_cast<unsigned int>(encrypted.size()));
+	}
+
+	class SimulatedClient : public std::enable_shared_from_this<SimulatedClient> {
+	private:
+		using Handler = std::function<void(const ResponseHeader&, std::string_view)>;
+
+		Shared& shared;
+		const ProtocolHandler& proto_handler = ProtocolHandler::get_instance();
+		const size_t index;
+		tcp::socket socket;
+		std::mt19937 rng;
+		unsigned int registrations = 0;
+		unsigned int files_sent = 0;
+		bool connected = false; // connected with an AES key
+		uint8_t server_version = 0; // from the last response, picks the send file layout
+		std::string name;
+		std::string id;
+		std::string aes_key;
+
+		std::vector<uint8_t> out;
+		std::array<uint8_t, ResponseHeader::SIZE> header_buffer{};
+		std::string payload;
+
+		unsigned int pick(const std::map<std::string, unsigned int>& weights, std::string& picked) {
+			unsigned int total = 0;
+			for (auto& [key, weight] : weights) {
+				total += weight;
+			}
+			unsigned int roll = std::uniform_int_distribution<unsigned int>(0, total - 1)(rng);
+			for (auto& [key, weight] : weights) {
+				if (roll < weight) {
+					picked = key;
+					break;
+				}
+				roll -= weight;
+			}
+			return total;
+		}
+
+		void fail(Op op, Clock::time_point started) {
+			if (shared.running.load(std::memory_order_relaxed)) { // not a request stop() cancelled
+				record(op, started, false);
+			}
+			boost::system::error_code ignored;
+			socket.close(ignored);
+			connected = false;
+			next();
+		}
+
+		// writes out, then reads one response into payload (none when handler is empty) and records the latency
+		void exchange(Op op, Handler handler) {
+			Clock::time_point started = Clock::now();
+			auto self = shared_from_this();
+			boost::asio::async_write(socket, boost::asio::buffer(out), [this, self, op, started, handler](boost::system::error_code error, size_t) {
+				if (error) {
+					return fail(op, started);
+				}
+				if (!handler) {
+					record(op, started, true);
+					return next();
+				}
+				boost::asio::async_read(socket, boost::asio::buffer(header_buffer), [this, self, op, started, handler](boost::system::error_code error, size_t) {
+					if (error) {
+						return fail(op, started);
+					}
+					ResponseHeader header = ResponseHeader::unpack(header_buffer.data());
+					server_version = header.version;
+					payload.resize(header.payload_size);
+					boost::asio::async_read(socket, boost::asio::buffer(&payload[0], payload.size()), [this, self, op, started, handler, header](boost::system::error_code error, size_t) {
+						if (error) {
+							return fail(op, started);
+						}
+						handler(header, payload);
+					});
+				});
+			});
+		}
+
+		template<typename RequestType>
+		void prepare(const RequestType& request) {
+			const std::vector<uint8_t>& packet = request.create_packet();
+			out.assign(packet.begin(), packet.end());
+		}
+
+		// a new connection, then then() (or the next operation if it fails)
+		void connect(Op op, std::function<void()> then) {
+			Clock::time_point started = Clock::now();
+			boost::system::error_code ignored;
+			socket.close(ignored);
+			connected = false;
+			auto self = shared_from_this();
+			socket.async_connect(shared.endpoint, [this, self, op, started, then](boost::system::error_code error) {
+				if (error) {
+					return fail(op, started);
+				}
+				then();
+			});
+		}
+
+		void do_register() {
+			name = "loadgen-" + std::to_string(getpid()) + "-" + std::to_string(index) + "-" + std::to_string(registrations++);
+			connect(Op::REGISTER, [this]() {
+				prepare(proto_handler.create_registration_request(name));
+				Clock::time_point started = Clock::now();
+				exchange(Op::REGISTER, [this, started](const ResponseHeader& header, std::string_view response) {
+					if (header.code != ResponseCode::REGISTER_SUCCESS || response.size() < RequestHeader::SIZE_CLIENT_ID) {
+						return fail(Op::REGISTER, started);
+					}
+					record(Op::REGISTER, started, true);
+					id = std::string(response.substr(0, RequestHeader::SIZE_CLIENT_ID));
+					do_send_public_key();
+				});
+			});
+		}
+
+		void do_send_public_key() {
+			prepare(proto_handler.create_send_public_key_request(id, name, shared.public_key));
+			Clock::time_point started = Clock::now();
+			exchange(Op::SEND_PUBLIC_KEY, [this, started](const ResponseHeader& header, std::string_view response) {
+				accept_aes_key(Op::SEND_PUBLIC_KEY, started, header.code == ResponseCode::AES_KEY, response);
+			});
+		}
+
+		void do_reconnect() {
+			connect(Op::RECONNECT, [this]() {
+				prepare(proto_handler.create_reconnect_request(id, name));
+				Clock::time_point started = Clock::now();
+				exchange(Op::RECONNECT, [this, started](const ResponseHeader& header, std::string_view response) {
+					accept_aes_key(Op::RECONNECT, started, header.code == ResponseCode::RECONNECT_SUCCESS, response);
+				});
+			});
+		}
+
+		void accept_aes_key(Op op, Clock::time_point started, bool accepted, std::string_view response) {
+			if (!accepted || response.size() <= RequestHeader::SIZE_CLIENT_ID) {
+				return fail(op, started);
+			}
+			try {
+				aes_key = decrypt_aes_key(shared, response.substr(RequestHeader::SIZE_CLIENT_ID));
+			}
+			catch (const std::exception&) {
+				return fail(op, started);
+			}
+			record(op, started, true);
+			connected = true;
+			next();
+		}
+
+		// every packet of the file in out, written at once; the server answers after the last one
+		void do_send_file(const std::string& file_name, const std::string& crc_state) {
+			std::string plain = shared.file;
+			std::string encrypted = CryptoManager::get_instance().aes_encrypt(aes_key, plain);
+			const size_t chunk = FileChunker::CHUNK_SIZE;
+			const uint32_t total_packets = static_cast<uint32_t>((encrypted.size() + chunk - 1) / chunk);
+			const uint8_t version = std::min(SendFileRequest::LARGE_FILES_VERSION, server_version);
+			out.clear();
+			for (uint32_t packet = 1; packet <= total_packets; ++packet) {
+				const uint64_t offset = uint64_t(packet - 1) * chunk;
+				std::string_view content = std::string_view(encrypted).substr(offset, chunk);
+				SendFileRequest request = proto_handler.create_send_file_request(id, version, encrypted.size(), plain.size(),
+					offset, packet, total_packets, file_name, content);
+				const std::vector<uint8_t>& bytes = request.create_packet();
+				out.insert(out.end(), bytes.begin(), bytes.end());
+			}
+			Clock::time_point started = Clock::now();
+			exchange(Op::SEND_FILE, [this, started, file_name, crc_state](const ResponseHeader& header, std::string_view response) {
+				if (header.code != ResponseCode::SEND_FILE_SUCCESS || response.size() < ResponsePayload::SendFileLayout::SIZE) {
+					return fail(Op::SEND_FILE, started);
+				}
+				auto [client_id, content_size, response_name, crc] = ResponsePayload::SendFileLayout::read(reinterpret_cast<const uint8_t*>(response.data()));
+				record(Op::SEND_FILE, started, crc == shared.file_crc);
+				file_bytes.fetch_add(shared.file.size(), std::memory_order_relaxed);
+				send_crc_state(file_name, crc_state);
+			});
+		}
+
+		void send_crc_state(const std::string& file_name, const std::string& crc_state) {
+			if (crc_state == "bad") { // no response, the file is sent again and confirmed
+				prepare(proto_handler.create_crc_state_request(id, file_name, 1));
+				Clock::time_point started = Clock::now();
+				auto self = shared_from_this();
+				boost::asio::async_write(socket, boost::asio::buffer(out), [this, self, started, file_name](boost::system::error_code error, size_t) {
+					if (error) {
+						return fail(Op::CRC_BAD, started);
+					}
+					record(Op::CRC_BAD, started, true);
+					do_send_file(file_name, "ok");
+				});
+				return;
+			}
+			Op op = crc_state == "ok" ? Op::CRC_OK : Op::CRC_TERMINATE;
+			prepare(proto_handler.create_crc_state_request(id, file_name, op == Op::CRC_OK ? 0 : 2));
+			Clock::time_point started = Clock::now();
+			exchange(op, [this, op, started](const ResponseHeader& header, std::string_view) {
+				if (header.code != ResponseCode::MESSAGE_CONFIRM) {
+					return fail(op, started);
+				}
+				record(op, started, true);
+				next();
+			});
+		}
+
+	public:
+		SimulatedClient(Shared& shared, boost::asio::io_context& io_context, size_t index)
+			: shared(shared), index(index), socket(boost::asio::make_strand(io_context)), rng(static_cast<unsigned int>(index * 7919 + getpid())) {
+		}
+
+		void start() {
+			boost::asio::post(socket.get_executor(), [self = shared_from_this()]() { self->next(); });
+		}
+
+		// cancels the request in flight, its handler sees running is false and stops
+		void stop() {
+			boost::asio::post(socket.get_executor(), [self = shared_from_this()]() {
+				boost::system::error_code ignored;
+				self->socket.close(ignored);
+			});
+		}
+
+		void next() {
+			if (!shared.running.load(std::memory_order_relaxed)) {
+				boost::system::error_code ignored;
+				socket.close(ignored);
+				return;
+			}
+			if (id.empty()) {
+				return do_register();
+			}
+			std::string op;
+			pick(shared.options.mix, op);
+			if (op == "register") {
+				return do_register();
+			}
+			if (op == "reconnect" || !connected) {
+				return do_reconnect();
+			}
+			std::string crc_state;
+			pick(shared.options.crc, crc_state);
+			do_send_file("loadgen-" + std::to_string(files_sent++ % 4) + ".bin", crc_state);
+		}
+	};
+
+	void print_report(const Options& options, double seconds) {
+		std::printf("%zu clients on %u threads for %.1f s, %zu byte files\n", options.clients, options.threads, seconds, options.file_size);
+		std::printf("%-5s %-14s %10s %8s %7s %10s %10s %10s %10s %10s\n",
+			"code", "request", "count", "errors", "err%", "ops/s", "p50_ms", "p99_ms", "p999_ms", "max_ms");
+		uint64_t total = 0, total_errors = 0;
+		for (size_t i = 0; i < OP_COUNT; ++i) {
+			const OpStats& stats = op_stats[i];
+			Metrics::StageSnapshot snapshot; // only for its percentile()
+			snapshot.count = stats.count.load();
+			snapshot.max_ns = stats.max_ns.load();
+			for (size_t b = 0; b < snapshot.buckets.size(); ++b) {
+				snapshot.buckets[b] = stats.buckets[b].load();
+			}
+			uint64_t errors = stats.errors.load();
+			total += snapshot.count;
+			total_errors += errors;
+			std::printf("%-5u %-14s %10llu %8llu %7.2f %10.1f %10.2f %10.2f %10.2f %10.2f\n", OP_CODES[i], OP_NAMES[i],
+				static_cast<unsigned long long>(snapshot.count), static_cast<unsigned long long>(errors),
+				snapshot.count ? 100.0 * errors / snapshot.count : 0.0, snapshot.count / seconds,
+				snapshot.percentile(0.5) / 1e6, snapshot.percentile(0.99) / 1e6, snapshot.percentile(0.999) / 1e6, snapshot.max_ns / 1e6);
+		}
+		std::printf("total: %llu requests (%.1f/s), %llu errors (%.2f%%), %.2f MB/s of file data accepted\n",
+			static_cast<unsigned long long>(total), total / seconds, static_cast<unsigned long long>(total_errors),
+			total ? 100.0 * total_errors / total : 0.0, file_bytes.load() / seconds / (1 << 20));
+	}
+}
+
+int main(int argc, char* argv[]) {
+	Shared shared;
+	try {
+		shared.options = parse_options(argc, argv);
+	}
+	catch (const std::exception& e) {
+		std::cerr << "<Error>: " << e.what() << std::endl;
+		std::cerr << "usage: gyf-loadgen [--host 127.0.0.1] [--port 1256] [--clients 1000] [--threads N] [--duration 30] [--file-size 16K] "
+			"[--mix register=1,reconnect=2,send=7] [--crc ok=90,bad=5,terminate=5]" << std::endl;
+		return 1;
+	}
+	const Options& options = shared.options;
+	Log::Logger::get_instance().set_level(Log::Level::Warning);
+
+	boost::asio::io_context io_context;
+	try {
+		tcp::resolver resolver(io_context);
+		shared.endpoint = *resolver.resolve(options.host, std::to_string(options.port)).begin();
+	}
+	catch (const std::exception& e) {
+		std::cerr << "<Error>: Could not resolve " << options.host << ": " << e.what() << std::endl;
+		return 1;
+	}
+	RSAPrivateWrapper rsa_private;
+	shared.private_key = rsa_private.getPrivateKey();
+	shared.public_key = rsa_private.getPublicKey();
+	std::mt19937_64 generator(options.file_size);
+	shared.file.resize(options.file_size);
+	for (char& c : shared.file) {
+		c = static_cast<char>(generator());
+	}
+	Checksum::Cksum::State crc;
+	Checksum::Cksum::start(crc);
+	Checksum::Cksum::update(crc, reinterpret_cast<const unsigned char*>(shared.file.data()), shared.file.size());
+	shared.file_crc = static_cast<uint32_t>(Checksum::Cksum::finish(crc, shared.file.size()));
+
+	std::vector<std::shared_ptr<SimulatedClient>> clients;
+	for (size_t i = 0; i < options.clients; ++i) {
+		clients.push_back(std::make_shared<SimulatedClient>(shared, io_context, i));
+		clients.back()->start();
+	}
+	Clock::time_point started = Clock::now();
+	std::vector<std::thread> threads;
+	for (unsigned int i = 0; i < options.threads; ++i) {
+		threads.emplace_back([&io_context]() { io_context.run(); });
+	}
+	std::this_thread::sleep_for(std::chrono::duration<double>(options.duration));
+	shared.running = false;
+	for (auto& client : clients) {
+		client->stop();
+	}
+	double seconds = std::chrono::duration<double>(Clock::now() - started).count();
+	for (std::thread& thread : threads) {
+		thread.join();
+	}
+	print_report(options, seconds);
+	Log::Logger::get_instance().flush();
+	return 0;
+}
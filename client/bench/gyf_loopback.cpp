@@ -0,0 +1,330 @@
+// End-to-end loopback harness: drives Client against the in-process MockServer on synthetic files and reports throughput,
+// handshake latency, packets/s and peak RSS. Each case runs in a forked child, so its peak RSS is its own.
+// usage: gyf-loopback [--sizes 1K,1M,128M] [--runs N] [--latency-ms MS] [--bandwidth-mbit MBIT] [--checksum xxh3,crc32c,cksum] [--transport tcp|unix|shm] [--sparse] [--verbose] [--keep-files]
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "checksum.h"
+#include "client.hpp"
+#include "file_chunker.h"
+#include "link_shaper.h"
+#include "logger.h"
+#include "mock_server.h"
+
+namespace {
+
+	struct Options {
+		std::vector<uint64_t> sizes;
+		int runs = 1;
+		std::chrono::microseconds latency{ 0 }; // one-way
+		uint64_t bandwidth = 0; // bytes per second, 0 for unlimited
+		bool verbose = false;
+		bool keep_files = false;
+		std::vector<Checksum::Algorithm> checksums = Checksum::default_preference();
+		Transport::Kind transport = Transport::Kind::TCP;
+		bool sparse = false; // SPARSE_STRIDE: 1 MB of data, 1 MB of written zeros, the rest a hole
+	};
+
+	constexpr uint64_t SPARSE_STRIDE = 16 << 20;
+	constexpr uint64_t SPARSE_DATA = 1 << 20;
+
+	// written by the child to the parent through a pipe, so it stays plain data
+	struct CaseResult {
+		bool ok;
+		double total_seconds;
+		double handshake_ms;
+		double prepare_ms; // between the handshake and the first packet (reading and encrypting the file)
+		double transfer_seconds; // first to last packet
+		uint64_t packets;
+		uint64_t wire_bytes;
+		long peak_rss_kb;
+		char error[256];
+	};
+
+	// swallows whatever still writes to the standard streams directly
+	class NullBuffer : public std::streambuf {
+	protected:
+		int overflow(int c) override {
+			return c;
+		}
+	};
+
+	uint64_t parse_size(const std::string& text) {
+		size_t end = 0;
+		uint64_t value = std::stoull(text, &end);
+		std::string suffix = text.substr(end);
+		if (suffix == "K" || suffix == "k") return value << 10;
+		if (suffix == "M" || suffix == "m") return value << 20;
+		if (suffix == "G" || suffix == "g") return value << 30;
+		if (!suffix.empty()) {
+			throw std::invalid_argument("unknown size suffix: " + suffix);
+		}
+		return value;
+	}
+
+	Transport::Kind parse_transport(const std::string& name) {
+		if (name == "tcp") return Transport::Kind::TCP;
+		if (name == "unix") return Transport::Kind::UNIX;
+		if (name == "shm") return Transport::Kind::SHM;
+		throw std::invalid_argument("unknown transport: " + name);
+	}
+
+	const char* transport_name(Transport::Kind kind) {
+		switch (kind) {
+		case Transport::Kind::UNIX: return "unix";
+		case Transport::Kind::SHM: return "shm";
+		default: return "tcp";
+		}
+	}
+
+	std::string format_size(uint64_t size) {
+		const char* suffixes[] = { "B", "K", "M", "G" };
+		int index = 0;
+		while (index < 3 && size >= 1024 && size % 1024 == 0) {
+			size /= 1024;
+			++index;
+		}
+		return std::to_string(size) + suffixes[index];
+	}
+
+	Options parse_options(int argc, char* argv[]) {
+		Options options;
+		std::string sizes = "1K,64K,1M,16M,128M,1G,10G";
+		for (int i = 1; i < argc; ++i) {
+			std::string arg = argv[i];
+			auto value = [&]() -> std::string {
+				if (i + 1 >= argc) {
+					throw std::invalid_argument("missing value for " + arg);
+				}
+				return argv[++i];
+			};
+			if (arg == "--sizes") sizes = value();
+			else if (arg == "--runs") options.runs = std::stoi(value());
+			else if (arg == "--latency-ms") options.latency = std::chrono::microseconds(static_cast<int64_t>(std::stod(value()) * 1000));
+			else if (arg == "--bandwidth-mbit") options.bandwidth = static_cast<uint64_t>(std::stod(value()) * 1000000 / 8);
+			else if (arg == "--checksum") {
+				if (!Checksum::parse_preference(value(), options.checksums)) {
+					throw std::invalid_argument("unknown or unavailable checksum in " + arg);
+				}
+			}
+			else if (arg == "--transport") options.transport = parse_transport(value());
+			else if (arg == "--sparse") options.sparse = true;
+			else if (arg == "--verbose") options.verbose = true;
+			else if (arg == "--keep-files") options.keep_files = true;
+			else throw std::invalid_argument("unknown option " + arg);
+		}
+		std::istringstream list(sizes);
+		std::string size;
+		while (std::getline(list, size, ',')) {
+			options.sizes.push_back(parse_size(size));
+		}
+		if (options.transport != Transport::Kind::TCP && (options.latency.count() > 0 || options.bandwidth > 0)) {
+			throw std::invalid_argument("the link shaper only forwards TCP");
+		}
+		return options;
+	}
+
+	// the v4 send file request numbers packets with 32 bits (16 TB in 4 KB chunks), its sizes are 64-bit
+	bool fits_protocol(uint64_t size) {
+		constexpr uint64_t AES_BLOCK_SIZE = 16;
+		uint64_t encrypted_size = (size / AES_BLOCK_SIZE + 1) * AES_BLOCK_SIZE; // PKCS#7 always pads
+		uint64_t packets = (encrypted_size + FileChunker::CHUNK_SIZE - 1) / FileChunker::CHUNK_SIZE;
+		return packets <= std::numeric_limits<uint32_t>::max();
+	}
+
+	void write_synthetic_file(const std::filesystem::path& path, uint64_t size, bool sparse) {
+		std::ofstream file(path, std::ios::binary);
+		std::mt19937_64 generator(size);
+		std::vector<uint64_t> block(128 * 1024);
+		const std::vector<char> zeros(block.size() * sizeof(uint64_t));
+		for (uint64_t pos = 0; pos < size;) {
+			uint64_t in_stride = pos % SPARSE_STRIDE;
+			if (sparse && in_stride >= 2 * SPARSE_DATA) { // the hole up to the next stride
+				pos = std::min(size, pos - in_stride + SPARSE_STRIDE);
+				file.seekp(static_cast<std::streamoff>(pos));
+				continue;
+			}
+			size_t length = static_cast<size_t>(std::min<uint64_t>(size - pos, zeros.size()));
+			if (sparse && in_stride >= SPARSE_DATA) {
+				file.write(zeros.data(), length);
+			}
+			else {
+				for (uint64_t& word : block) {
+					word = generator();
+				}
+				file.write(reinterpret_cast<const char*>(block.data()), length);
+			}
+			pos += length;
+		}
+		file.close();
+		if (!file) {
+			throw std::runtime_error("could not write " + path.string());
+		}
+		std::filesystem::resize_file(path, size); // a trailing hole
+	}
+
+	double milliseconds(MockServer::Clock::duration duration) {
+		return std::chrono::duration<double, std::milli>(duration).count();
+	}
+
+	// runs in the child: one full client session against a fresh mock server
+	CaseResult run_case(const Options& options, uint64_t size) {
+		CaseResult result{};
+		std::filesystem::path directory = std::filesystem::temp_directory_path() / ("gyf_loopback_" + std::to_string(getpid()));
+		std::filesystem::create_directories(directory);
+		NullBuffer null_buffer;
+		std::streambuf* cout_buffer = std::cout.rdbuf();
+		std::streambuf* cerr_buffer = std::cerr.rdbuf();
+		try {
+			write_synthetic_file(directory / "payload.bin", size, options.sparse);
+			MockServer server(options.transport);
+			server.start();
+			std::unique_ptr<LinkShaper> shaper;
+			Transport::Address address = server.get_address();
+			if (options.latency.count() > 0 || options.bandwidth > 0) {
+				shaper = std::make_unique<LinkShaper>(address.port, options.latency, options.bandwidth);
+				shaper->start();
+				address.port = shaper->get_port();
+			}
+			std::ofstream(directory / "transfer.info") << address.to_string() << "\nloopback\npayload.bin\n";
+			std::filesystem::current_path(directory);
+
+			if (!options.verbose) {
+				Log::Logger::get_instance().set_level(Log::Level::Off);
+				std::cout.rdbuf(&null_buffer);
+				std::cerr.rdbuf(&null_buffer);
+			}
+			auto started = MockServer::Clock::now();
+			{
+				Client client;
+				client.set_checksum_preference(options.checksums);
+				client.start();
+			}
+			auto finished = MockServer::Clock::now();
+			Log::Logger::get_instance().flush();
+			std::cout.rdbuf(cout_buffer);
+			std::cerr.rdbuf(cerr_buffer);
+			if (shaper) {
+				shaper->stop();
+			}
+			server.stop();
+
+			MockServer::TransferStats stats = server.get_stats();
+			result.ok = stats.completed && stats.plain_bytes == size;
+			if (!result.ok) {
+				std::snprintf(result.error, sizeof(result.error), "server did not confirm the file");
+			}
+			result.total_seconds = std::chrono::duration<double>(finished - started).count();
+			result.handshake_ms = milliseconds(stats.key_sent - stats.accepted);
+			result.prepare_ms = milliseconds(stats.first_packet - stats.key_sent);
+			result.transfer_seconds = milliseconds(stats.last_packet - stats.first_packet) / 1000;
+			result.packets = stats.packets;
+			result.wire_bytes = stats.wire_bytes;
+		}
+		catch (const std::exception& e) {
+			std::cout.rdbuf(cout_buffer);
+			std::cerr.rdbuf(cerr_buffer);
+			result.ok = false;
+			std::snprintf(result.error, sizeof(result.error), "%s", e.what());
+		}
+		struct rusage usage;
+		getrusage(RUSAGE_SELF, &usage);
+		result.peak_rss_kb = usage.ru_maxrss;
+		if (!options.keep_files) {
+			std::error_code ignored;
+			std::filesystem::remove_all(directory, ignored);
+		}
+		return result;
+	}
+
+	CaseResult run_forked(const Options& options, uint64_t size) {
+		int fds[2];
+		if (pipe(fds) != 0) {
+			throw std::runtime_error("pipe failed");
+		}
+		// the child would inherit whatever is still buffered and print it again when its logger flushes
+		std::fflush(stdout);
+		std::fflush(stderr);
+		pid_t pid = fork();
+		if (pid < 0) {
+			throw std::runtime_error("fork failed");
+		}
+		if (pid == 0) {
+			close(fds[0]);
+			CaseResult result = run_case(options, size);
+			ssize_t written = write(fds[1], &result, sizeof(result));
+			_exit(written == sizeof(result) ? 0 : 1);
+		}
+		close(fds[1]);
+		CaseResult result{};
+		ssize_t received = read(fds[0], &result, sizeof(result));
+		close(fds[0]);
+		int status = 0;
+		waitpid(pid, &status, 0);
+		if (received != sizeof(result)) {
+			result = CaseResult{};
+			std::snprintf(result.error, sizeof(result.error), "child exited with status %d", status);
+		}
+		return result;
+	}
+
+	double mb_per_second(uint64_t bytes, double seconds) {
+		return seconds > 0 ? bytes / seconds / 1e6 : 0;
+	}
+}
+
+int main(int argc, char* argv[]) {
+	Options options;
+	try {
+		options = parse_options(argc, argv);
+	}
+	catch (const std::exception& e) {
+		std::cerr << "<Error>: " << e.what() << std::endl;
+		std::cerr << "usage: gyf-loopback [--sizes 1K,1M,128M] [--runs N] [--latency-ms MS] [--bandwidth-mbit MBIT] [--checksum xxh3,crc32c,cksum] [--transport tcp|unix|shm] [--sparse] [--verbose] [--keep-files]" << std::endl;
+		return 1;
+	}
+	std::printf("link: latency %.1f ms one-way, bandwidth %s\n", options.latency.count() / 1000.0,
+		options.bandwidth ? (std::to_string(options.bandwidth * 8 / 1000000) + " Mbit/s").c_str() : "unlimited");
+	std::printf("checksum: %s, transport: %s\n", Checksum::get_name(options.checksums.front()), transport_name(options.transport));
+	std::printf("%8s %4s %12s %11s %10s %10s %10s %11s %9s  %s\n",
+		"size", "run", "handshake_ms", "prepare_ms", "xfer_s", "xfer_MB/s", "e2e_MB/s", "packets/s", "rss_MB", "status");
+	int failures = 0;
+	for (uint64_t size : options.sizes) {
+		if (!fits_protocol(size)) {
+			std::printf("%8s %4s %12s %11s %10s %10s %10s %11s %9s  %s\n", format_size(size).c_str(), "-", "-", "-", "-", "-", "-", "-", "-",
+				"skipped: exceeds the v4 send file limits");
+			continue;
+		}
+		for (int run = 1; run <= options.runs; ++run) {
+			CaseResult result = run_forked(options, size);
+			failures += result.ok ? 0 : 1;
+			std::printf("%8s %4d %12.2f %11.2f %10.3f %10.1f %10.1f %11.0f %9.1f  %s\n",
+				format_size(size).c_str(), run,
+				result.handshake_ms,
+				result.prepare_ms,
+				result.transfer_seconds,
+				mb_per_second(size, result.transfer_seconds),
+				mb_per_second(size, result.total_seconds),
+				result.transfer_seconds > 0 ? result.packets / result.transfer_seconds : 0,
+				result.peak_rss_kb / 1024.0,
+				result.ok ? "ok" : result.error);
+			std::fflush(stdout);
+		}
+	}
+	return failures == 0 ? 0 : 1;
+}
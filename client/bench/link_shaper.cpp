@@ -0,0 +1,165 @@
+#include "link_shaper.h"
+#include <algorithm>
+#include <iostream>
+
+using boost::asio::ip::tcp;
+
+LinkShaper::LinkShaper(uint16_t upstream_port, std::chrono::microseconds latency, uint64_t bandwidth) :
+	upstream_port(upstream_port),
+	latency(latency),
+	bandwidth(bandwidth),
+	queue_limit(std::max<size_t>(MIN_QUEUE_LIMIT, static_cast<size_t>(2 * bandwidth * latency.count() / 1000000))),
+	acceptor(io_context, tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0))
+{
+}
+
+LinkShaper::~LinkShaper()
+{
+	stop();
+}
+
+uint16_t LinkShaper::get_port() const
+{
+	return acceptor.local_endpoint().port();
+}
+
+void LinkShaper::start()
+{
+	running = true;
+	thread = std::thread(&LinkShaper::serve, this);
+}
+
+void LinkShaper::stop()
+{
+	if (!running.exchange(false)) {
+		return;
+	}
+	boost::system::error_code ignored;
+	{
+		std::lock_guard<std::mutex> lock(sockets_mutex);
+		for (tcp::socket* socket : active_sockets) {
+			socket->shutdown(tcp::socket::shutdown_both, ignored);
+		}
+	}
+	// wakes the blocking accept with a connection of our own
+	tcp::socket waker(io_context);
+	waker.connect(tcp::endpoint(boost::asio::ip::address_v4::loopback(), get_port()), ignored);
+	thread.join();
+}
+
+void LinkShaper::serve()
+{
+	while (running) {
+		tcp::socket client(io_context), server(io_context);
+		boost::system::error_code error;
+		acceptor.accept(client, error);
+		if (error || !running) {
+			continue;
+		}
+		server.connect(tcp::endpoint(boost::asio::ip::address_v4::loopback(), upstream_port), error);
+		if (error) {
+			std::cerr << "<Error>: Link shaper could not reach the upstream port " << upstream_port << ": " << error.message() << std::endl;
+			continue;
+		}
+		client.set_option(tcp::no_delay(true));
+		server.set_option(tcp::no_delay(true));
+		{
+			std::lock_guard<std::mutex> lock(sockets_mutex);
+			active_sockets = { &client, &server };
+		}
+		relay(client, server);
+		std::lock_guard<std::mutex> lock(sockets_mutex);
+		active_sockets.clear();
+	}
+}
+
+void LinkShaper::relay(tcp::socket& client, tcp::socket& server)
+{
+	Pipe upstream(*this, client, server), downstream(*this, server, client);
+	std::thread threads[] = {
+		std::thread(&Pipe::read_loop, &upstream),
+		std::thread(&Pipe::write_loop, &upstream),
+		std::thread(&Pipe::read_loop, &downstream),
+		std::thread(&Pipe::write_loop, &downstream),
+	};
+	for (std::thread& thread : threads) {
+		thread.join();
+	}
+}
+
+// =========== Pipe ===========
+
+LinkShaper::Pipe::Pipe(const LinkShaper& shaper, tcp::socket& from, tcp::socket& to) : shaper(shaper), from(from), to(to)
+{
+}
+
+void LinkShaper::Pipe::close()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	closed = true;
+	changed.notify_all();
+}
+
+void LinkShaper::Pipe::read_loop()
+{
+	while (true) {
+		std::vector<uint8_t> data(READ_SIZE);
+		boost::system::error_code error;
+		size_t length = from.read_some(boost::asio::buffer(data), error);
+		if (error) {
+			break; // the sender is done (or gone), the writer drains what is left
+		}
+		data.resize(length);
+		std::unique_lock<std::mutex> lock(mutex);
+		changed.wait(lock, [this] { return queued < shaper.queue_limit || closed; });
+		if (closed) {
+			return;
+		}
+		queued += length;
+		segments.push_back({ Clock::now(), std::move(data) });
+		changed.notify_all();
+	}
+	close();
+}
+
+void LinkShaper::Pipe::write_loop()
+{
+	Clock::time_point link_free = Clock::now();
+	boost::system::error_code error;
+	while (true) {
+		Segment segment;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			changed.wait(lock, [this] { return !segments.empty() || closed; });
+			if (segments.empty()) {
+				break;
+			}
+			segment = std::move(segments.front());
+			segments.pop_front();
+		}
+		std::this_thread::sleep_until(segment.arrival + shaper.latency);
+		for (size_t offset = 0; offset < segment.data.size() && !error; offset += WRITE_SLICE) {
+			size_t length = std::min(WRITE_SLICE, segment.data.size() - offset);
+			if (shaper.bandwidth != 0) {
+				Clock::time_point start = std::max(Clock::now(), link_free);
+				std::this_thread::sleep_until(start);
+				link_free = start + std::chrono::microseconds(length * 1000000 / shaper.bandwidth);
+			}
+			boost::asio::write(to, boost::asio::buffer(segment.data.data() + offset, length), error);
+		}
+		if (error) { // the receiver is gone, stop the reader as well
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				closed = true;
+				segments.clear();
+				changed.notify_all();
+			}
+			from.shutdown(tcp::socket::shutdown_receive, error);
+			return;
+		}
+		std::lock_guard<std::mutex> lock(mutex);
+		queued -= segment.data.size();
+		changed.notify_all();
+	}
+	to.shutdown(tcp::socket::shutdown_send, error);
+}
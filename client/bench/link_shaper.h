@@ -0,0 +1,73 @@
+#pragma once
+
+#include <boost/asio.hpp>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// LinkShaper relays loopback connections to an upstream port while emulating a WAN link: in each direction every byte is held
+// back for a fixed one-way latency and released no faster than the configured bandwidth.
+class LinkShaper {
+public:
+	using Clock = std::chrono::steady_clock;
+
+private:
+	constexpr static size_t READ_SIZE = 64 * 1024;
+	constexpr static size_t WRITE_SLICE = 16 * 1024; // paced separately, so slow links are not bursty
+	constexpr static size_t MIN_QUEUE_LIMIT = 4 * 1024 * 1024;
+
+	// one direction of a relayed connection: a reader stamps what arrives, a writer releases it when the link allows
+	class Pipe {
+	private:
+		struct Segment {
+			Clock::time_point arrival;
+			std::vector<uint8_t> data;
+		};
+		std::mutex mutex;
+		std::condition_variable changed;
+		std::deque<Segment> segments;
+		size_t queued = 0;
+		bool closed = false;
+
+		const LinkShaper& shaper;
+		boost::asio::ip::tcp::socket& from;
+		boost::asio::ip::tcp::socket& to;
+
+		void close();
+	public:
+		Pipe(const LinkShaper& shaper, boost::asio::ip::tcp::socket& from, boost::asio::ip::tcp::socket& to);
+		void read_loop();
+		void write_loop();
+	};
+
+	const uint16_t upstream_port;
+	const std::chrono::microseconds latency;
+	const uint64_t bandwidth; // bytes per second, 0 for unlimited
+	const size_t queue_limit; // bytes in flight per direction before the reader stops (and the sender feels backpressure)
+
+	boost::asio::io_context io_context;
+	boost::asio::ip::tcp::acceptor acceptor;
+	std::thread thread;
+	std::atomic<bool> running{ false };
+
+	std::mutex sockets_mutex;
+	std::vector<boost::asio::ip::tcp::socket*> active_sockets; // so stop() can unblock the relay
+
+	void serve();
+	void relay(boost::asio::ip::tcp::socket& client, boost::asio::ip::tcp::socket& server);
+
+public:
+	LinkShaper(uint16_t upstream_port, std::chrono::microseconds latency, uint64_t bandwidth);
+	~LinkShaper();
+	LinkShaper(const LinkShaper&) = delete;
+	LinkShaper& operator=(const LinkShaper&) = delete;
+
+	uint16_t get_port() const;
+	void start();
+	void stop();
+};
@@ -0,0 +1,392 @@
+#include "mock_server.h"
+#include <osrng.h>
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <stdexcept>
+#include <unistd.h>
+#include "request.h"
+#include "response.h"
+#include "rsa_wrapper.h"
+#include "aes_wrapper.h"
+
+using boost::asio::ip::tcp;
+using local = boost::asio::local::stream_protocol;
+
+MockServer::MockServer(Transport::Kind kind) : kind(kind), acceptor(io_context, tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0)), local_acceptor(io_context)
+{
+	if (kind != Transport::Kind::TCP) {
+		static std::atomic<int> servers{ 0 };
+		socket_path = (std::filesystem::temp_directory_path() / ("gyf-mock-" + std::to_string(::getpid()) + "-" + std::to_string(servers++) + ".sock")).string();
+		std::filesystem::remove(socket_path);
+		local_acceptor = local::acceptor(io_context, local::endpoint(socket_path));
+	}
+}
+
+MockServer::~MockServer()
+{
+	stop();
+	if (!socket_path.empty()) {
+		std::error_code ignored;
+		std::filesystem::remove(socket_path, ignored);
+	}
+}
+
+uint16_t MockServer::get_port() const
+{
+	return acceptor.local_endpoint().port();
+}
+
+Transport::Address MockServer::get_address() const
+{
+	Transport::Address address;
+	address.kind = kind;
+	address.host = "127.0.0.1";
+	address.port = get_port();
+	address.path = socket_path;
+	return address;
+}
+
+void MockServer::start()
+{
+	running = true;
+	thread = std::thread(&MockServer::serve, this);
+}
+
+void MockServer::stop()
+{
+	if (!running.exchange(false)) {
+		return;
+	}
+	{
+		std::lock_guard<std::mutex> lock(transport_mutex);
+		if (active_transport != nullptr) {
+			active_transport->shutdown();
+		}
+	}
+	// wakes the blocking accept with a connection of our own
+	boost::system::error_code ignored;
+	if (kind == Transport::Kind::TCP) {
+		tcp::socket waker(io_context);
+		waker.connect(tcp::endpoint(boost::asio::ip::address_v4::loopback(), get_port()), ignored);
+		thread.join();
+	}
+	else {
+		local::socket waker(io_context);
+		waker.connect(local::endpoint(socket_path), ignored);
+		thread.join(); // before the waker is closed, which the accept would take for a client that left
+	}
+}
+
+MockServer::TransferStats MockServer::get_stats() const
+{
+	std::lock_guard<std::mutex> lock(stats_mutex);
+	return stats;
+}
+
+void MockServer::record(const std::function<void(TransferStats&)>& update)
+{
+	std::lock_guard<std::mutex> lock(stats_mutex);
+	update(stats);
+}
+
+std::unique_ptr<Transport> MockServer::accept()
+{
+	boost::system::error_code error;
+	if (kind == Transport::Kind::TCP) {
+		tcp::socket socket(io_context);
+		acceptor.accept(socket, error);
+		return error || !running ? nullptr : Transport::accept(std::move(socket));
+	}
+	local::socket socket(io_context);
+	local_acceptor.accept(socket, error);
+	return error || !running ? nullptr : Transport::accept(std::move(socket)); // unix or shm, as the client connects
+}
+
+void MockServer::serve()
+{
+	while (running) {
+		std::unique_ptr<Transport> transport;
+		try {
+			transport = accept();
+		}
+		catch (const std::exception& e) {
+			std::cerr << "<Error>: Mock server could not accept the connection: " << e.what() << std::endl;
+		}
+		if (!transport) {
+			continue;
+		}
+		record([](TransferStats& s) { s = TransferStats(); s.accepted = Clock::now(); });
+		{
+			std::lock_guard<std::mutex> lock(transport_mutex);
+			active_transport = transport.get();
+		}
+		try {
+			handle_connection(*transport);
+		}
+		catch (const boost::system::system_error&) {
+			// the client left (or stop() shut the transport down)
+		}
+		catch (const std::exception& e) {
+			std::cerr << "<Error>: Mock server dropped the connection: " << e.what() << std::endl;
+		}
+		std::lock_guard<std::mutex> lock(transport_mutex);
+		active_transport = nullptr;
+	}
+}
+
+void MockServer::handle_connection(Transport& transport)
+{
+	IncomingFile file;
+	negotiated.clear();
+	std::array<uint8_t, RequestHeader::SIZE> header;
+	std::string payload;
+	while (true) {
+		transport.read(header.data(), header.size());
+		auto [id, version, code, payload_size] = RequestHeader::Layout::read(header.data());
+		std::string client_id(id);
+		payload.resize(payload_size);
+		transport.read(reinterpret_cast<uint8_t*>(&payload[0]), payload_size);
+		record([&, payload_size = payload_size](TransferStats& s) { s.wire_bytes += RequestHeader::SIZE + payload_size; });
+
+		switch (code) {
+		case RegisterRequest::CODE:
+			send_response(transport, ResponseCode::REGISTER_SUCCESS, handle_register(payload));
+			break;
+		case SendPublicKeyRequest::CODE:
+			send_response(transport, ResponseCode::AES_KEY, handle_public_key(client_id, payload));
+			record([](TransferStats& s) { s.key_sent = Clock::now(); });
+			break;
+		case ReconnectRequest::CODE: {
+			auto client = clients.find(client_id);
+			if (client == clients.end() || client->second.encrypted_aes_key.empty()) {
+				send_response(transport, ResponseCode::RECONNECT_REJECTED, client_id);
+			}
+			else {
+				send_response(transport, ResponseCode::RECONNECT_SUCCESS, client_id + client->second.encrypted_aes_key);
+				record([](TransferStats& s) { s.key_sent = Clock::now(); });
+			}
+			break;
+		}
+		case NegotiateChecksumRequest::CODE:
+			send_response(transport, ResponseCode::CHECKSUM_SELECTED, handle_negotiate_checksum(client_id, payload));
+			break;
+		case SendZeroRangesRequest::CODE:
+			handle_zero_ranges(payload, file);
+			break;
+		case SendFileRequest::CODE:
+			handle_file_packet(transport, client_id, version, payload, file);
+			break;
+		case SendCRCStateRequest::CODE_CORRECT:
+			send_response(transport, ResponseCode::MESSAGE_CONFIRM, client_id);
+			record([](TransferStats& s) { s.confirmed = Clock::now(); s.completed = true; });
+			break;
+		case SendCRCStateRequest::CODE_INCORRECT:
+			break; // the client sends the file again, no response expected
+		case SendCRCStateRequest::CODE_ELIMINATE:
+			send_response(transport, ResponseCode::MESSAGE_CONFIRM, client_id);
+			break;
+		default:
+			send_response(transport, ResponseCode::GENERAL_FAILURE, "");
+		}
+	}
+}
+
+void MockServer::send_response(Transport& transport, uint16_t code, const std::string& payload)
+{
+	std::vector<uint8_t> packet(ResponseHeader::SIZE + payload.size());
+	ResponseHeader(VERSION, code, static_cast<uint32_t>(payload.size())).pack_into(packet.data());
+	std::memcpy(packet.data() + ResponseHeader::SIZE, payload.data(), payload.size());
+	transport.write(packet.data(), packet.size());
+}
+
+static const uint8_t* bytes_of(const std::string& payload)
+{
+	return reinterpret_cast<const uint8_t*>(payload.data());
+}
+
+// the send file responses carry a 32-bit content size, larger files (protocol 4) report the maximum like the server
+static uint32_t saturate(uint64_t size)
+{
+	return static_cast<uint32_t>(std::min<uint64_t>(size, UINT32_MAX));
+}
+
+std::string MockServer::handle_register(const std::string& payload)
+{
+	CryptoPP::AutoSeededRandomPool rng;
+	std::string client_id(RequestHeader::SIZE_CLIENT_ID, '\0');
+	rng.GenerateBlock(reinterpret_cast<CryptoPP::byte*>(&client_id[0]), client_id.size());
+	if (payload.size() >= RegisterRequest::Layout::SIZE) {
+		auto [name] = RegisterRequest::Layout::read(bytes_of(payload));
+		clients[client_id].name = std::string(name);
+	}
+	return client_id;
+}
+
+std::string MockServer::handle_public_key(const std::string& client_id, const std::string& payload)
+{
+	ClientEntry& client = clients[client_id];
+	CryptoPP::AutoSeededRandomPool rng;
+	client.aes_key.assign(AESWrapper::DEFAULT_KEYLENGTH, '\0');
+	rng.GenerateBlock(reinterpret_cast<CryptoPP::byte*>(&client.aes_key[0]), client.aes_key.size());
+	if (payload.size() < SendPublicKeyRequest::Layout::SIZE) {
+		throw std::runtime_error("<Error>: Public key payload is too short.");
+	}
+	auto [name, public_key] = SendPublicKeyRequest::Layout::read(bytes_of(payload));
+	RSAPublicWrapper rsa_public{ std::string(public_key) };
+	client.encrypted_aes_key = rsa_public.encrypt(client.aes_key);
+	return client_id + client.encrypted_aes_key;
+}
+
+std::string MockServer::handle_negotiate_checksum(const std::string& client_id, const std::string& payload)
+{
+	if (payload.size() < NegotiateChecksumRequest::Layout::SIZE) {
+		throw std::runtime_error("<Error>: Checksum negotiation payload is too short.");
+	}
+	auto [file_name, proposed] = NegotiateChecksumRequest::Layout::read(bytes_of(payload));
+	Checksum::Algorithm selected = Checksum::Algorithm::CKSUM;
+	for (char id : proposed) {
+		auto algorithm = static_cast<Checksum::Algorithm>(static_cast<uint8_t>(id));
+		if (Checksum::is_available(algorithm)) {
+			selected = algorithm;
+			break;
+		}
+	}
+	negotiated[std::string(file_name)] = selected;
+	std::string response(ResponsePayload::ChecksumSelectedLayout::SIZE, '\0');
+	ResponsePayload::ChecksumSelectedLayout::write(reinterpret_cast<uint8_t*>(&response[0]), client_id, static_cast<uint8_t>(selected));
+	return response;
+}
+
+void MockServer::handle_file_packet(Transport& transport, const std::string& client_id, uint8_t version, const std::string& payload, IncomingFile& file)
+{
+	const bool large = version >= SendFileRequest::LARGE_FILES_VERSION;
+	const size_t fields_size = large ? SendFileRequest::Layout::SIZE : SendFileRequest::LegacyLayout::SIZE;
+	if (payload.size() < fields_size) {
+		send_response(transport, ResponseCode::GENERAL_FAILURE, "");
+		return;
+	}
+	uint64_t encrypted_size;
+	uint32_t packet_number, total_packets;
+	std::string_view file_name;
+	if (large) {
+		auto [encrypted, original, offset, number, total, name] = SendFileRequest::Layout::read(bytes_of(payload));
+		encrypted_size = encrypted, packet_number = number, total_packets = total, file_name = name;
+	}
+	else {
+		auto [encrypted, original, number, total, name] = SendFileRequest::LegacyLayout::read(bytes_of(payload));
+		encrypted_size = encrypted, packet_number = number, total_packets = total, file_name = name;
+	}
+
+	Clock::time_point now = Clock::now();
+	if (packet_number == 1) { // a new attempt starts over
+		CryptoPP::byte iv[CryptoPP::AES::BLOCKSIZE] = { 0 };
+		const std::string& aes_key = clients[client_id].aes_key;
+		file.decryption.SetKeyWithIV(reinterpret_cast<const CryptoPP::byte*>(aes_key.data()), aes_key.size(), iv);
+		file.pending.clear();
+		auto algorithm = negotiated.find(std::string(file_name));
+		file.digest.reset(algorithm == negotiated.end() ? Checksum::Algorithm::CKSUM : algorithm->second);
+		file.size = 0;
+		file.next_zero = 0;
+		record([&](TransferStats& s) { if (s.packets == 0) s.first_packet = now; });
+	}
+	record([&](TransferStats& s) { ++s.packets; s.last_packet = now; });
+
+	file.pending.append(payload, fields_size, std::string::npos);
+	bool last = packet_number == total_packets;
+	decrypt_pending(file, last);
+	if (!last) {
+		return;
+	}
+	Checksum::Algorithm algorithm = file.digest.get_algorithm();
+	uint64_t checksum = file.digest.finish(file.size);
+	record([&](TransferStats& s) { s.plain_bytes = file.size; s.algorithm = algorithm; s.checksum = checksum; });
+
+	if (algorithm == Checksum::Algorithm::CKSUM) {
+		std::string response(ResponsePayload::SendFileLayout::SIZE, '\0');
+		ResponsePayload::SendFileLayout::write(reinterpret_cast<uint8_t*>(&response[0]), client_id, saturate(encrypted_size), file_name,
+			static_cast<uint32_t>(checksum));
+		send_response(transport, ResponseCode::SEND_FILE_SUCCESS, response);
+	}
+	else {
+		std::string response(ResponsePayload::SendFileDigestLayout::SIZE, '\0');
+		ResponsePayload::SendFileDigestLayout::write(reinterpret_cast<uint8_t*>(&response[0]), client_id, saturate(encrypted_size), file_name,
+			static_cast<uint8_t>(algorithm), checksum);
+		send_response(transport, ResponseCode::SEND_FILE_DIGEST, response);
+	}
+}
+
+void MockServer::handle_zero_ranges(const std::string& payload, IncomingFile& file)
+{
+	if (payload.size() < SendZeroRangesRequest::Layout::SIZE) {
+		throw std::runtime_error("<Error>: Zero ranges payload is too short.");
+	}
+	auto [file_name, first_index, count] = SendZeroRangesRequest::Layout::read(bytes_of(payload));
+	if (payload.size() != SendZeroRangesRequest::payload_size(count)) {
+		throw std::runtime_error("<Error>: Zero ranges payload does not match its count.");
+	}
+	if (first_index == 0) { // a new attempt
+		file.zero_ranges.clear();
+	}
+	else if (first_index != file.zero_ranges.size()) {
+		throw std::runtime_error("<Error>: Zero ranges arrived out of order.");
+	}
+	const uint8_t* in = bytes_of(payload) + SendZeroRangesRequest::Layout::SIZE;
+	for (uint32_t i = 0; i < count; ++i, in += SendZeroRangesRequest::RangeLayout::SIZE) {
+		auto [offset, length] = SendZeroRangesRequest::RangeLayout::read(in);
+		file.zero_ranges.push_back({ offset, length });
+	}
+}
+
+void MockServer::digest_zero_ranges(IncomingFile& file)
+{
+	static const std::array<unsigned char, 64 << 10> zeros{};
+	while (file.next_zero < file.zero_ranges.size() && file.zero_ranges[file.next_zero].offset == file.size) {
+		for (uint64_t left = file.zero_ranges[file.next_zero++].length; left > 0;) {
+			size_t n = static_cast<size_t>(std::min<uint64_t>(left, zeros.size()));
+			file.digest.update(zeros.data(), n);
+			file.size += n;
+			left -= n;
+		}
+	}
+}
+
+void MockServer::decrypt_pending(IncomingFile& file, bool last)
+{
+	const size_t block = CryptoPP::AES::BLOCKSIZE;
+	size_t ready = file.pending.size() - file.pending.size() % block;
+	if (!last) {
+		ready = ready > block ? ready - block : 0;
+	}
+	else if (ready != file.pending.size() || ready == 0) {
+		throw std::runtime_error("<Error>: Encrypted file is not a whole number of AES blocks.");
+	}
+	if (ready == 0) {
+		return;
+	}
+	std::string plain(ready, '\0');
+	file.decryption.ProcessData(reinterpret_cast<CryptoPP::byte*>(&plain[0]), reinterpret_cast<const CryptoPP::byte*>(file.pending.data()), ready);
+	file.pending.erase(0, ready);
+	if (last) { // PKCS#7 padding
+		size_t padding = static_cast<unsigned char>(plain.back());
+		if (padding == 0 || padding > block || padding > plain.size()) {
+			throw std::runtime_error("<Error>: Invalid padding on the decrypted file.");
+		}
+		plain.resize(plain.size() - padding);
+	}
+	for (size_t done = 0;;) { // the decrypted bytes fill the file between the zero ranges
+		digest_zero_ranges(file);
+		if (done == plain.size()) {
+			break;
+		}
+		size_t n = plain.size() - done;
+		if (file.next_zero < file.zero_ranges.size()) {
+			n = static_cast<size_t>(std::min<uint64_t>(n, file.zero_ranges[file.next_zero].offset - file.size));
+		}
+		file.digest.update(reinterpret_cast<const unsigned char*>(plain.data() + done), n);
+		file.size += n;
+		done += n;
+	}
+}
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <boost/asio.hpp>
+#include <modes.h>
+#include <aes.h>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "checksum.h"
+#include "request.h"
+#include "transport.h"
+
+// MockServer is an in-process stand-in for the Python server, speaking the same protocol (requests 825-902, responses 1600-1609)
+// on a loopback port, or a Unix domain socket for the unix and shm transports. The file is decrypted and checksummed as the packets arrive, so it is never held in memory.
+class MockServer {
+public:
+	using Clock = std::chrono::steady_clock;
+
+	// what the server saw of the last connection
+	struct TransferStats {
+		Clock::time_point accepted;
+		Clock::time_point key_sent; // the AES key response was written, end of the handshake
+		Clock::time_point first_packet;
+		Clock::time_point last_packet;
+		Clock::time_point confirmed; // the client acknowledged the checksum
+		uint64_t packets = 0; // send file packets, over all attempts
+		uint64_t wire_bytes = 0; // everything read from the socket, headers included
+		uint64_t plain_bytes = 0; // size of the decrypted file
+		Checksum::Algorithm algorithm = Checksum::Algorithm::CKSUM;
+		uint64_t checksum = 0;
+		bool completed = false;
+	};
+
+private:
+	constexpr static uint8_t VERSION = 5; // field layouts come from request.h and response.h
+
+	struct ClientEntry {
+		std::string name;
+		std::string aes_key;
+		std::string encrypted_aes_key;
+	};
+
+	// the file being received on the current connection
+	struct IncomingFile {
+		CryptoPP::CBC_Mode<CryptoPP::AES>::Decryption decryption;
+		std::string pending; // ciphertext not decrypted yet, the last block waits for the padding to be known
+		Checksum::Digest digest;
+		uint64_t size = 0; // decrypted so far, zero ranges included
+		std::vector<ZeroRange> zero_ranges; // not in the stream, digested as zeros at their offsets
+		size_t next_zero = 0;
+	};
+
+	const Transport::Kind kind;
+	boost::asio::io_context io_context;
+	boost::asio::ip::tcp::acceptor acceptor;
+	boost::asio::local::stream_protocol::acceptor local_acceptor; // open for the unix and shm transports
+	std::string socket_path;
+	std::thread thread;
+	std::atomic<bool> running{ false };
+
+	std::mutex transport_mutex;
+	Transport* active_transport = nullptr; // so stop() can unblock a pending read
+
+	mutable std::mutex stats_mutex;
+	TransferStats stats;
+
+	std::map<std::string, ClientEntry> clients; // by client id
+	std::map<std::string, Checksum::Algorithm> negotiated; // by file name, for the current connection
+
+	void serve();
+	std::unique_ptr<Transport> accept();
+	void handle_connection(Transport& transport);
+	void send_response(Transport& transport, uint16_t code, const std::string& payload);
+
+	std::string handle_register(const std::string& payload);
+	std::string handle_public_key(const std::string& client_id, const std::string& payload);
+	std::string handle_negotiate_checksum(const std::string& client_id, const std::string& payload);
+	void handle_file_packet(Transport& transport, const std::string& client_id, uint8_t version, const std::string& payload, IncomingFile& file);
+	void handle_zero_ranges(const std::string& payload, IncomingFile& file);
+	void decrypt_pending(IncomingFile& file, bool last);
+	static void digest_zero_ranges(IncomingFile& file); // the ones that start where the file is
+
+	void record(const std::function<void(TransferStats&)>& update);
+
+public:
+	explicit MockServer(Transport::Kind kind = Transport::Kind::TCP); // binds an ephemeral loopback port or a socket in the temp directory
+	~MockServer();
+	MockServer(const MockServer&) = delete;
+	MockServer& operator=(const MockServer&) = delete;
+
+	uint16_t get_port() const; // TCP
+	Transport::Address get_address() const; // for transfer.info
+	void start();
+	void stop();
+	TransferStats get_stats() const;
+};
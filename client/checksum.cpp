@@ -0,0 +1,137 @@
+#include "checksum.h"
+#include <new>
+#include <sstream>
+
+const char* Checksum::get_name(Algorithm algorithm)
+{
+	switch (algorithm) {
+	case Algorithm::CKSUM:
+		return "cksum";
+	case Algorithm::CRC32C:
+		return "crc32c";
+	case Algorithm::XXH3_64:
+		return "xxh3";
+	}
+	return "unknown";
+}
+
+bool Checksum::parse_algorithm(const std::string& name, Algorithm& algorithm)
+{
+	for (Algorithm candidate : { Algorithm::CKSUM, Algorithm::CRC32C, Algorithm::XXH3_64 }) {
+		if (name == get_name(candidate)) {
+			algorithm = candidate;
+			return true;
+		}
+	}
+	return false;
+}
+
+bool Checksum::parse_preference(const std::string& list, std::vector<Algorithm>& preference)
+{
+	std::vector<Algorithm> parsed;
+	std::istringstream ss(list);
+	std::string name;
+	while (std::getline(ss, name, ',')) {
+		Algorithm algorithm;
+		if (!parse_algorithm(name, algorithm) || !is_available(algorithm)) {
+			return false;
+		}
+		parsed.push_back(algorithm);
+	}
+	if (parsed.empty()) {
+		return false;
+	}
+	preference = parsed;
+	return true;
+}
+
+bool Checksum::is_available(Algorithm algorithm)
+{
+#ifndef GYF_HAVE_XXHASH
+	if (algorithm == Algorithm::XXH3_64) {
+		return false;
+	}
+#endif
+	return algorithm == Algorithm::CKSUM || algorithm == Algorithm::CRC32C || algorithm == Algorithm::XXH3_64;
+}
+
+std::vector<Checksum::Algorithm> Checksum::default_preference()
+{
+	std::vector<Algorithm> preference;
+	if (is_available(Algorithm::XXH3_64)) {
+		preference.push_back(Algorithm::XXH3_64);
+	}
+	preference.push_back(Algorithm::CRC32C);
+	preference.push_back(Algorithm::CKSUM);
+	return preference;
+}
+
+// =========== XXH3_64 ===========
+
+#ifdef GYF_HAVE_XXHASH
+Checksum::XXH3_64::State::State() : state(XXH3_createState())
+{
+	if (state == nullptr) {
+		throw std::bad_alloc();
+	}
+}
+
+Checksum::XXH3_64::State::~State()
+{
+	XXH3_freeState(state);
+}
+#endif
+
+// =========== Digest ===========
+
+Checksum::Digest::Digest(Algorithm algorithm) : algorithm(algorithm)
+{
+	reset(algorithm);
+}
+
+void Checksum::Digest::reset(Algorithm new_algorithm)
+{
+	algorithm = new_algorithm;
+	switch (algorithm) {
+	case Algorithm::CRC32C:
+		CRC32C::start(crc);
+		break;
+#ifdef GYF_HAVE_XXHASH
+	case Algorithm::XXH3_64:
+		XXH3_64::start(xxh3);
+		break;
+#endif
+	default:
+		Cksum::start(crc);
+	}
+}
+
+void Checksum::Digest::update(const unsigned char* b, size_t n)
+{
+	switch (algorithm) {
+	case Algorithm::CRC32C:
+		CRC32C::update(crc, b, n);
+		break;
+#ifdef GYF_HAVE_XXHASH
+	case Algorithm::XXH3_64:
+		XXH3_64::update(xxh3, b, n);
+		break;
+#endif
+	default:
+		Cksum::update(crc, b, n);
+	}
+}
+
+uint64_t Checksum::Digest::finish(uint64_t length)
+{
+	switch (algorithm) {
+	case Algorithm::CRC32C:
+		return CRC32C::finish(crc, length);
+#ifdef GYF_HAVE_XXHASH
+	case Algorithm::XXH3_64:
+		return XXH3_64::finish(xxh3, length);
+#endif
+	default:
+		return Cksum::finish(crc, length);
+	}
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "crc_core.h"
+#include "crc32c_core.h"
+#ifdef GYF_HAVE_XXHASH
+#include <xxhash.h>
+#endif
+
+// Checksum lists the algorithms a transfer can be verified with, negotiated per file with the server (request 829).
+// Each algorithm is a policy with the same static interface, so the file checksum code is written once as a template:
+//   State; start(State&); update(State&, const unsigned char*, size_t); finish(State&, uint64_t length) -> uint64_t
+// and COMBINABLE, with combine(State& a, const State& b, uint64_t length_b) when segments can be merged.
+namespace Checksum {
+
+	// ids on the wire, never renumber
+	enum class Algorithm : uint8_t {
+		CKSUM = 0,		// POSIX cksum (CRCCore), the protocol's original checksum and the fallback
+		CRC32C = 1,		// Castagnoli CRC (CRC32CCore), SSE4.2 when available
+		XXH3_64 = 2,	// xxHash3 64-bit, only when built with libxxhash
+	};
+
+	const char* get_name(Algorithm algorithm);
+	bool parse_algorithm(const std::string& name, Algorithm& algorithm);
+	// a comma separated preference list ("xxh3,crc32c"), unavailable algorithms are an error
+	bool parse_preference(const std::string& list, std::vector<Algorithm>& preference);
+	bool is_available(Algorithm algorithm);
+	std::vector<Algorithm> default_preference(); // the fastest available first, cksum last
+
+	struct Cksum {
+		constexpr static Algorithm ALGORITHM = Algorithm::CKSUM;
+		constexpr static bool COMBINABLE = true;
+		using State = uint32_t;
+		static void start(State& state) { state = 0; }
+		static void update(State& state, const unsigned char* b, size_t n) { state = CRCCore::update(state, b, n); }
+		static uint64_t finish(State& state, uint64_t length) { return CRCCore::finalize(state, length); }
+		static void combine(State& a, const State& b, uint64_t length_b) { a = CRCCore::combine(a, b, length_b); }
+	};
+
+	struct CRC32C {
+		constexpr static Algorithm ALGORITHM = Algorithm::CRC32C;
+		constexpr static bool COMBINABLE = false; // fast enough that a single thread keeps up with the disk
+		using State = uint32_t;
+		static void start(State& state) { state = CRC32CCore::START; }
+		static void update(State& state, const unsigned char* b, size_t n) { state = CRC32CCore::update(state, b, n); }
+		static uint64_t finish(State& state, uint64_t) { return CRC32CCore::finish(state); }
+	};
+
+#ifdef GYF_HAVE_XXHASH
+	struct XXH3_64 {
+		constexpr static Algorithm ALGORITHM = Algorithm::XXH3_64;
+		constexpr static bool COMBINABLE = false;
+		// owns the library's streaming state
+		class State {
+		private:
+			XXH3_state_t* state;
+		public:
+			State();
+			~State();
+			State(const State&) = delete;
+			State& operator=(const State&) = delete;
+			XXH3_state_t* get() { return state; }
+		};
+		static void start(State& state) { XXH3_64bits_reset(state.get()); }
+		static void update(State& state, const unsigned char* b, size_t n) { XXH3_64bits_update(state.get(), b, n); }
+		static uint64_t finish(State& state, uint64_t) { return XXH3_64bits_digest(state.get()); }
+	};
+#endif
+
+	// calls visitor(Policy{}) with the policy of algorithm (a generic lambda gets it as decltype of its argument), the one
+	// place that maps ids to policies
+	template<typename Visitor>
+	auto visit(Algorithm algorithm, Visitor&& visitor) {
+		switch (algorithm) {
+		case Algorithm::CRC32C:
+			return visitor(CRC32C{});
+#ifdef GYF_HAVE_XXHASH
+		case Algorithm::XXH3_64:
+			return visitor(XXH3_64{});
+#endif
+		default:
+			return visitor(Cksum{});
+		}
+	}
+
+	// a running checksum whose algorithm is only known at run time (the mock server verifies whatever was negotiated)
+	class Digest {
+	private:
+		Algorithm algorithm;
+		uint32_t crc = 0;
+#ifdef GYF_HAVE_XXHASH
+		XXH3_64::State xxh3;
+#endif
+	public:
+		explicit Digest(Algorithm algorithm = Algorithm::CKSUM);
+		void reset(Algorithm new_algorithm);
+		void update(const unsigned char* b, size_t n);
+		uint64_t finish(uint64_t length);
+		Algorithm get_algorithm() const { return algorithm; }
+	};
+}
@@ -1,16 +1,25 @@
 #include "client.hpp"
+#include <algorithm>
 #include <cstdlib>
 #include <cstring>
+#include <filesystem>
 #include <fstream>
 #include <regex>
+#include <sstream>
 #include "request.h"
 #include "rsa_wrapper.h"
 #include "file_chunker.h"
 #include "crc_handler.h"
+#include "metrics.h"
+#include "range_downloader.h"
 
-Client::Client() : port(0), is_registered(false) // just more like added to avoid warnings, but they used after being assigned anyway
+Client::Client() : is_registered(false), checksum_preference(Checksum::default_preference()) // just more like added to avoid warnings, but they used after being assigned anyway
 {
 }
+void Client::set_checksum_preference(const std::vector<Checksum::Algorithm>& preference)
+{
+	checksum_preference = preference;
+}
 
 Client::~Client()
 {
@@ -19,10 +28,10 @@ void Client::parse_me_info_line(const int& line_number, const std::string& line)
 	switch (line_number) {
 	case 1:
 		name = line;
-		std::cout << "<Info>: Client name: " << name << std::endl;
+		GYF_LOG(Info) << "Client name: " << name;
 		break;
 	case 2:
-		std::cout << "<Info>: Client ID: " << line << std::endl; // hexified
+		GYF_LOG(Info) << "Client ID: " << line; // hexified
 		id = crypto_manager.dehexify(line);
 		break;
 
@@ -31,36 +40,49 @@ void Client::parse_me_info_line(const int& line_number, const std::string& line)
 	}
 }
 void Client::get_me_info_content() {
-	std::cout << "--------" << std::endl;
+	GYF_LOG_PLAIN(Info) << "--------";
 	std::ifstream me_info_file("me.info");
 	if (!me_info_file.is_open()) {
 		is_registered = false; // I added this for clarity, but is_registered is false at construction anyway
-		std::cout << "<Info>: me.info file not found, client is not registered." << std::endl;
+		GYF_LOG(Info) << "me.info file not found, client is not registered.";
 		return;
 	}
-	std::cout << "<Info>: me.info file found, retrieving data.." << std::endl;
+	GYF_LOG(Info) << "me.info file found, retrieving data..";
 	std::string line;
 	int line_number = 1;
 	while (line_number <= NUMBER_LINES_ME_INFO - 1) {
 		if (!std::getline(me_info_file, line)) {
-			std::cerr << "<Error>: me.info file is corrupt/wrong form, moving to register.." << std::endl;
+			GYF_LOG(Error) << "me.info file is corrupt/wrong form, moving to register..";
 		}
 		parse_me_info_line(line_number, line);
 		++line_number;
 	}
 	is_registered = true;
 	me_info_file.close();
-	std::cout << "--------" << std::endl;
+	GYF_LOG_PLAIN(Info) << "--------";
 }
-bool Client::check_host(const std::string& address) const
+bool Client::check_host(const std::string& host) const
 {
-	std::regex ipv4_pattern(
+	static const std::regex ipv4_pattern( // compiled once
 		R"(^(25[0-5]|2[0-4][0-9]|1[0-9]{2}|[1-9]?[0-9])(\.(25[0-5]|2[0-4][0-9]|1[0-9]{2}|[1-9]?[0-9])){3}$)"
 	);
 	return std::regex_match(host, ipv4_pattern);
 }
 void Client::get_address(std::string line) {
+	// a server on the same host can also be reached through its Unix domain socket, and through shared memory set up on it
+	for (auto [prefix, kind] : { std::pair{ "unix:", Transport::Kind::UNIX }, std::pair{ "shm:", Transport::Kind::SHM } }) {
+		if (line.rfind(prefix, 0) == 0) {
+			address.kind = kind;
+			address.path = line.substr(std::strlen(prefix));
+			if (address.path.empty()) {
+				throw std::runtime_error("<Error>: Missing socket path in transfer.info file.");
+			}
+			return;
+		}
+	}
+	address.kind = Transport::Kind::TCP;
 	std::istringstream ss(line);
+	std::string& host = address.host;
 	if (!std::getline(ss, host, ':') || !check_host(host)) {
 		throw std::runtime_error("<Error>: Invalid or missing address in transfer.info file.");
 	}
@@ -74,7 +96,7 @@ void Client::get_address(std::string line) {
 		if (converted_port < 0 || converted_port > 65535) {
 			throw std::out_of_range("<Error>: Invalid port in transfer.info file.");
 		}
-		port = static_cast<uint16_t>(converted_port);
+		address.port = static_cast<uint16_t>(converted_port);
 	}
 	catch (std::invalid_argument&) {
 		throw std::runtime_error("<Error>: Could not convert port from transfer.info file.");
@@ -92,7 +114,7 @@ void Client::parse_transfer_info_line(const int& line_number, const std::string&
 		if (!is_registered) { // in the case of being registered, we are not using the name in transfer.info, but the one in me.info
 			if (line.size() > static_cast<size_t>(RegisterRequest::SIZE_CLIENT_NAME - 1)) { // the fact that \0 is not in the file itself
 				name = line.substr(0, static_cast<size_t>(RegisterRequest::SIZE_CLIENT_NAME - 1));
-				std::cerr << "<Warning>: Client name in transfer.info is longer than " << RegisterRequest::SIZE_CLIENT_NAME - 1 << " characters. Truncating.." << std::endl;
+				GYF_LOG(Warning) << "Client name in transfer.info is longer than " << RegisterRequest::SIZE_CLIENT_NAME - 1 << " characters. Truncating..";
 			}
 			else {
 				name = line;
@@ -121,16 +143,16 @@ void Client::get_transfer_info_content()
 		parse_transfer_info_line(line_number, line);
 		++line_number;
 	}
-	std::cout << "--------" << std::endl;
-	std::cout << "<Info>: Retrieved transfer.info content:" << std::endl;
-	std::cout << "<Info>: Address at: " << host << ":" << port << std::endl;
-	std::cout << "<Info>: Client name: " << name << std::endl;
-	std::cout << "<Info>: File path: " << file_path << std::endl;
-	std::cout << "--------" << std::endl;
+	GYF_LOG_PLAIN(Info) << "--------";
+	GYF_LOG(Info) << "Retrieved transfer.info content:";
+	GYF_LOG(Info) << "Address at: " << address.to_string();
+	GYF_LOG(Info) << "Client name: " << name;
+	GYF_LOG(Info) << "File path: " << file_path;
+	GYF_LOG_PLAIN(Info) << "--------";
 	file_transfer_info.close(); // not necessary, because of the RAII, but just for clarity
 }
 void Client::output_to_me_info() {
-	std::cout << "<Info>: Doing changes to me.info.." << std::endl;
+	GYF_LOG(Info) << "Doing changes to me.info..";
 	std::ofstream me_info_file("me.info");
 	if (!me_info_file.is_open()) {
 		throw std::runtime_error("<Error>: Could not open me.info file.");
@@ -144,17 +166,17 @@ bool Client::get_register_response(std::string& response_error_str) {
 		response_error_str = proto_handler.get_response_code_description(header.code);
 		return false;
 	}
-	std::cout << "<Info>: Registration accepted, getting client ID.." << std::endl;
+	GYF_LOG(Info) << "Registration accepted, getting client ID..";
 	id = net_manager.receive_register_payload(header);
-	std::cout << "<Info>: Client ID: " << crypto_manager.hexify(id.c_str(), 16) << std::endl;
+	GYF_LOG(Info) << "Client ID: " << crypto_manager.hexify(id.c_str(), 16);
 	output_to_me_info();
 	return true;
 }
-Request* Client::create_register()
+RegisterRequest Client::create_register()
 {
-	std::cout << "<Info> Started registeration process.." << std::endl;
-	Request* request = proto_handler.create_registration_request(name);
-	std::cout << "<Info> Created registration request.." << std::endl;
+	GYF_LOG(Info) << "Started registeration process..";
+	RegisterRequest request = proto_handler.create_registration_request(name);
+	GYF_LOG(Info) << "Created registration request..";
 	return request;
 }
 void Client::output_to_priv_key(std::string private_key_64) {
@@ -173,14 +195,26 @@ void Client::output_key_to_me_info(std::string private_key_64) {
 	me_info_file << private_key_64;
 	me_info_file.close();
 }
+void Client::prepare_key_pair() {
+	if (!pending_key_pair.valid()) {
+		GYF_LOG(Info) << "Creating public and private key in the background..";
+		pending_key_pair = key_pool.take_async();
+	}
+}
 std::string Client::create_public_key() {
-	std::cout << "<Info>: Creating public and private key.." << std::endl;
-	RSAPrivateWrapper rsa_private;
-	std::string private_key_64 = crypto_manager.encode(rsa_private.getPrivateKey());
-	std::cout << "<Info>: Updating priv.key and me.info with new private key.." << std::endl;
-	output_to_priv_key(private_key_64);
-	output_key_to_me_info(private_key_64);
-	return rsa_private.getPublicKey();
+	prepare_key_pair();
+	KeyPool::KeyPair key_pair;
+	{
+		Metrics::ScopedTimer timer(Metrics::Stage::KEY_WAIT);
+		key_pair = pending_key_pair.get();
+	}
+	GYF_LOG(Info) << "Updating priv.key and me.info with new private key..";
+	output_to_priv_key(key_pair.private_key_64);
+	output_key_to_me_info(key_pair.private_key_64);
+	std::promise<std::string> private_key; // replaces a priv.key prepared before the reconnection was rejected
+	private_key.set_value(crypto_manager.decode(key_pair.private_key_64));
+	pending_private_key = private_key.get_future();
+	return key_pair.public_key;
 }
 std::string Client::get_private_key_from_priv_key() {
 	std::ifstream priv_key_file("priv.key");
@@ -193,14 +227,17 @@ std::string Client::get_private_key_from_priv_key() {
 	}
 	return private_key_64;
 }
-void Client::retrieve_aes_key(const std::string& aes_string) {
-	std::string private_key = crypto_manager.decode(get_private_key_from_priv_key());
+void Client::prepare_private_key() {
+	pending_private_key = std::async(std::launch::async, [this]() { return crypto_manager.decode(get_private_key_from_priv_key()); });
+}
+void Client::retrieve_aes_key(std::string_view aes_string) {
+	std::string private_key = pending_private_key.valid() ? pending_private_key.get() : crypto_manager.decode(get_private_key_from_priv_key());
 	RSAPrivateWrapper rsa_private(private_key);
-	aes_key = rsa_private.decrypt(aes_string);
-	std::cout << "<Debug>: AES key length is " << aes_key.length() << std::endl;
-	//std::cout << "<Debug>: AES key is " << crypto_manager.hexify(aes_key.c_str(), aes_key.length() + 1) << std::endl;
-	std::cout << "<Info>: AES key retrieved and decrypted successfully." << std::endl;
-	std::cout << "--------" << std::endl;
+	aes_key = rsa_private.decrypt(aes_string.data(), static_cast<unsigned int>(aes_string.size()));
+	GYF_LOG(Debug) << "AES key length is " << aes_key.length();
+	//GYF_LOG(Debug) << "AES key is " << crypto_manager.hexify(aes_key.c_str(), aes_key.length() + 1);
+	GYF_LOG(Info) << "AES key retrieved and decrypted successfully.";
+	GYF_LOG_PLAIN(Info) << "--------";
 }
 bool Client::get_send_public_key_response(std::string& response_error_str, uint32_t& response_return) {
 	ResponseHeader header = net_manager.receive_response_header();
@@ -210,43 +247,44 @@ bool Client::get_send_public_key_response(std::string& response_error_str, uint3
 		return false;
 	}
 	else {
-		std::cout << "<Info>: Server received the public key successfully." << std::endl;
-		std::cout << "<Info>: Checking the AES key from server.." << std::endl;
+		GYF_LOG(Info) << "Server received the public key successfully.";
+		GYF_LOG(Info) << "Checking the AES key from server..";
 		if (header.payload_size <= 0) {
 			throw std::runtime_error("<Error>: Server sent an invalid AES key size.");
 		}
-		std::cout << "<Info>: AES key seems fine!" << std::endl;
-		std::cout << "--------" << std::endl;
+		GYF_LOG(Info) << "AES key seems fine!";
+		GYF_LOG_PLAIN(Info) << "--------";
 		response_return = header.payload_size;
 		return true;
 	}
 }
-Request* Client::create_public_key_request() {
+SendPublicKeyRequest Client::create_public_key_request() {
 	std::string public_key = create_public_key();
-	Request* request = proto_handler.create_send_public_key_request(id, name, public_key);
-	return request;
+	return proto_handler.create_send_public_key_request(id, name, public_key);
 }
 uint32_t Client::perform_send_public_key() {
 	return perform_operation<uint32_t>(
 		net_manager,
-		[this]() -> Request* { return create_public_key_request(); },
+		[this]() { return create_public_key_request(); },
 		[this](std::string& response_error_str, uint32_t& response_return) { return get_send_public_key_response(response_error_str, response_return); }
 	);
 }
 void Client::get_aes_key(uint32_t aes_key_size) {
-	std::cout << "<Info>: Attempt to receive AES key from server.." << std::endl;
-	std::string aes_string = net_manager.receive_aes_key(aes_key_size);
-	retrieve_aes_key(aes_string);
+	GYF_LOG(Info) << "Attempt to receive AES key from server..";
+	retrieve_aes_key(net_manager.receive_aes_key(aes_key_size));
 }
 void Client::setup() {
-	std::cout << "<Info>: Setting up the client.." << std::endl;
+	GYF_LOG(Info) << "Setting up the client..";
 	get_me_info_content();
+	if (!is_registered) {
+		prepare_key_pair(); // meanwhile transfer.info is read, the server resolved and the registration sent
+	}
 	get_transfer_info_content();
 }
 void Client::perform_register() {
 	perform_operation(
 		net_manager,
-		[this]() -> Request* { return create_register(); },
+		[this]() { return create_register(); },
 		[this](std::string& response_error_str) { return get_register_response(response_error_str); }
 	);
 }
@@ -254,7 +292,7 @@ bool Client::get_reconnect_response(std::string& response_error_str, uint32_t& r
 	ResponseHeader header = net_manager.receive_response_header();
 
 	if (header.code == ResponseCode::RECONNECT_REJECTED) {
-		std::cerr << "<Info>: Server rejected reconnection request." << std::endl;
+		GYF_LOG(Info) << "Server rejected reconnection request.";
 		is_registered = false;
 		response_error_str = proto_handler.get_response_code_description(header.code);
 		net_manager.receive_reconnect_failure_payload(header);
@@ -262,13 +300,13 @@ bool Client::get_reconnect_response(std::string& response_error_str, uint32_t& r
 		return true; // to avoid another attempt, but reconnection has been rejected and proceed to register
 	}
 	else if (header.code == ResponseCode::RECONNECT_SUCCESS) { // AES key is sent
-		std::cout << "<Info>: Server accepted reconnection request." << std::endl;
-		std::cout << "<Info>: Checking the AES key from server.." << std::endl;
+		GYF_LOG(Info) << "Server accepted reconnection request.";
+		GYF_LOG(Info) << "Checking the AES key from server..";
 		if (header.payload_size <= 0) {
 			throw std::runtime_error("<Error>: Server sent an invalid AES key size.");
 		}
-		std::cout << "<Info>: AES key seems fine!" << std::endl;
-		std::cout << "--------" << std::endl;
+		GYF_LOG(Info) << "AES key seems fine!";
+		GYF_LOG_PLAIN(Info) << "--------";
 		response_return = header.payload_size;
 		return true;
 	}
@@ -278,54 +316,139 @@ bool Client::get_reconnect_response(std::string& response_error_str, uint32_t& r
 	}
 }
 uint32_t Client::perform_attempt_reconnect() {
-	std::cout << "<Info>: Attempting to reconnect to the server.." << std::endl;
+	GYF_LOG(Info) << "Attempting to reconnect to the server..";
 	return perform_operation<uint32_t>(
 		net_manager,
-		[this]() -> Request* { return proto_handler.create_reconnect_request(id, name); },
+		[this]() { return proto_handler.create_reconnect_request(id, name); },
 		[this](std::string& response_error_str, uint32_t& response_return) { return get_reconnect_response(response_error_str, response_return); }
 	);
 }
 
 void Client::send_file_chunks(FileChunker& chunker) {
+	chunker.rewind(); // every attempt sends the file from its first chunk
+	Log::Progress progress("Packets sent", chunker.total_chunks());
+	const std::string file_name = chunker.get_file_name();
+	const uint8_t version = std::min(Client::CLIENT_VERSION, net_manager.get_server_version());
+	const uint64_t encrypted_size = chunker.get_size();
+	const uint64_t original_size = chunker.get_original_size();
+	const uint32_t total_packets = static_cast<uint32_t>(chunker.total_chunks());
+	send_zero_ranges(chunker);
 	while (!chunker.is_finished()) {
-		std::string chunk = chunker.get_next();
-		Request* request = proto_handler.create_send_file_request(
-			id,
-			chunker.get_size(),
-			chunker.get_original_size(),
-			static_cast<uint16_t>(chunker.get_total_reads()),
-			static_cast<uint16_t>(chunker.total_chunks()),
-			chunker.get_file_name(),
-			chunk
+		std::string_view chunk = chunker.get_next();
+		const uint64_t offset = chunker.get_offset();
+		const uint32_t packet_number = static_cast<uint32_t>(chunker.get_total_reads());
+		RequestPool<SendFileRequest>::Handle request = send_file_pool.acquire(
+			[&]() { return new SendFileRequest(proto_handler.create_send_file_request(id, version, encrypted_size, original_size, offset, packet_number, total_packets, file_name, chunk)); },
+			[&](SendFileRequest& reused) { reused.reset(id, version, encrypted_size, original_size, offset, packet_number, total_packets, file_name, chunk); }
 		);
-		net_manager.send_request(request);
-		std::cout << "<Info>: Packet " << chunker.get_total_reads() << " out of " << chunker.total_chunks() << " sent." << std::endl;
-		delete request;
+		net_manager.send_request(*request);
+		if (started != std::chrono::steady_clock::time_point{}) { // the first file bytes of this run are on the wire
+			auto elapsed = std::chrono::steady_clock::now() - started;
+			Metrics::record(Metrics::Stage::FIRST_BYTE, static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()));
+			GYF_LOG(Debug) << "Time to first byte: " << std::chrono::duration<double, std::milli>(elapsed).count() << " ms";
+			started = {};
+		}
+		progress.update(packet_number);
+	}
+	GYF_LOG(Debug) << "Send file requests: " << send_file_pool.get_created() << " allocated, " << send_file_pool.get_reused() << " reused.";
+}
+void Client::send_zero_ranges(const FileChunker& chunker) {
+	if (net_manager.get_server_version() < SendZeroRangesRequest::SPARSE_VERSION) {
+		return;
 	}
+	const std::vector<ZeroRange>& ranges = chunker.get_zero_ranges();
+	const std::string file_name = chunker.get_file_name();
+	size_t first = 0;
+	do { // at least one, even without ranges, so none are left from an earlier attempt; no response, like the packets
+		size_t count = std::min<size_t>(SendZeroRangesRequest::MAX_RANGES, ranges.size() - first);
+		std::vector<ZeroRange> batch(ranges.begin() + first, ranges.begin() + first + count);
+		net_manager.send_request(proto_handler.create_send_zero_ranges_request(id, file_name, static_cast<uint32_t>(first), std::move(batch)));
+		first += count;
+	} while (first < ranges.size());
 }
 void Client::print_file_info(const FileChunker& chunker) const {
-	std::cout << "<Info>: Processing the file.." << std::endl;
-	std::cout << "<Info>: Original file size: " << chunker.get_original_size() << " bytes" << std::endl;
-	std::cout << "<Info>: Encrypted file size: " << chunker.get_size() << " bytes" << std::endl;
-	std::cout << "<Info>: Total packets to send: " << chunker.total_chunks() << std::endl;
+	GYF_LOG(Info) << "Processing the file..";
+	GYF_LOG(Info) << "Original file size: " << chunker.get_original_size() << " bytes";
+	if (!chunker.get_zero_ranges().empty()) {
+		uint64_t zeros = 0;
+		for (const ZeroRange& range : chunker.get_zero_ranges()) {
+			zeros += range.length;
+		}
+		GYF_LOG(Info) << "Zero ranges left out: " << chunker.get_zero_ranges().size() << " (" << zeros << " bytes)";
+	}
+	GYF_LOG(Info) << "Encrypted file size: " << chunker.get_size() << " bytes";
+	GYF_LOG(Info) << "Total packets to send: " << chunker.total_chunks();
 }
-bool Client::get_send_file_response(std::string& response_error_str, unsigned long& server_crc) {
+void Client::check_file_fits(const FileChunker& chunker) const {
+	if (chunker.total_chunks() > UINT32_MAX) {
+		throw std::runtime_error("<Error>: The file needs more packets than a send file request can number.");
+	}
+	uint8_t server_version = net_manager.get_server_version();
+	if (server_version < SendFileRequest::LARGE_FILES_VERSION && !SendFileRequest::fits_legacy(chunker.get_size(), chunker.total_chunks())) {
+		throw std::runtime_error("<Error>: The server (protocol version " + std::to_string(server_version) +
+			") takes files up to 4 GB and 65,535 packets, update it to send this file.");
+	}
+}
+bool Client::get_checksum_selected_response(std::string& response_error_str, uint8_t& algorithm) {
 	ResponseHeader header = net_manager.receive_response_header();
-	if (header.code != ResponseCode::SEND_FILE_SUCCESS) {
+	if (header.code != ResponseCode::CHECKSUM_SELECTED) {
 		response_error_str = proto_handler.get_response_code_description(header.code);
 		return false;
 	}
-	server_crc = net_manager.receive_send_file_payload();
-	return true;
+	algorithm = net_manager.receive_checksum_selected_payload();
+	for (Checksum::Algorithm proposed : checksum_preference) {
+		if (algorithm == static_cast<uint8_t>(proposed)) {
+			return true;
+		}
+	}
+	if (algorithm == static_cast<uint8_t>(Checksum::Algorithm::CKSUM)) { // always acceptable
+		return true;
+	}
+	throw std::runtime_error("<Error>: Server selected a checksum algorithm that was not proposed.");
+}
+Checksum::Algorithm Client::perform_negotiate_checksum(const std::string& file_name) {
+	if (checksum_preference.size() == 1 && checksum_preference.front() == Checksum::Algorithm::CKSUM) {
+		return Checksum::Algorithm::CKSUM;
+	}
+	if (net_manager.get_server_version() < NegotiateChecksumRequest::NEGOTIATE_VERSION) {
+		// an older server reads the request as an unknown one, and answers every 23 bytes of it with a failure
+		GYF_LOG(Info) << "The server (protocol version " << static_cast<int>(net_manager.get_server_version()) << ") verifies files with cksum.";
+		return Checksum::Algorithm::CKSUM;
+	}
+	GYF_LOG(Info) << "Negotiating the checksum algorithm for " << file_name << "..";
+	Checksum::Algorithm algorithm = static_cast<Checksum::Algorithm>(perform_operation<uint8_t>(
+		net_manager,
+		[this, &file_name]() { return proto_handler.create_negotiate_checksum_request(id, file_name, checksum_preference); },
+		[this](std::string& response_error_str, uint8_t& algorithm) { return get_checksum_selected_response(response_error_str, algorithm); }
+	));
+	GYF_LOG(Info) << "Checksum algorithm: " << Checksum::get_name(algorithm);
+	return algorithm;
+}
+bool Client::get_send_file_response(std::string& response_error_str, Checksum::Algorithm algorithm, uint64_t& server_checksum) {
+	ResponseHeader header = net_manager.receive_response_header();
+	if (header.code == ResponseCode::SEND_FILE_SUCCESS && algorithm == Checksum::Algorithm::CKSUM) {
+		server_checksum = net_manager.receive_send_file_payload();
+		return true;
+	}
+	if (header.code == ResponseCode::SEND_FILE_DIGEST) {
+		uint8_t used_algorithm;
+		server_checksum = net_manager.receive_send_file_digest_payload(used_algorithm);
+		if (used_algorithm != static_cast<uint8_t>(algorithm)) {
+			throw std::runtime_error("<Error>: Server checked the file with another checksum algorithm than the negotiated one.");
+		}
+		return true;
+	}
+	response_error_str = proto_handler.get_response_code_description(header.code);
+	return false;
 }
-bool Client::check_crc(const unsigned long& client_crc, const uint32_t& server_crc) const {
-	std::cout << "<Info>: Client CRC: " << client_crc << std::endl;
-	std::cout << "<Info>: Server CRC: " << server_crc << std::endl;
-	if (client_crc == server_crc) {
-		std::cout << "<Info>: CRC check passed." << std::endl;
+bool Client::check_crc(Checksum::Algorithm algorithm, uint64_t client_checksum, uint64_t server_checksum) const {
+	GYF_LOG(Info) << "Client CRC (" << Checksum::get_name(algorithm) << "): " << client_checksum;
+	GYF_LOG(Info) << "Server CRC (" << Checksum::get_name(algorithm) << "): " << server_checksum;
+	if (client_checksum == server_checksum) {
+		GYF_LOG(Info) << "CRC check passed.";
 		return true;
 	}
-	std::cerr << "<Error>: CRC check failed." << std::endl;
+	GYF_LOG(Error) << "CRC check failed.";
 	return false;
 
 }
@@ -335,52 +458,59 @@ bool Client::get_message_confirm_response(std::string& response_error_str) {
 		response_error_str = proto_handler.get_response_code_description(header.code);
 		return false;
 	}
-	std::cout << "<Info>: Server confirmed the message." << std::endl;
-	net_manager.receive_confirm_message_payload();
+	GYF_LOG(Info) << "Server confirmed the message.";
+	net_manager.receive_confirm_message_payload(header);
 	return true;
 }
 void Client::perform_send_crc_correct(const std::string& file_name) {
-	std::cout << "<Info>: Sending CRC correct state to server.." << std::endl;
+	GYF_LOG(Info) << "Sending CRC correct state to server..";
 	perform_operation(
 		net_manager,
-		[this, file_name]() -> Request* { return proto_handler.create_crc_state_request(id, file_name, Client::STATE_CORRECT); },
+		[this, file_name]() { return proto_handler.create_crc_state_request(id, file_name, Client::STATE_CORRECT); },
 		[this](std::string& response_error_str) { return get_message_confirm_response(response_error_str); }
 	);
 }
 void Client::perform_send_crc_bad(const std::string& file_name) {
-	std::cout << "<Info>: Sending CRC bad state to server.." << std::endl;
+	GYF_LOG(Info) << "Sending CRC bad state to server..";
 	perform_operation(
 		net_manager,
-		[this, file_name]() -> Request* { return proto_handler.create_crc_state_request(id, file_name, Client::STATE_BAD); },
-		[this](std::string& response_error_str) { return true; } // not expecting a response from server
+		[this, file_name]() { return proto_handler.create_crc_state_request(id, file_name, Client::STATE_BAD); },
+		[](std::string&) { return true; } // not expecting a response from server
 	);
 }
 void Client::perform_send_crc_terminate(const std::string& file_name) {
-	std::cout << "<Info>: Sending CRC terminate state to server.." << std::endl;
+	GYF_LOG(Info) << "Sending CRC terminate state to server..";
 	perform_operation(
 		net_manager,
-		[this, file_name]() -> Request* { return proto_handler.create_crc_state_request(id, file_name, Client::STATE_TERMINATE); },
+		[this, file_name]() { return proto_handler.create_crc_state_request(id, file_name, Client::STATE_TERMINATE); },
 		[this](std::string& response_error_str) { return get_message_confirm_response(response_error_str); }
 	);
 }
-void Client::perform_send_file() {
-	std::cout << "<Info>: Starting the process of sending the file " << file_path << std::endl;
-	CRCHandler crc_handler;
-	std::future<unsigned long> future_crc = crc_handler.calculate(file_path);
-	FileChunker chunker(file_path, aes_key);
+void Client::perform_send_file(const std::string& path) {
+	GYF_LOG(Info) << "Starting the process of sending the file " << path;
+	Metrics::ScopedTimer timer(Metrics::Stage::SEND_FILE);
+	Checksum::Algorithm algorithm = perform_negotiate_checksum(std::filesystem::path(path).filename().string());
+	std::future<uint64_t> future_crc = take_checksum(path, algorithm);
+	FileChunker chunker(path, aes_key, net_manager.get_server_version() >= SendZeroRangesRequest::SPARSE_VERSION);
 	print_file_info(chunker);
+	check_file_fits(chunker);
+	timer.add_bytes(chunker.get_original_size());
 	std::string file_name = chunker.get_file_name();
-	unsigned long calculated_crc = future_crc.get(), server_crc{}; // client, server CRCs
+	uint64_t calculated_crc, server_crc{}; // client, server checksums
+	{
+		Metrics::ScopedTimer wait_timer(Metrics::Stage::CRC_WAIT);
+		calculated_crc = future_crc.get();
+	}
 	std::string response_error_str;
 	for (auto attempt = 1; attempt <= ProtocolHandler::NUMBER_OF_ATTEMPTS; ++attempt) {
-		std::cout << "<Info>: Attempt #" << attempt << " to send the file.." << std::endl;
+		GYF_LOG(Info) << "Attempt #" << attempt << " to send the file..";
 		send_file_chunks(chunker);
-		if (!get_send_file_response(response_error_str, server_crc)) {
-			std::cerr << "<Error>: server responded with error" << std::endl;
+		if (!get_send_file_response(response_error_str, algorithm, server_crc)) {
+			GYF_LOG(Error) << "server responded with error";
 		}
 		else {
-			std::cout << "<Info>: Server received the file, checking CRC.." << std::endl;
-			if (check_crc(calculated_crc, server_crc)) {
+			GYF_LOG(Info) << "Server received the file, checking CRC..";
+			if (check_crc(algorithm, calculated_crc, server_crc)) {
 				perform_send_crc_correct(file_name);
 				return;
 			}
@@ -394,18 +524,157 @@ void Client::perform_send_file() {
 		}
 	}
 }
-void Client::start()
+bool Client::get_file_info_response(std::string& response_error_str, StoredFileInfo& info) {
+	ResponseHeader header = net_manager.receive_response_header();
+	if (header.code != ResponseCode::FILE_INFO) {
+		response_error_str = proto_handler.get_response_code_description(header.code);
+		return false;
+	}
+	info = net_manager.receive_file_info_payload();
+	if (!Checksum::is_available(static_cast<Checksum::Algorithm>(info.algorithm))) {
+		throw std::runtime_error("<Error>: Server selected a checksum algorithm that was not proposed.");
+	}
+	return true;
+}
+StoredFileInfo Client::perform_file_info(const std::string& file_name) {
+	GYF_LOG(Info) << "Asking the server for " << file_name << "..";
+	return perform_operation<StoredFileInfo>(
+		net_manager,
+		[this, &file_name]() { return proto_handler.create_file_info_request(id, file_name, checksum_preference); },
+		[this](std::string& response_error_str, StoredFileInfo& info) { return get_file_info_response(response_error_str, info); }
+	);
+}
+void Client::perform_download(const std::string& file_name, const std::string& output, unsigned int connections) {
+	Metrics::ScopedTimer timer(Metrics::Stage::DOWNLOAD);
+	uint8_t server_version = net_manager.get_server_version();
+	if (server_version < FileInfoRequest::DOWNLOAD_VERSION) {
+		throw std::runtime_error("<Error>: The server (protocol version " + std::to_string(server_version) + ") cannot send files back, update it to download.");
+	}
+	StoredFileInfo info = perform_file_info(file_name);
+	GYF_LOG(Info) << "File size: " << info.size << " bytes (" << info.size - info.data_size << " in zero ranges)";
+	GYF_LOG(Info) << "Range checksum: " << Checksum::get_name(static_cast<Checksum::Algorithm>(info.algorithm));
+	RangeDownloader downloader(id, aes_key, file_name, output, info);
+	size_t missing = downloader.prepare();
+	if (missing < downloader.get_range_count()) {
+		GYF_LOG(Info) << "Resuming the download of " << output << ", " << missing << " of " << downloader.get_range_count() << " ranges left..";
+	}
+	// the other connections skip the handshake: the server encrypts for the client id, with the key of this session
+	std::vector<std::unique_ptr<NetworkManager>> extra_connections;
+	std::vector<NetworkManager*> used{ &net_manager };
+	for (unsigned int i = 1; i < connections && i < missing; ++i) {
+		extra_connections.push_back(std::make_unique<NetworkManager>());
+		extra_connections.back()->establish(address);
+		used.push_back(extra_connections.back().get());
+	}
+	GYF_LOG(Info) << "Downloading " << missing << " ranges of " << RangeDownloader::RANGE_SIZE << " bytes over " << used.size() << " connection(s)..";
+	downloader.run(used);
+	for (std::unique_ptr<NetworkManager>& connection : extra_connections) {
+		connection->close();
+	}
+	timer.add_bytes(info.size);
+	GYF_LOG(Info) << file_name << " downloaded to " << output << ", every range passed its checksum.";
+}
+void Client::connect()
+{
+	net_manager.establish(address);
+}
+void Client::handshake()
 {
-	setup();
-	net_manager.establish(host, std::to_string(port));
 	uint32_t aes_key_size{};
 	if (is_registered) {
 		aes_key_size = perform_attempt_reconnect(); // attempts to check if the me.info data valid server-side wise
 	}
 	if (!is_registered) { // if registered was flagged true and reconnect failed, will be flagged false again
+		prepare_key_pair(); // overlaps the registration round trip when reconnecting was rejected
 		perform_register();
 		aes_key_size = perform_send_public_key();
+		is_registered = true; // a later session reconnects with the new id
 	}
 	get_aes_key(aes_key_size);
-	perform_send_file();
+}
+void Client::open_session()
+{
+	connect();
+	handshake();
+}
+void Client::prepare_file(const std::string& path)
+{
+	std::error_code error;
+	if (!std::filesystem::is_regular_file(path, error)) {
+		throw std::runtime_error("<Error>: Could not open the file required to send: " + path);
+	}
+	if (!checksum_preference.empty()) { // the server picks the first proposed algorithm it supports, usually the first
+		Checksum::Algorithm algorithm = checksum_preference.front();
+		speculative_checksum.path = path;
+		speculative_checksum.algorithm = algorithm;
+		speculative_checksum.cancelled = std::make_shared<std::atomic<bool>>(false);
+		speculative_checksum.value = crc_handler.calculate(path, algorithm, speculative_checksum.cancelled);
+	}
+}
+std::future<uint64_t> Client::take_checksum(const std::string& path, Checksum::Algorithm algorithm)
+{
+	if (speculative_checksum.value.valid()) {
+		std::future<uint64_t> prepared = std::move(speculative_checksum.value);
+		if (speculative_checksum.path == path && speculative_checksum.algorithm == algorithm) {
+			return prepared;
+		}
+		// a server that predates the negotiation or lacks the algorithm, the reads stop at their next block and the
+		// discarded future is waited for here
+		speculative_checksum.cancelled->store(true, std::memory_order_relaxed);
+		GYF_LOG(Debug) << "The server picked another checksum algorithm, calculating again..";
+	}
+	return crc_handler.calculate(path, algorithm);
+}
+void Client::start()
+{
+	started = std::chrono::steady_clock::now();
+	setup();
+	// resolving and connecting runs next to everything that does not need the session
+	std::future<void> connected = std::async(std::launch::async, [this]() { connect(); });
+	if (is_registered) {
+		prepare_private_key();
+	}
+	prepare_file(file_path);
+	connected.get();
+	handshake();
+	perform_send_file(file_path);
+}
+void Client::send_watched_file(const std::string& path)
+{
+	try {
+		perform_send_file(path);
+	}
+	catch (const boost::system::system_error& e) {
+		GYF_LOG(Warning) << "Connection lost (" << e.what() << "), opening a new session..";
+		net_manager.close();
+		open_session();
+		perform_send_file(path);
+	}
+}
+void Client::watch(DirectoryWatcher& watcher)
+{
+	setup();
+	open_session(); // once, every file below goes over this session
+	GYF_LOG(Info) << "Waiting for files..";
+	std::vector<std::string> ready;
+	while (watcher.wait(ready)) {
+		for (const std::string& path : ready) {
+			try {
+				send_watched_file(path);
+			}
+			catch (const std::exception& e) { // a bad file (gone already, unreadable) or a server that is down, the next file tries again
+				GYF_LOG_PLAIN(Error) << e.what();
+				GYF_LOG(Error) << "Skipping " << path;
+			}
+		}
+	}
+	GYF_LOG(Info) << "Stopped watching, closing the session.";
+	net_manager.close();
+}
+void Client::download(const std::string& file_name, const std::string& output, unsigned int connections)
+{
+	setup(); // the file line of transfer.info is not used
+	open_session();
+	perform_download(file_name, output, connections);
+	net_manager.close();
 }
\ No newline at end of file
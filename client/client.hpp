@@ -3,8 +3,16 @@
 #include "network_manager.h"
 #include "protocol_handler.h"
 #include "crypto_manager.h"
-#include <iostream>
+#include "logger.h"
 #include "file_chunker.h"
+#include "metrics.h"
+#include "request_pool.h"
+#include "directory_watcher.h"
+#include "checksum.h"
+#include "key_pool.h"
+#include "crc_handler.h"
+#include <chrono>
+#include <future>
 
 class Client {
 
@@ -22,8 +30,7 @@ private:
 	static constexpr uint8_t STATE_TERMINATE = 2;
 
 	//fields for transfer.info
-	std::string host;
-	uint16_t port;
+	Transport::Address address; // host:port, unix:<path> or shm:<path>
 	std::string name;
 	std::string file_path;
 
@@ -42,10 +49,31 @@ private:
 	// for crypto stuff
 	const CryptoManager& crypto_manager = CryptoManager::get_instance();
 
+	// checksum algorithms to propose for each file, most preferred first (only cksum: no negotiation, as protocol v3 did)
+	std::vector<Checksum::Algorithm> checksum_preference;
+
+	// the key pair for registering, started as soon as setup() finds no me.info so it is ready by the time it is sent
+	KeyPool key_pool;
+	std::future<KeyPool::KeyPair> pending_key_pair;
+
+	// prepared by start() while connecting: priv.key decoded, and the file's checksum with the algorithm most likely picked
+	std::future<std::string> pending_private_key;
+	CRCHandler crc_handler;
+	struct SpeculativeChecksum {
+		std::string path;
+		Checksum::Algorithm algorithm = Checksum::Algorithm::CKSUM;
+		std::future<uint64_t> value;
+		std::shared_ptr<std::atomic<bool>> cancelled; // set when the server picks another algorithm
+	} speculative_checksum;
+	std::chrono::steady_clock::time_point started{}; // when start() began, until the first file bytes are sent
+
+	// send file requests are reused across chunks (and attempts), so the data path does not allocate per packet
+	RequestPool<SendFileRequest> send_file_pool;
+
 	//transfer.info handling
 	void get_transfer_info_content(); // retrieves the content of transfer.info
 	void parse_transfer_info_line(const int& line_number, const std::string& line); // parses specific line from transfer.info
-	bool check_host(const std::string& address) const; 	// checks if the address is valid
+	bool check_host(const std::string& host) const; 	// checks if the address is valid
 	void get_address(std::string line); // gets the address from the line
 
 	//me.info handling
@@ -54,36 +82,52 @@ private:
 	void output_to_me_info();
 
 	// public key handling
+	void prepare_key_pair(); // starts taking the key pair in the background, unless it already is
 	std::string create_public_key(); // creates the public key
 	void output_to_priv_key(std::string private_key_64); // outputs the private key to priv.key
 	void output_key_to_me_info(std::string private_key_64); // outputs the private key to me.info
 
 	// retrieves and validates the required info, then sets up the connection
 	void setup();
+	void connect();
+	void handshake(); // reconnects (or registers) and retrieves the AES key
+	void open_session(); // connect() then handshake()
+	void prepare_private_key(); // reads and decodes priv.key in the background
+	void prepare_file(const std::string& path); // checks the file and starts its checksum in the background
+	std::future<uint64_t> take_checksum(const std::string& path, Checksum::Algorithm algorithm); // the prepared one if it fits
+	void send_watched_file(const std::string& path); // survives a dropped connection and files that cannot be sent
 	
 	// registeration process
 	bool get_register_response(std::string& response_error_str);
-	Request* create_register();
+	RegisterRequest create_register();
 
 	// reconnection process
 	bool get_reconnect_response(std::string& response_error_str, uint32_t& response_return);
 
 	// sending public key process
-	Request* create_public_key_request(); // creates the request for sending the public key
+	SendPublicKeyRequest create_public_key_request(); // creates the request for sending the public key
 	bool get_send_public_key_response(std::string& response_error_str, uint32_t& response_return); // gets the response for sending the public key
 	std::string get_private_key_from_priv_key(); // gets the private key from priv.key in base 64
 
 	// aes key receiving
-	void retrieve_aes_key(const std::string& aes_string); // gets the aes key from server
+	void retrieve_aes_key(std::string_view aes_string); // gets the aes key from server
 	void get_aes_key(uint32_t aes_key_size); // starts the operation of retrieving the aes key
 
 	// sending file process
 	void send_file_chunks(FileChunker& chunker);
+	void send_zero_ranges(const FileChunker& chunker); // before the first packet of every attempt, to servers that take them
 	void print_file_info(const FileChunker& chunker) const;
-	bool get_send_file_response(std::string& response_error_str, unsigned long& server_crc);
-	bool check_crc(const unsigned long& server_crc, const uint32_t& client_crc) const;
+	void check_file_fits(const FileChunker& chunker) const; // throws when the server's send file request cannot describe it
+	bool get_checksum_selected_response(std::string& response_error_str, uint8_t& algorithm);
+	bool get_send_file_response(std::string& response_error_str, Checksum::Algorithm algorithm, uint64_t& server_checksum);
+	bool check_crc(Checksum::Algorithm algorithm, uint64_t client_checksum, uint64_t server_checksum) const;
 	bool get_message_confirm_response(std::string& response_error_str);
 
+	// download process
+	bool get_file_info_response(std::string& response_error_str, StoredFileInfo& info);
+	StoredFileInfo perform_file_info(const std::string& file_name);
+	void perform_download(const std::string& file_name, const std::string& output, unsigned int connections);
+
 	//void op_reconnect();
 	//void op_send_file();
 
@@ -91,19 +135,24 @@ private:
 	void perform_register();
 	uint32_t perform_send_public_key();
 	uint32_t perform_attempt_reconnect(); // checks whether the client from me.info really exists in server and reconnects in
-	void perform_send_file();
+	Checksum::Algorithm perform_negotiate_checksum(const std::string& file_name);
+	void perform_send_file(const std::string& path);
 	void perform_send_crc_correct(const std::string& file_name);
 	void perform_send_crc_bad(const std::string& file_name);
 	void perform_send_crc_terminate(const std::string& file_name);
 
 public:
 	//client version
-	static constexpr uint8_t CLIENT_VERSION = 3;
+	static constexpr uint8_t CLIENT_VERSION = 6;
 
 	Client();
 	~Client();
 
-	void start();
+	void set_checksum_preference(const std::vector<Checksum::Algorithm>& preference);
+	void start(); // sends the file from transfer.info and returns, connecting while the key and the file are prepared
+	void watch(DirectoryWatcher& watcher); // keeps one session open and sends every file the watcher reports, until it is stopped
+	// fetches a file this client sent (and verified) into output, over that many connections; an interrupted download resumes
+	void download(const std::string& file_name, const std::string& output, unsigned int connections);
 
 	// template for performing operations
 	template<typename ReturnType, typename RequestFunc, typename ResponseHandler>
@@ -115,36 +164,38 @@ public:
 
 template<typename ReturnType, typename RequestFunc, typename ResponseHandler>
 ReturnType Client::perform_operation(NetworkManager& net_manager, RequestFunc request_creator, ResponseHandler response_handler) {
-	std::cout << "--------" << std::endl;
-	std::unique_ptr<Request> request(request_creator()); // pre + request
+	GYF_LOG_PLAIN(Info) << "--------";
+	auto request = request_creator(); // pre + request
 	std::string response_error_str;
 	ReturnType response_return{};
 	for (auto attempt = 1; attempt <= ProtocolHandler::NUMBER_OF_ATTEMPTS; ++attempt) {
-		std::cout << "<Info>: Doing attempt #" << attempt << ".." << std::endl;
-		net_manager.send_request(request.get());
+		GYF_LOG(Info) << "Doing attempt #" << attempt << "..";
+		Metrics::ScopedTimer timer(Metrics::Stage::OPERATION);
+		net_manager.send_request(request);
 		if (response_handler(response_error_str, response_return)) { // post if succeed
-			//std::cout << "<Info>: Operation successful." << std::endl;
-			std::cout << "--------" << std::endl;
+			//GYF_LOG(Info) << "Operation successful.";
+			GYF_LOG_PLAIN(Info) << "--------";
 			return response_return;
 		}
-		std::cerr << "<Error>: server responded with error" << std::endl;
+		GYF_LOG(Error) << "server responded with error";
 	}
 	throw std::runtime_error("<Error>: Fatal! Server responded with " + response_error_str + "\n");
 }
 template<typename RequestFunc, typename ResponseHandler>
 void Client::perform_operation(NetworkManager& net_manager, RequestFunc request_creator, ResponseHandler response_handler) {
-	std::cout << "--------" << std::endl;
-	std::unique_ptr<Request> request(request_creator()); // pre + request
+	GYF_LOG_PLAIN(Info) << "--------";
+	auto request = request_creator(); // pre + request
 	std::string response_error_str;
 	for (auto attempt = 1; attempt <= ProtocolHandler::NUMBER_OF_ATTEMPTS; ++attempt) {
-		std::cout << "<Info>: Doing attempt #" << attempt << ".." << std::endl;
-		net_manager.send_request(request.get());
+		GYF_LOG(Info) << "Doing attempt #" << attempt << "..";
+		Metrics::ScopedTimer timer(Metrics::Stage::OPERATION);
+		net_manager.send_request(request);
 		if (response_handler(response_error_str)) { // post if succeed
-			std::cout << "<Info>: Operation successful." << std::endl;
-			std::cout << "--------" << std::endl;
+			GYF_LOG(Info) << "Operation successful.";
+			GYF_LOG_PLAIN(Info) << "--------";
 			return;
 		}
-		std::cerr << "<Error>: server responded with error" << std::endl;
+		GYF_LOG(Error) << "server responded with error";
 	}
 	throw std::runtime_error("<Error>: Fatal! Server responded with " + response_error_str + "\n");
 }
\ No newline at end of file
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#if defined(__x86_64__) || defined(_M_X64)
+#include <nmmintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#define GYF_CRC32C_HARDWARE 1
+#endif
+
+// CRC32CCore holds CRC32C (Castagnoli, reflected 0x82f63b78), shared by the client's checksum policies and the server's
+// native check_sum extension. On x86-64 it runs on the SSE4.2 crc32 instruction when the CPU has it, elsewhere on
+// slicing-by-8 tables. The state starts at START and is inverted when finished (check value of "123456789": 0xe3069283).
+namespace CRC32CCore {
+
+	constexpr uint32_t POLYNOMIAL = 0x82f63b78;
+	constexpr uint32_t START = 0xffffffff;
+
+	// table[0] is the byte-wise table, table[k] advances an entry of table[0] by k more zero bytes (slicing-by-8)
+	struct Tables {
+		uint32_t table[8][256];
+		constexpr Tables() : table() {
+			for (uint32_t i = 0; i < 256; ++i) {
+				uint32_t crc = i;
+				for (int bit = 0; bit < 8; ++bit) {
+					crc = (crc >> 1) ^ ((crc & 1) ? POLYNOMIAL : 0);
+				}
+				table[0][i] = crc;
+			}
+			for (int k = 1; k < 8; ++k) {
+				for (uint32_t i = 0; i < 256; ++i) {
+					table[k][i] = (table[k - 1][i] >> 8) ^ table[0][table[k - 1][i] & 0xff];
+				}
+			}
+		}
+	};
+	inline constexpr Tables tables{};
+
+	inline uint32_t update_software(uint32_t crc, const unsigned char* b, size_t n) {
+		const auto& t = tables.table;
+		while (n >= 8) {
+			uint32_t low = crc ^ (static_cast<uint32_t>(b[0]) | static_cast<uint32_t>(b[1]) << 8 |
+				static_cast<uint32_t>(b[2]) << 16 | static_cast<uint32_t>(b[3]) << 24);
+			crc = t[7][low & 0xff] ^ t[6][(low >> 8) & 0xff] ^ t[5][(low >> 16) & 0xff] ^ t[4][low >> 24] ^
+				t[3][b[4]] ^ t[2][b[5]] ^ t[1][b[6]] ^ t[0][b[7]];
+			b += 8;
+			n -= 8;
+		}
+		while (n--) {
+			crc = (crc >> 8) ^ t[0][(crc ^ *b++) & 0xff];
+		}
+		return crc;
+	}
+
+#ifdef GYF_CRC32C_HARDWARE
+#if defined(__GNUC__) || defined(__clang__)
+	__attribute__((target("sse4.2")))
+#endif
+	inline uint32_t update_hardware(uint32_t crc, const unsigned char* b, size_t n) {
+		uint64_t crc64 = crc;
+		while (n >= 8) {
+			uint64_t word;
+			std::memcpy(&word, b, sizeof(word));
+			crc64 = _mm_crc32_u64(crc64, word);
+			b += 8;
+			n -= 8;
+		}
+		uint32_t crc32 = static_cast<uint32_t>(crc64);
+		while (n--) {
+			crc32 = _mm_crc32_u8(crc32, *b++);
+		}
+		return crc32;
+	}
+
+	inline bool detect_hardware() {
+#if defined(_MSC_VER)
+		int info[4];
+		__cpuid(info, 1);
+		return (info[2] & (1 << 20)) != 0;
+#else
+		return __builtin_cpu_supports("sse4.2");
+#endif
+	}
+#endif
+
+	inline bool has_hardware() {
+#ifdef GYF_CRC32C_HARDWARE
+		static const bool supported = detect_hardware();
+		return supported;
+#else
+		return false;
+#endif
+	}
+
+	// feeds n bytes into a running (not yet finished) state
+	inline uint32_t update(uint32_t crc, const unsigned char* b, size_t n) {
+#ifdef GYF_CRC32C_HARDWARE
+		if (has_hardware()) {
+			return update_hardware(crc, b, n);
+		}
+#endif
+		return update_software(crc, b, n);
+	}
+
+	inline uint32_t finish(uint32_t crc) {
+		return ~crc;
+	}
+}
@@ -1,46 +1,103 @@
 #include "crc_handler.h"
+#include <algorithm>
 #include <filesystem>
 #include <fstream>
+#include <limits>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <boost/asio/post.hpp>
+#include <boost/asio/thread_pool.hpp>
+#include "logger.h"
+#include "metrics.h"
 
+namespace {
+	unsigned int core_count() {
+		return std::max(1u, std::thread::hardware_concurrency());
+	}
+	// shared by every CRCHandler, so segments never wait for threads to be created
+	boost::asio::thread_pool& segment_pool() {
+		static boost::asio::thread_pool pool(core_count());
+		return pool;
+	}
+}
 
-std::future<unsigned long> CRCHandler::calculate(const std::string& file_path) const {
-	return std::async(&CRCHandler::read_and_calculate, this, file_path);
+CRCHandler::CRCHandler(unsigned int max_threads) : max_threads(max_threads ? max_threads : core_count())
+{
+}
+std::future<uint64_t> CRCHandler::calculate(const std::string& file_path, Checksum::Algorithm algorithm,
+	std::shared_ptr<const std::atomic<bool>> cancelled) const {
+	return Checksum::visit(algorithm, [this, &file_path, &cancelled](auto policy) {
+		return std::async(&CRCHandler::read_and_calculate<decltype(policy)>, this, file_path, std::move(cancelled));
+	});
 }
-unsigned long CRCHandler::read_and_calculate(const std::string& file_path) const {
-	if (std::filesystem::exists(file_path)) {
-		std::filesystem::path fpath = file_path;
-		std::ifstream f1(file_path.c_str(), std::ios::binary);
-		if (!f1.is_open()) {
-			std::cerr << "Cannot open input file " << file_path << std::endl;
-			return 0;
+template<typename Policy>
+uint64_t CRCHandler::calculate_segment(const std::string& file_path, uint64_t offset, uint64_t length, typename Policy::State& state,
+	const std::atomic<bool>* cancelled) {
+	uint64_t read_length = 0;
+	std::ifstream f1(file_path.c_str(), std::ios::binary);
+	if (!f1.is_open() || !f1.seekg(static_cast<std::streamoff>(offset))) {
+		return 0;
+	}
+	std::vector<char> block(READ_BLOCK_SIZE);
+	while (read_length < length && !(cancelled && cancelled->load(std::memory_order_relaxed))) {
+		size_t wanted = static_cast<size_t>(std::min<uint64_t>(block.size(), length - read_length));
+		if (!f1.read(block.data(), wanted) && f1.gcount() == 0) {
+			break;
 		}
-		size_t size = static_cast<size_t>(std::filesystem::file_size(fpath));
-		char* b = new char[size];
-		f1.seekg(0, std::ios::beg);
-		f1.read(b, size);
-		return memcrc(b, size);
+		size_t read_bytes = static_cast<size_t>(f1.gcount());
+		Policy::update(state, reinterpret_cast<const unsigned char*>(block.data()), read_bytes);
+		read_length += read_bytes;
 	}
-	else {
-		std::cerr << "Cannot open input file " << file_path << std::endl;
+	return read_length;
+}
+template<typename Policy>
+uint64_t CRCHandler::read_and_calculate(const std::string& file_path, std::shared_ptr<const std::atomic<bool>> cancelled) const {
+	std::error_code error;
+	uint64_t size = std::filesystem::file_size(file_path, error);
+	if (error) {
+		GYF_LOG(Error) << "Cannot open input file " << file_path;
 		return 0;
 	}
-}
-
-unsigned long CRCHandler::memcrc(char* b, size_t n) const {
-	unsigned int v = 0, c = 0;
-	unsigned long s = 0;
-	unsigned int tabidx;
-
-	for (size_t i = 0; i < n; i++) {
-		tabidx = (s >> 24) ^ (unsigned char)b[i];
-		s = UNSIGNED((s << 8)) ^ crctab[0][tabidx];
+	Metrics::ScopedTimer timer(Metrics::Stage::CRC_CALCULATE);
+	uint64_t segments = Policy::COMBINABLE ? std::min<uint64_t>(max_threads, size / MIN_SEGMENT_SIZE) : 1;
+	uint64_t length = 0;
+	typename Policy::State state;
+	Policy::start(state);
+	if (segments <= 1) {
+		length = calculate_segment<Policy>(file_path, 0, std::numeric_limits<uint64_t>::max(), state, cancelled.get()); // up to the end, even if it grew
 	}
-
-	while (n) {
-		c = n & 0377;
-		n = n >> 8;
-		s = UNSIGNED(s << 8) ^ crctab[0][(s >> 24) ^ c];
+	else if constexpr (Policy::COMBINABLE) {
+		// whole read blocks per segment, the last one takes the rest of the file
+		uint64_t segment_size = (size / segments + READ_BLOCK_SIZE - 1) / READ_BLOCK_SIZE * READ_BLOCK_SIZE;
+		struct Partial {
+			typename Policy::State state;
+			uint64_t length = 0;
+			std::future<void> done;
+		};
+		std::vector<Partial> partials(segments);
+		for (uint64_t i = 0; i < segments; ++i) {
+			uint64_t offset = i * segment_size;
+			uint64_t segment_length = i + 1 == segments ? std::numeric_limits<uint64_t>::max() : segment_size;
+			Partial& partial = partials[i];
+			Policy::start(partial.state);
+			auto task = std::make_shared<std::packaged_task<void()>>([&file_path, &partial, offset, segment_length, &cancelled] {
+				partial.length = calculate_segment<Policy>(file_path, offset, segment_length, partial.state, cancelled.get());
+			});
+			partial.done = task->get_future();
+			boost::asio::post(segment_pool(), [task] { (*task)(); });
+		}
+		for (Partial& partial : partials) {
+			partial.done.get();
+			Policy::combine(state, partial.state, partial.length);
+			length += partial.length;
+		}
 	}
-	delete[] b;
-	return (unsigned long)UNSIGNED(~s);
+	timer.add_bytes(length);
+	return Policy::finish(state, length);
+}
+
+unsigned long CRCHandler::memcrc(const char* b, size_t n) const {
+	uint32_t s = CRCCore::update(0, reinterpret_cast<const unsigned char*>(b), n);
+	return CRCCore::finalize(s, n);
 }
@@ -0,0 +1,157 @@
+#include "directory_watcher.h"
+#include <stdexcept>
+#include "logger.h"
+#ifdef __linux__
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+#ifdef __linux__
+DirectoryWatcher::DirectoryWatcher(const std::vector<std::string>& watched_directories, std::chrono::milliseconds debounce) :
+	debounce(debounce)
+{
+	inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (inotify_fd < 0 || pipe2(stop_pipe, O_NONBLOCK | O_CLOEXEC) != 0) {
+		throw std::runtime_error(std::string("<Error>: Could not start watching directories: ") + std::strerror(errno));
+	}
+	for (const std::string& directory : watched_directories) {
+		int watch = inotify_add_watch(inotify_fd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_MODIFY | IN_DELETE | IN_MOVED_FROM | IN_ONLYDIR);
+		if (watch < 0) {
+			throw std::runtime_error("<Error>: Could not watch " + directory + ": " + std::strerror(errno));
+		}
+		directories[watch] = directory;
+		GYF_LOG(Info) << "Watching " << directory;
+	}
+}
+
+DirectoryWatcher::~DirectoryWatcher()
+{
+	for (int fd : { inotify_fd, stop_pipe[0], stop_pipe[1] }) {
+		if (fd >= 0) {
+			close(fd);
+		}
+	}
+}
+
+void DirectoryWatcher::stop()
+{
+	char byte = 0;
+	ssize_t ignored = write(stop_pipe[1], &byte, 1);
+	(void)ignored;
+}
+
+bool DirectoryWatcher::wait(std::vector<std::string>& ready)
+{
+	ready.clear();
+	while (ready.empty()) {
+		pollfd fds[2] = { { inotify_fd, POLLIN, 0 }, { stop_pipe[0], POLLIN, 0 } };
+		int result = poll(fds, 2, next_timeout());
+		if (result < 0 && errno != EINTR) {
+			throw std::runtime_error(std::string("<Error>: Watching directories failed: ") + std::strerror(errno));
+		}
+		if (fds[1].revents & POLLIN) {
+			return false;
+		}
+		if (fds[0].revents & POLLIN) {
+			read_events();
+		}
+		collect_ready(ready);
+	}
+	return true;
+}
+
+void DirectoryWatcher::read_events()
+{
+	alignas(inotify_event) char buffer[16 * 1024];
+	ssize_t length;
+	while ((length = read(inotify_fd, buffer, sizeof(buffer))) > 0) {
+		std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+		for (char* position = buffer; position < buffer + length; ) {
+			const inotify_event* event = reinterpret_cast<const inotify_event*>(position);
+			position += sizeof(inotify_event) + event->len;
+			if (event->mask & IN_Q_OVERFLOW) {
+				GYF_LOG(Warning) << "Too many file events at once, some changes were missed.";
+				continue;
+			}
+			if (event->mask & IN_IGNORED) {
+				auto directory = directories.find(event->wd);
+				if (directory != directories.end()) {
+					GYF_LOG(Warning) << "Stopped watching " << directory->second << " (removed or unmounted).";
+					directories.erase(directory);
+				}
+				continue;
+			}
+			// editors and downloaders write into hidden temporary files first, the final rename is what counts
+			if (event->len == 0 || event->name[0] == '.' || (event->mask & IN_ISDIR) || directories.count(event->wd) == 0) {
+				continue;
+			}
+			std::string path = directories[event->wd] + "/" + event->name;
+			if (event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+				pending.erase(path);
+				continue;
+			}
+			PendingFile& file = pending[path];
+			file.deadline = now + debounce;
+			file.closed = (event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) != 0;
+		}
+	}
+}
+#else
+DirectoryWatcher::DirectoryWatcher(const std::vector<std::string>& watched_directories, std::chrono::milliseconds debounce) :
+	debounce(debounce)
+{
+	throw std::runtime_error("<Error>: Watching directories is only supported on Linux.");
+}
+
+DirectoryWatcher::~DirectoryWatcher()
+{
+}
+
+void DirectoryWatcher::stop()
+{
+}
+
+bool DirectoryWatcher::wait(std::vector<std::string>& ready)
+{
+	return false;
+}
+
+void DirectoryWatcher::read_events()
+{
+}
+#endif
+
+void DirectoryWatcher::collect_ready(std::vector<std::string>& ready)
+{
+	std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	for (auto file = pending.begin(); file != pending.end(); ) {
+		if (file->second.closed && file->second.deadline <= now) {
+			ready.push_back(file->first);
+			file = pending.erase(file);
+		}
+		else {
+			++file;
+		}
+	}
+}
+
+int DirectoryWatcher::next_timeout() const
+{
+	bool any = false;
+	std::chrono::steady_clock::time_point earliest;
+	for (const auto& [path, file] : pending) {
+		if (file.closed && (!any || file.deadline < earliest)) {
+			earliest = file.deadline;
+			any = true;
+		}
+	}
+	if (!any) {
+		return -1;
+	}
+	auto remaining = std::chrono::ceil<std::chrono::milliseconds>(earliest - std::chrono::steady_clock::now());
+	return remaining.count() > 0 ? static_cast<int>(remaining.count()) : 0;
+}
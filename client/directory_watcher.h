@@ -0,0 +1,38 @@
+#pragma once
+
+#include <chrono>
+#include <map>
+#include <string>
+#include <vector>
+
+// DirectoryWatcher reports the files written into a set of directories (not recursive), via inotify. A file is reported
+// once it was closed after writing (or moved in) and then left alone for the debounce interval, so files that are still
+// being written, or are saved several times in a row, are reported once. Linux only.
+class DirectoryWatcher {
+private:
+	struct PendingFile {
+		std::chrono::steady_clock::time_point deadline;
+		bool closed = false; // false while a writer may still have the file open
+	};
+
+	const std::chrono::milliseconds debounce;
+	int inotify_fd = -1;
+	int stop_pipe[2] = { -1, -1 };
+	std::map<int, std::string> directories; // watch descriptor to directory
+	std::map<std::string, PendingFile> pending; // path to its state
+
+	void read_events();
+	void collect_ready(std::vector<std::string>& ready);
+	int next_timeout() const; // in milliseconds, -1 when nothing is pending
+
+public:
+	DirectoryWatcher(const std::vector<std::string>& watched_directories, std::chrono::milliseconds debounce);
+	~DirectoryWatcher();
+	DirectoryWatcher(const DirectoryWatcher&) = delete;
+	DirectoryWatcher& operator=(const DirectoryWatcher&) = delete;
+
+	// blocks until at least one file is ready and fills ready with their paths, returns false once stop() was called
+	bool wait(std::vector<std::string>& ready);
+	// async-signal-safe, meant to be called from a SIGINT/SIGTERM handler
+	void stop();
+};
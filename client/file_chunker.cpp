@@ -1,44 +1,229 @@
 #include "file_chunker.h"
-#include <fstream>
-#include "crypto_manager.h"
+#include <algorithm>
+#include <cstring>
 #include <filesystem>
+#include <stdexcept>
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+#ifdef __linux__
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#include "aes_wrapper.h"
+#include "metrics.h"
 
+namespace {
 
-FileChunker::FileChunker(const std::string& path, const std::string& aes_key) : path(path), aes_key(aes_key) {
-	chunked_file = read_content();
-    encrypt_content();
+	// true when the n bytes are all zero, on SSE2 64 bytes per step; a data block usually fails on its first step
+	bool is_zero(const char* data, size_t n) {
+		size_t i = 0;
+#if defined(__SSE2__) || defined(_M_X64)
+		for (; i + 64 <= n; i += 64) {
+			const __m128i* p = reinterpret_cast<const __m128i*>(data + i);
+			__m128i any = _mm_or_si128(_mm_or_si128(_mm_loadu_si128(p), _mm_loadu_si128(p + 1)),
+				_mm_or_si128(_mm_loadu_si128(p + 2), _mm_loadu_si128(p + 3)));
+			if (_mm_movemask_epi8(_mm_cmpeq_epi8(any, _mm_setzero_si128())) != 0xffff) {
+				return false;
+			}
+		}
+#else
+		for (; i + 8 <= n; i += 8) {
+			uint64_t word;
+			std::memcpy(&word, data + i, sizeof(word));
+			if (word) {
+				return false;
+			}
+		}
+#endif
+		for (; i < n; ++i) {
+			if (data[i]) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	struct Extent {
+		uint64_t begin;
+		uint64_t end;
+	};
+
+	// the parts of the file that may hold data, on Linux what SEEK_DATA / SEEK_HOLE report (the rest are holes), elsewhere
+	// or when the file system cannot tell, the whole file
+	std::vector<Extent> data_extents(const std::string& path, uint64_t size) {
+#ifdef __linux__
+		int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+		if (fd >= 0) {
+			std::vector<Extent> extents;
+			uint64_t pos = 0;
+			while (pos < size) {
+				off_t data = ::lseek(fd, static_cast<off_t>(pos), SEEK_DATA);
+				if (data < 0) {
+					if (errno != ENXIO) { // ENXIO: only a hole is left
+						extents.push_back({ pos, size });
+					}
+					break;
+				}
+				off_t hole = ::lseek(fd, data, SEEK_HOLE);
+				uint64_t begin = std::min<uint64_t>(data, size);
+				uint64_t end = hole < 0 ? size : std::min<uint64_t>(hole, size);
+				if (begin < end) {
+					extents.push_back({ begin, end });
+				}
+				pos = std::max(end, begin + 1);
+			}
+			::close(fd);
+			return extents;
+		}
+#endif
+		return { { 0, size } };
+	}
+
+}
+
+
+FileChunker::FileChunker(const std::string& path, const std::string& aes_key, bool elide_zeros) : path(path), file(path, std::ios::binary), aes_key(aes_key) {
+	if (!file) {
+		throw std::runtime_error("Could not open the file required to send: " + path);
+	}
+	if (aes_key.size() != AESWrapper::DEFAULT_KEYLENGTH) {
+		throw std::length_error("key length must be 32 bytes");
+	}
+	original_size = std::filesystem::file_size(path);
+	plain.resize(static_cast<size_t>(std::min<uint64_t>(READ_SIZE, original_size)) + CryptoPP::AES::BLOCKSIZE);
+	data_size = original_size;
+	if (elide_zeros) {
+		find_zero_ranges();
+		for (const ZeroRange& range : zero_ranges) {
+			data_size -= range.length;
+		}
+	}
+	encrypted_size = (data_size / CryptoPP::AES::BLOCKSIZE + 1) * CryptoPP::AES::BLOCKSIZE;
+	rewind();
 }
 
-std::string FileChunker::read_content() {
-    std::ifstream file_to_read(path, std::ios::binary);
-    if (!file_to_read) {
-        throw std::runtime_error("Could not open the file required to send: " + path);
+void FileChunker::find_zero_ranges() {
+	Metrics::ScopedTimer timer(Metrics::Stage::ZERO_SCAN);
+	auto add = [this](uint64_t begin, uint64_t end) {
+		if (begin >= end) {
+			return;
+		}
+		if (!zero_ranges.empty() && zero_ranges.back().offset + zero_ranges.back().length == begin) {
+			zero_ranges.back().length += end - begin;
+		}
+		else {
+			zero_ranges.push_back({ begin, end - begin });
+		}
+	};
+	// whole blocks of a hole, a block at the end of the file may be partial
+	auto add_hole = [&](uint64_t begin, uint64_t end) {
+		begin = (begin + ZERO_BLOCK - 1) / ZERO_BLOCK * ZERO_BLOCK;
+		add(begin, end == original_size ? end : end / ZERO_BLOCK * ZERO_BLOCK);
+	};
+	uint64_t scanned = 0;
+	for (const Extent& extent : data_extents(path, original_size)) {
+		add_hole(scanned, extent.begin);
+		file.seekg(static_cast<std::streamoff>(extent.begin));
+		for (uint64_t pos = extent.begin; pos < extent.end;) {
+			// reads end on a block boundary, so no block is split between two of them
+			size_t length = static_cast<size_t>(std::min<uint64_t>(READ_SIZE - pos % ZERO_BLOCK, extent.end - pos));
+			file.read(&plain[0], length);
+			if (static_cast<size_t>(file.gcount()) != length) {
+				throw std::runtime_error("Could not read the file required to send (did it change?): " + path);
+			}
+			timer.add_bytes(length);
+			for (size_t i = 0; i < length;) {
+				uint64_t block = pos + i;
+				size_t block_length = std::min<size_t>(ZERO_BLOCK - block % ZERO_BLOCK, length - i);
+				bool whole = block % ZERO_BLOCK == 0 && (block_length == ZERO_BLOCK || block + block_length == original_size);
+				if (whole && is_zero(plain.data() + i, block_length)) {
+					add(block, block + block_length);
+				}
+				i += block_length;
+			}
+			pos += length;
+		}
+		scanned = extent.end;
 	}
-    std::string result((std::istreambuf_iterator<char>(file_to_read)),
-        std::istreambuf_iterator<char>());
-	original_size = result.size();
-    return result;
+	add_hole(scanned, original_size);
+	zero_ranges.erase(std::remove_if(zero_ranges.begin(), zero_ranges.end(),
+		[](const ZeroRange& range) { return range.length < MIN_ZERO_RANGE; }), zero_ranges.end());
+}
+
+void FileChunker::rewind() {
+	file.clear();
+	file.seekg(0);
+	CryptoPP::byte iv[CryptoPP::AES::BLOCKSIZE] = { 0 }; // same as AESWrapper::encrypt
+	encryption.SetKeyWithIV(reinterpret_cast<const CryptoPP::byte*>(aes_key.data()), aes_key.size(), iv);
+	encrypted.clear();
+	encrypted_pos = 0;
+	plain_read = 0;
+	data_read = 0;
+	next_zero = 0;
+	encrypted_all = false;
+	pos = 0;
+	offset = 0;
+	total_reads = 0;
 }
-void FileChunker::encrypt_content() {
-	CryptoManager& crypto_manager = CryptoManager::get_instance();
-    chunked_file = crypto_manager.aes_encrypt(aes_key, chunked_file);
+
+void FileChunker::read_block() {
+	Metrics::ScopedTimer timer(Metrics::Stage::FILE_LOAD);
+	encrypted.erase(0, encrypted_pos); // the chunks taken so far, keeps the capacity
+	encrypted_pos = 0;
+	while (next_zero < zero_ranges.size() && zero_ranges[next_zero].offset == plain_read) { // not in the stream
+		plain_read += zero_ranges[next_zero++].length;
+		file.seekg(static_cast<std::streamoff>(plain_read));
+	}
+	uint64_t data_end = next_zero < zero_ranges.size() ? zero_ranges[next_zero].offset : original_size;
+	// never past the size the chunks were counted with, even if the file grows meanwhile
+	size_t length = static_cast<size_t>(std::min<uint64_t>(READ_SIZE, data_end - plain_read));
+	file.read(&plain[0], length);
+	if (static_cast<size_t>(file.gcount()) != length) {
+		throw std::runtime_error("Could not read the file required to send (did it change?): " + path);
+	}
+	plain_read += length;
+	data_read += length;
+	timer.add_bytes(length);
+	size_t whole = length; // READ_SIZE and the zero ranges' boundaries are whole numbers of AES blocks
+	if (data_read == data_size) { // PKCS#7, as AESWrapper::encrypt pads
+		const size_t block = CryptoPP::AES::BLOCKSIZE;
+		whole = (length / block + 1) * block;
+		std::fill(plain.begin() + length, plain.begin() + whole, static_cast<char>(whole - length));
+		encrypted_all = true;
+	}
+	size_t end = encrypted.size();
+	encrypted.resize(end + whole);
+	encryption.ProcessData(reinterpret_cast<CryptoPP::byte*>(&encrypted[end]), reinterpret_cast<const CryptoPP::byte*>(plain.data()), whole);
 }
 
-size_t FileChunker::total_chunks() const {
-	return chunked_file.length() / CHUNK_SIZE + 1; // +1 to account for the last chunk (to be a separate partial packet)
+uint64_t FileChunker::total_chunks() const {
+	return (encrypted_size + CHUNK_SIZE - 1) / CHUNK_SIZE; // the last chunk may be partial
 }
 
-size_t FileChunker::get_original_size() const
+uint64_t FileChunker::get_original_size() const
 {
 	return original_size;
 }
 
-std::string FileChunker::get_next() {
-	if (pos >= chunked_file.length()) {
-		return "";
+const std::vector<ZeroRange>& FileChunker::get_zero_ranges() const
+{
+	return zero_ranges;
+}
+
+std::string_view FileChunker::get_next() {
+	if (is_finished()) {
+		return std::string_view();
+	}
+	while (encrypted.size() - encrypted_pos < CHUNK_SIZE && !encrypted_all) {
+		read_block();
 	}
-	size_t chunk_size = std::min(CHUNK_SIZE, chunked_file.length() - pos);
-	std::string chunk = chunked_file.substr(pos, chunk_size);
+	size_t chunk_size = std::min(CHUNK_SIZE, encrypted.size() - encrypted_pos);
+	Metrics::ScopedTimer timer(Metrics::Stage::FILE_NEXT_CHUNK, chunk_size);
+	std::string_view chunk = std::string_view(encrypted).substr(encrypted_pos, chunk_size);
+	encrypted_pos += chunk_size;
+	offset = pos;
 	pos += chunk_size;
 	++total_reads;
 	return chunk;
@@ -50,13 +235,17 @@ std::string FileChunker::get_file_name() const {
 }
 
 bool FileChunker::is_finished() const {
-	return pos >= chunked_file.length();
+	return pos >= encrypted_size;
 }
 
-size_t FileChunker::get_total_reads() const {
+uint64_t FileChunker::get_total_reads() const {
 	return total_reads;
 }
 
-size_t FileChunker::get_size() const {
-	return chunked_file.length();
-}
\ No newline at end of file
+uint64_t FileChunker::get_offset() const {
+	return offset;
+}
+
+uint64_t FileChunker::get_size() const {
+	return encrypted_size;
+}
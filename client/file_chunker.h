@@ -1,28 +1,57 @@
 #pragma once
 
+#include <cstdint>
+#include <fstream>
 #include <string>
+#include <string_view>
+#include <vector>
+#include <modes.h>
+#include <aes.h>
+#include "request.h"
 
-// FileChunker is a class that is responsible for reading a file and splitting it into chunks appropriate for sending over the network
+// FileChunker is a class that is responsible for reading a file and splitting it into chunks appropriate for sending over the network.
+// The file is read and encrypted a block at a time as the chunks are taken, so only READ_SIZE of it is in memory at once.
+// With zero elision (servers from SendZeroRangesRequest::SPARSE_VERSION on) the file's zero ranges are found up front, holes
+// with SEEK_DATA / SEEK_HOLE (Linux) and runs of all-zero ZERO_BLOCKs by scanning the data, and left out of the encrypted
+// stream: the chunks carry only the rest of the file, the server recreates the ranges from get_zero_ranges().
 class FileChunker {
 private:
 	const std::string path;
-	std::string chunked_file;
-	size_t pos = 0; // serves as an iterator in the sense of knowing where we are in the buffer
+	std::ifstream file;
 	const std::string aes_key;
-	size_t original_size;
-	size_t total_reads = 0;
+	uint64_t original_size;
+	std::vector<ZeroRange> zero_ranges; // sorted, start on a ZERO_BLOCK boundary and end on one or at the end of the file
+	uint64_t data_size; // original_size less the zero ranges, what is encrypted
+	uint64_t encrypted_size; // known before encrypting, PKCS#7 pads to the next whole AES block
+	CryptoPP::CBC_Mode<CryptoPP::AES>::Encryption encryption;
+	std::string plain; // read buffer, with room for the padding
+	std::string encrypted; // encrypted bytes, the ones before encrypted_pos were taken
+	size_t encrypted_pos = 0;
+	uint64_t plain_read = 0; // position in the file, zero ranges included
+	uint64_t data_read = 0;
+	size_t next_zero = 0; // the first zero range not skipped yet
+	bool encrypted_all = false; // the padding was added
+	uint64_t pos = 0; // encrypted bytes taken, serves as an iterator in the sense of knowing where we are in the file
+	uint64_t offset = 0; // of the last chunk taken
+	uint64_t total_reads = 0;
 
+	void read_block(); // part of the loading process, reads and encrypts the next READ_SIZE bytes of the file
+	void find_zero_ranges();
+public:
 	static constexpr size_t CHUNK_SIZE = 4096; // 4 KB for memory management efficiency
+	static constexpr size_t READ_SIZE = 1 << 20; // read and encrypted at once
+	static constexpr size_t ZERO_BLOCK = 4096; // granularity of the zero ranges, a whole number of AES blocks
+	static constexpr uint64_t MIN_ZERO_RANGE = 64 << 10; // a shorter run is sent, its record would save too little
 
-	std::string read_content(); // part of the loading process
-	void encrypt_content();
-public:
-	FileChunker(const std::string& path, const std::string& aes_key);
-	std::string get_next(); // getting the next chunk in the file
+	FileChunker(const std::string& path, const std::string& aes_key, bool elide_zeros = false);
+	void rewind(); // back to the first chunk, for sending the file again
+	std::string_view get_next(); // getting the next chunk in the file (a view into the chunker, valid until the next call)
 	bool is_finished() const; // checking if we are done with the file
-	size_t total_chunks() const;
-	size_t get_original_size() const;
-	size_t get_size() const;
-	size_t get_total_reads() const;
+	uint64_t total_chunks() const;
+	uint64_t get_original_size() const;
+	const std::vector<ZeroRange>& get_zero_ranges() const; // empty without zero elision
+	uint64_t get_size() const; // after encryption
+	uint64_t get_offset() const; // of the last chunk in the encrypted file
+	uint64_t get_total_reads() const;
 	std::string get_file_name() const; // gets the file name from the path
-};
\ No newline at end of file
+};
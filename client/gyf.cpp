@@ -1,19 +1,127 @@
 #include "client.hpp"
+#include <chrono>
+#include <csignal>
+#include <cstdlib>
 #include <exception>
 #include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+#include "checksum.h"
+#include "key_pool.h"
+#include "logger.h"
+#include "metrics.h"
+#ifdef _MSC_VER
 #define _CRTDBG_MAP_ALLOC
 #include <crtdbg.h>
+#endif
 
+static const char* USAGE = "usage: gyf [--log-level debug|info|warning|error|off] [--metrics json|prometheus] [--metrics-file path] [--watch directory]... [--debounce-ms ms] [--checksum xxh3,crc32c,cksum] [--prewarm-keys count] [--download file [--output path] [--connections count]]";
 
+// the watcher of daemon mode, SIGINT and SIGTERM stop it so the session is closed and the metrics are dumped
+static DirectoryWatcher* active_watcher = nullptr;
+static void stop_watching(int)
+{
+	if (active_watcher != nullptr) {
+		active_watcher->stop();
+	}
+}
+
+// usage: see USAGE
+// without --watch the file in transfer.info is sent once. With --watch (daemon mode) the client stays connected and sends
+// every file written into the watched directories (the file line of transfer.info is ignored), until SIGINT or SIGTERM.
+// the metrics are dumped at the end of the run when --metrics is given, and on SIGUSR1 at any time
+// --checksum lists the algorithms to propose to the server, best first (default: the fastest available built in)
+// --prewarm-keys only fills the key pool (keys/) up to count RSA key pairs, on every core, and exits; clients registering
+// from this directory take their key from there instead of generating one
+// --download fetches a file the client sent before into --output (default: its name), in ranges over --connections
+// connections (default 4); the ranges are checked as they arrive, and running it again resumes an interrupted download
 int main(int argc, char* argv[]) {
 	//_CrtSetDbgFlag(_CRTDBG_ALLOC_MEM_DF | _CRTDBG_LEAK_CHECK_DF);
+	Metrics::SignalReporter signal_reporter; // first, so every later thread leaves SIGUSR1 to it
 
+	Log::Level log_level = Log::Level::Info;
+	bool dump_metrics = false;
+	Metrics::Format metrics_format = Metrics::Format::JSON;
+	std::string metrics_path;
+	std::vector<std::string> watched_directories;
+	std::chrono::milliseconds debounce(500);
+	std::vector<Checksum::Algorithm> checksum_preference = Checksum::default_preference();
+	long prewarm_keys = -1;
+	std::string download_name;
+	std::string output_path;
+	unsigned int connections = 4;
+	for (int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		if (arg == "--log-level" && i + 1 < argc && Log::parse_level(argv[i + 1], log_level)) {
+			++i;
+		}
+		else if (arg == "--metrics" && i + 1 < argc && Metrics::parse_format(argv[i + 1], metrics_format)) {
+			dump_metrics = true;
+			++i;
+		}
+		else if (arg == "--metrics-file" && i + 1 < argc) {
+			metrics_path = argv[++i];
+		}
+		else if (arg == "--watch" && i + 1 < argc) {
+			watched_directories.push_back(argv[++i]);
+		}
+		else if (arg == "--debounce-ms" && i + 1 < argc && std::atoi(argv[i + 1]) >= 0) {
+			debounce = std::chrono::milliseconds(std::atoi(argv[++i]));
+		}
+		else if (arg == "--checksum" && i + 1 < argc && Checksum::parse_preference(argv[i + 1], checksum_preference)) {
+			++i;
+		}
+		else if (arg == "--prewarm-keys" && i + 1 < argc && std::atol(argv[i + 1]) > 0) {
+			prewarm_keys = std::atol(argv[++i]);
+		}
+		else if (arg == "--download" && i + 1 < argc) {
+			download_name = argv[++i];
+		}
+		else if (arg == "--output" && i + 1 < argc) {
+			output_path = argv[++i];
+		}
+		else if (arg == "--connections" && i + 1 < argc && std::atoi(argv[i + 1]) > 0) {
+			connections = static_cast<unsigned int>(std::atoi(argv[++i]));
+		}
+		else {
+			std::cerr << "<Error>: Unknown argument " << arg << std::endl;
+			std::cerr << USAGE << std::endl;
+			return 1;
+		}
+	}
+	Metrics::configure(metrics_format, metrics_path);
+	Log::Logger::get_instance().set_level(log_level);
+
+	std::unique_ptr<DirectoryWatcher> watcher; // outlives the client, the signal handlers may still reach it
 	try {
 		Client client;
-		client.start();
+		client.set_checksum_preference(checksum_preference);
+		if (prewarm_keys > 0) {
+			KeyPool pool;
+			size_t added = pool.fill(static_cast<size_t>(prewarm_keys));
+			GYF_LOG(Info) << "Key pool ready: " << added << " generated, " << pool.size() << " in " << KeyPool::DEFAULT_DIRECTORY;
+		}
+		else if (!download_name.empty()) {
+			client.download(download_name, output_path.empty() ? download_name : output_path, connections);
+		}
+		else if (watched_directories.empty()) {
+			client.start();
+		}
+		else {
+			watcher = std::make_unique<DirectoryWatcher>(watched_directories, debounce);
+			active_watcher = watcher.get();
+			std::signal(SIGINT, stop_watching);
+			std::signal(SIGTERM, stop_watching);
+			client.watch(*watcher);
+		}
 	}
 	catch (std::exception& e) {
-		std::cerr << e.what() << std::endl;
+		GYF_LOG_PLAIN(Error) << e.what();
+	}
+	Log::Logger::get_instance().flush();
+	if (dump_metrics) {
+		Metrics::dump();
 	}
 	return 0;
 }
\ No newline at end of file
@@ -0,0 +1,141 @@
+#include "key_pool.h"
+#include <algorithm>
+#include <atomic>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <osrng.h>
+#include "crypto_manager.h"
+#include "logger.h"
+#include "metrics.h"
+#include "rsa_wrapper.h"
+
+namespace fs = std::filesystem;
+
+KeyPool::KeyPool(std::string directory) : directory(std::move(directory))
+{
+}
+std::string KeyPool::generate()
+{
+	Metrics::ScopedTimer timer(Metrics::Stage::KEY_GENERATE);
+	RSAPrivateWrapper rsa_private;
+	return CryptoManager::get_instance().encode(rsa_private.getPrivateKey());
+}
+bool KeyPool::take_stored(std::string& private_key_64) const
+{
+	std::error_code error;
+	for (fs::directory_iterator it(directory, error), end; !error && it != end; it.increment(error)) {
+		const fs::path& path = it->path();
+		if (path.extension() != KEY_EXTENSION) {
+			continue;
+		}
+		fs::path claimed = path;
+		claimed += ".taken";
+		std::error_code rename_error;
+		fs::rename(path, claimed, rename_error);
+		if (rename_error) { // another client claimed it first
+			continue;
+		}
+		std::ifstream key_file(claimed, std::ios::binary);
+		private_key_64.assign(std::istreambuf_iterator<char>(key_file), std::istreambuf_iterator<char>());
+		key_file.close();
+		fs::remove(claimed, rename_error);
+		if (!private_key_64.empty()) {
+			return true;
+		}
+	}
+	return false;
+}
+void KeyPool::store(const std::string& private_key_64) const
+{
+	CryptoPP::AutoSeededRandomPool rng;
+	std::string name(8, '\0');
+	rng.GenerateBlock(reinterpret_cast<CryptoPP::byte*>(&name[0]), name.size());
+	name = CryptoManager::get_instance().hexify(name.data(), static_cast<unsigned int>(name.size()));
+	// written under a name take_stored() skips, then renamed, so a key is never claimed half written
+	fs::path partial = fs::path(directory) / (name + ".partial");
+	{
+		std::ofstream key_file(partial, std::ios::binary);
+		if (!key_file.is_open() || !(key_file << private_key_64)) {
+			throw std::runtime_error("<Error>: Could not write a key into " + directory + ".");
+		}
+	}
+	fs::rename(partial, fs::path(directory) / (name + KEY_EXTENSION));
+}
+KeyPool::KeyPair KeyPool::take() const
+{
+	KeyPair key_pair;
+	while (take_stored(key_pair.private_key_64)) {
+		try {
+			RSAPrivateWrapper rsa_private(CryptoManager::get_instance().decode(key_pair.private_key_64));
+			key_pair.public_key = rsa_private.getPublicKey();
+			GYF_LOG(Debug) << "Took a pre-generated key from " << directory;
+			return key_pair;
+		}
+		catch (const std::exception& e) {
+			GYF_LOG(Warning) << "Dropping a corrupt pre-generated key: " << e.what();
+		}
+	}
+	key_pair.private_key_64 = generate();
+	RSAPrivateWrapper rsa_private(CryptoManager::get_instance().decode(key_pair.private_key_64));
+	key_pair.public_key = rsa_private.getPublicKey();
+	return key_pair;
+}
+std::future<KeyPool::KeyPair> KeyPool::take_async() const
+{
+	return std::async(std::launch::async, [pool = *this]() { return pool.take(); });
+}
+size_t KeyPool::size() const
+{
+	size_t count = 0;
+	std::error_code error;
+	for (fs::directory_iterator it(directory, error), end; !error && it != end; it.increment(error)) {
+		if (it->path().extension() == KEY_EXTENSION) {
+			++count;
+		}
+	}
+	return count;
+}
+size_t KeyPool::fill(size_t target, unsigned int threads) const
+{
+	fs::create_directories(directory);
+	const size_t stored = size();
+	if (stored >= target) {
+		return 0;
+	}
+	const size_t missing = target - stored;
+	if (threads == 0) {
+		threads = std::max(1u, std::thread::hardware_concurrency());
+	}
+	threads = static_cast<unsigned int>(std::min<size_t>(threads, missing));
+
+	std::atomic<size_t> next{ 0 };
+	std::atomic<bool> failed{ false };
+	auto work = [&]() {
+		try {
+			while (!failed && next.fetch_add(1) < missing) {
+				store(generate());
+			}
+		}
+		catch (const std::exception& e) {
+			GYF_LOG_PLAIN(Error) << e.what();
+			failed = true;
+		}
+	};
+	std::vector<std::thread> workers;
+	for (unsigned int i = 1; i < threads; ++i) {
+		workers.emplace_back(work);
+	}
+	work();
+	for (std::thread& worker : workers) {
+		worker.join();
+	}
+	if (failed) {
+		throw std::runtime_error("<Error>: Could not fill the key pool in " + directory + ".");
+	}
+	return missing;
+}
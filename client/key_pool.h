@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstddef>
+#include <future>
+#include <string>
+
+// KeyPool hands out the RSA key pair a client registers with. Generating one (the prime search) is the slow part of the
+// registration, so a key is taken from a directory of pre-generated keys (filled ahead of time with gyf --prewarm-keys)
+// when there is one, and generated otherwise. Each pooled key is claimed by renaming its file, so clients sharing the
+// directory never get the same key.
+class KeyPool {
+public:
+	static constexpr const char* DEFAULT_DIRECTORY = "keys";
+	static constexpr const char* KEY_EXTENSION = ".key";
+
+	struct KeyPair {
+		std::string private_key_64; // base64, as priv.key and me.info store it
+		std::string public_key; // what the send public key request carries
+	};
+
+private:
+	std::string directory;
+
+	bool take_stored(std::string& private_key_64) const; // claims one pooled key, false when the pool is empty
+	void store(const std::string& private_key_64) const;
+	static std::string generate(); // a new private key in base64
+
+public:
+	explicit KeyPool(std::string directory = DEFAULT_DIRECTORY);
+
+	KeyPair take() const; // a pooled key if there is one, a new one otherwise
+	std::future<KeyPair> take_async() const; // take() on its own thread, so registration can go on meanwhile
+	size_t size() const; // keys ready in the pool
+	// generates keys on up to threads threads (0: one per core) until the pool holds target keys, returns how many were added
+	size_t fill(size_t target, unsigned int threads = 0) const;
+};
@@ -0,0 +1,209 @@
+#include "logger.h"
+#include <cstdio>
+#include <cstring>
+
+bool Log::parse_level(const std::string& name, Level& level)
+{
+	if (name == "debug") level = Level::Debug;
+	else if (name == "info") level = Level::Info;
+	else if (name == "warning") level = Level::Warning;
+	else if (name == "error") level = Level::Error;
+	else if (name == "off") level = Level::Off;
+	else return false;
+	return true;
+}
+
+// =========== Logger ===========
+
+Log::Logger::Logger() : slots(new Slot[CAPACITY])
+{
+	static_assert((CAPACITY & (CAPACITY - 1)) == 0, "CAPACITY must be a power of two");
+	for (size_t i = 0; i < CAPACITY; ++i) {
+		slots[i].sequence.store(i, std::memory_order_relaxed);
+	}
+	thread = std::thread(&Logger::drain, this);
+}
+
+Log::Logger::~Logger()
+{
+	stopping = true;
+	wake();
+	thread.join();
+}
+
+Log::Logger& Log::Logger::get_instance()
+{
+	static Logger instance;
+	return instance;
+}
+
+void Log::Logger::set_level(Level new_level)
+{
+	level.store(new_level, std::memory_order_relaxed);
+}
+
+void Log::Logger::push(Level line_level, bool tagged, const char* text, size_t length)
+{
+	size_t position = enqueue_position.load(std::memory_order_relaxed);
+	Slot* slot;
+	while (true) {
+		slot = &slots[position & (CAPACITY - 1)];
+		size_t sequence = slot->sequence.load(std::memory_order_acquire);
+		intptr_t difference = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position);
+		if (difference == 0) {
+			if (enqueue_position.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+				break;
+			}
+		}
+		else if (difference < 0) { // full
+			if (line_level == Level::Debug) {
+				dropped.fetch_add(1, std::memory_order_relaxed);
+				return;
+			}
+			wake();
+			std::this_thread::yield();
+			position = enqueue_position.load(std::memory_order_relaxed);
+		}
+		else {
+			position = enqueue_position.load(std::memory_order_relaxed);
+		}
+	}
+	slot->level = line_level;
+	slot->tagged = tagged;
+	slot->length = static_cast<uint16_t>(length < LINE_SIZE ? length : LINE_SIZE);
+	std::memcpy(slot->text, text, slot->length);
+	slot->sequence.store(position + 1, std::memory_order_release);
+	if (idle.load()) {
+		wake();
+	}
+}
+
+void Log::Logger::wake()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	idle = false;
+	wakeup.notify_one();
+}
+
+bool Log::Logger::write_next()
+{
+	Slot& slot = slots[dequeue_position & (CAPACITY - 1)];
+	if (slot.sequence.load(std::memory_order_acquire) != dequeue_position + 1) {
+		return false;
+	}
+	static const char* TAGS[] = { "<Debug>: ", "<Info>: ", "<Warning>: ", "<Error>: " };
+	FILE* out = slot.level >= Level::Warning ? stderr : stdout;
+	if (slot.tagged) {
+		std::fputs(TAGS[static_cast<size_t>(slot.level)], out);
+	}
+	std::fwrite(slot.text, 1, slot.length, out);
+	std::fputc('\n', out);
+	slot.sequence.store(dequeue_position + CAPACITY, std::memory_order_release);
+	++dequeue_position;
+	return true;
+}
+
+void Log::Logger::drain()
+{
+	while (true) {
+		while (write_next()) {
+		}
+		uint64_t lost = dropped.exchange(0, std::memory_order_relaxed);
+		if (lost != 0) {
+			std::fprintf(stderr, "<Warning>: %llu debug lines were dropped, the log buffer was full\n", static_cast<unsigned long long>(lost));
+		}
+		std::fflush(stdout);
+		std::fflush(stderr);
+		written_position.store(dequeue_position, std::memory_order_release);
+
+		idle = true;
+		if (slots[dequeue_position & (CAPACITY - 1)].sequence.load(std::memory_order_acquire) == dequeue_position + 1) {
+			idle = false;
+			continue;
+		}
+		if (stopping) {
+			return;
+		}
+		std::unique_lock<std::mutex> lock(mutex);
+		wakeup.wait_for(lock, std::chrono::milliseconds(100), [this] { return !idle || stopping; });
+	}
+}
+
+void Log::Logger::flush()
+{
+	size_t target = enqueue_position.load();
+	while (written_position.load(std::memory_order_acquire) < target) {
+		wake();
+		std::this_thread::sleep_for(std::chrono::microseconds(100));
+	}
+}
+
+// =========== Line ===========
+
+Log::Line::Buffer::Buffer()
+{
+	reset();
+}
+
+int Log::Line::Buffer::overflow(int c)
+{
+	return c; // the line is full, the rest is cut off
+}
+
+void Log::Line::Buffer::reset()
+{
+	setp(text, text + sizeof(text));
+}
+
+const char* Log::Line::Buffer::data() const
+{
+	return pbase();
+}
+
+size_t Log::Line::Buffer::size() const
+{
+	return static_cast<size_t>(pptr() - pbase());
+}
+
+Log::Line::ThreadState& Log::Line::thread_state()
+{
+	thread_local ThreadState state;
+	return state;
+}
+
+Log::Line::Line(Level level, bool tagged) : level(level), tagged(tagged)
+{
+	ThreadState& state = thread_state();
+	state.buffer.reset();
+	state.stream.flags(std::ios_base::dec | std::ios_base::skipws);
+	state.stream.precision(6);
+	state.stream.clear();
+}
+
+Log::Line::~Line()
+{
+	ThreadState& state = thread_state();
+	Logger::get_instance().push(level, tagged, state.buffer.data(), state.buffer.size());
+}
+
+std::ostream& Log::Line::stream()
+{
+	return thread_state().stream;
+}
+
+// =========== Progress ===========
+
+Log::Progress::Progress(const std::string& label, uint64_t total, std::chrono::milliseconds interval) :
+	label(label), total(total), interval(interval), last_line(std::chrono::steady_clock::now())
+{
+}
+
+void Log::Progress::update(uint64_t done)
+{
+	auto now = std::chrono::steady_clock::now();
+	if (done < total && now - last_line < interval) {
+		return;
+	}
+	last_line = now;
+	GYF_LOG(Info) << label << ": " << done << " out of " << total << " (" << (total ? done * 100 / total : 100) << "%)";
+}
@@ -0,0 +1,128 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <streambuf>
+#include <string>
+#include <thread>
+
+// lines below this level are compiled out entirely (0 debug, 1 info, 2 warning, 3 error, 4 off)
+#ifndef GYF_LOG_MIN_LEVEL
+#define GYF_LOG_MIN_LEVEL 0
+#endif
+
+// GYF_LOG(Info) << "Packet " << n << " sent."; prints "<Info>: Packet 7 sent." from the background thread
+#define GYF_LOG(level) GYF_LOG_LINE(level, true)
+// same, without the "<Level>: " tag (separators and such)
+#define GYF_LOG_PLAIN(level) GYF_LOG_LINE(level, false)
+#define GYF_LOG_LINE(level, tagged) \
+	if constexpr (!Log::compiled_in(Log::Level::level)) ; \
+	else if (!Log::Logger::get_instance().enabled(Log::Level::level)) ; \
+	else Log::Line(Log::Level::level, tagged).stream()
+
+// Log formats on the calling thread into a thread-local buffer and hands the line to a lock-free ring buffer, which a
+// background thread drains to the terminal, so logging never waits on console I/O.
+namespace Log {
+
+	enum class Level : uint8_t { Debug, Info, Warning, Error, Off };
+	constexpr Level MIN_LEVEL = static_cast<Level>(GYF_LOG_MIN_LEVEL);
+	constexpr bool compiled_in(Level level) { return level >= MIN_LEVEL; }
+	bool parse_level(const std::string& name, Level& level);
+
+	class Logger {
+	public:
+		constexpr static size_t CAPACITY = 1024; // lines, a power of two
+		constexpr static size_t LINE_SIZE = 480; // longer lines are truncated
+
+	private:
+		// a bounded multi-producer single-consumer queue, each slot carries its own sequence number
+		struct Slot {
+			std::atomic<size_t> sequence{ 0 };
+			Level level = Level::Info;
+			bool tagged = true;
+			uint16_t length = 0;
+			char text[LINE_SIZE];
+		};
+
+		std::unique_ptr<Slot[]> slots;
+		alignas(64) std::atomic<size_t> enqueue_position{ 0 };
+		alignas(64) size_t dequeue_position = 0; // background thread only
+		std::atomic<size_t> written_position{ 0 }; // lines already handed to the terminal
+		std::atomic<uint64_t> dropped{ 0 };
+
+		std::atomic<Level> level{ Level::Info };
+
+		std::mutex mutex;
+		std::condition_variable wakeup;
+		std::atomic<bool> idle{ false };
+		std::atomic<bool> stopping{ false };
+		std::thread thread;
+
+		Logger();
+		void drain();
+		bool write_next();
+		void wake();
+
+	public:
+		~Logger();
+		Logger(const Logger&) = delete;
+		Logger& operator=(const Logger&) = delete;
+		static Logger& get_instance();
+
+		bool enabled(Level line_level) const {
+			return line_level >= level.load(std::memory_order_relaxed);
+		}
+		void set_level(Level new_level);
+
+		// debug lines are dropped when the buffer is full, anything more important waits for room
+		void push(Level line_level, bool tagged, const char* text, size_t length);
+		void flush(); // returns once everything logged so far is on the terminal
+	};
+
+	// one log line, formatted into a thread-local buffer and pushed when it goes out of scope
+	class Line {
+	private:
+		class Buffer : public std::streambuf {
+		private:
+			char text[Logger::LINE_SIZE];
+		protected:
+			int overflow(int c) override;
+		public:
+			Buffer();
+			void reset();
+			const char* data() const;
+			size_t size() const;
+		};
+		struct ThreadState {
+			Buffer buffer;
+			std::ostream stream{ &buffer };
+		};
+		static ThreadState& thread_state();
+
+		const Level level;
+		const bool tagged;
+	public:
+		Line(Level level, bool tagged);
+		~Line();
+		Line(const Line&) = delete;
+		Line& operator=(const Line&) = delete;
+		std::ostream& stream();
+	};
+
+	// rate-limited progress ("<Info>: Sending file.bin: 1200 out of 4000 packets (30%)"), at most one line per interval
+	class Progress {
+	private:
+		const std::string label;
+		const uint64_t total;
+		const std::chrono::steady_clock::duration interval;
+		std::chrono::steady_clock::time_point last_line;
+	public:
+		Progress(const std::string& label, uint64_t total, std::chrono::milliseconds interval = std::chrono::milliseconds(500));
+		void update(uint64_t done); // the final update always prints
+	};
+}
@@ -0,0 +1,301 @@
+#include "metrics.h"
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <vector>
+#ifndef _WIN32
+#include <pthread.h>
+#include <signal.h>
+#endif
+
+namespace {
+
+	// one per thread, written only by its thread, so a relaxed load + store is enough (no locked read-modify-write)
+	struct ThreadCounters {
+		struct StageCounters {
+			std::atomic<uint64_t> count{ 0 };
+			std::atomic<uint64_t> bytes{ 0 };
+			std::atomic<uint64_t> busy_ns{ 0 };
+			std::atomic<uint64_t> max_ns{ 0 };
+			std::array<std::atomic<uint64_t>, Metrics::Histogram::BUCKET_COUNT> buckets{};
+		};
+		std::array<StageCounters, Metrics::STAGE_COUNT> stages;
+	};
+
+	void bump(std::atomic<uint64_t>& counter, uint64_t amount) {
+		counter.store(counter.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+	}
+
+	void add(Metrics::StageSnapshot& to, const ThreadCounters::StageCounters& from) {
+		to.count += from.count.load(std::memory_order_relaxed);
+		to.bytes += from.bytes.load(std::memory_order_relaxed);
+		to.busy_ns += from.busy_ns.load(std::memory_order_relaxed);
+		to.max_ns = std::max(to.max_ns, from.max_ns.load(std::memory_order_relaxed));
+		for (size_t i = 0; i < Metrics::Histogram::BUCKET_COUNT; ++i) {
+			to.buckets[i] += from.buckets[i].load(std::memory_order_relaxed);
+		}
+	}
+
+	// the counters of running threads; a thread that ends folds its own into retired, so short lived ones (the CRC
+	// future, a download connection) still show up in the totals without keeping a record per thread ever started
+	std::mutex registry_mutex;
+	std::vector<ThreadCounters*> registry;
+	std::array<Metrics::StageSnapshot, Metrics::STAGE_COUNT> retired{};
+
+	class LocalCounters {
+	private:
+		std::unique_ptr<ThreadCounters> counters = std::make_unique<ThreadCounters>();
+	public:
+		LocalCounters() {
+			std::lock_guard<std::mutex> lock(registry_mutex);
+			registry.push_back(counters.get());
+		}
+		~LocalCounters() {
+			std::lock_guard<std::mutex> lock(registry_mutex);
+			for (size_t stage = 0; stage < Metrics::STAGE_COUNT; ++stage) {
+				add(retired[stage], counters->stages[stage]);
+			}
+			registry.erase(std::find(registry.begin(), registry.end(), counters.get()));
+		}
+		LocalCounters(const LocalCounters&) = delete;
+		LocalCounters& operator=(const LocalCounters&) = delete;
+		ThreadCounters& get() { return *counters; }
+	};
+
+	ThreadCounters& local_counters() {
+		thread_local LocalCounters counters;
+		return counters.get();
+	}
+
+	std::mutex destination_mutex;
+	Metrics::Format destination_format = Metrics::Format::JSON;
+	std::string destination_path;
+
+	constexpr double QUANTILES[] = { 0.5, 0.9, 0.99, 0.999 };
+	const char* QUANTILE_NAMES[] = { "p50", "p90", "p99", "p999" };
+}
+
+const char* Metrics::stage_name(Stage stage)
+{
+	switch (stage) {
+	case Stage::SEND_FILE: return "send_file";
+	case Stage::OPERATION: return "operation";
+	case Stage::SEND_REQUEST: return "send_request";
+	case Stage::RECEIVE_RESPONSE: return "receive_response";
+	case Stage::FILE_LOAD: return "file_load";
+	case Stage::FILE_NEXT_CHUNK: return "file_next_chunk";
+	case Stage::ZERO_SCAN: return "zero_scan";
+	case Stage::CRC_CALCULATE: return "crc_calculate";
+	case Stage::CRC_WAIT: return "crc_wait";
+	case Stage::KEY_GENERATE: return "key_generate";
+	case Stage::KEY_WAIT: return "key_wait";
+	case Stage::CONNECT: return "connect";
+	case Stage::FIRST_BYTE: return "first_byte";
+	case Stage::DOWNLOAD: return "download";
+	case Stage::DOWNLOAD_RANGE: return "download_range";
+	default: return "unknown";
+	}
+}
+
+// =========== Histogram ===========
+
+size_t Metrics::Histogram::index_of(uint64_t value)
+{
+	if (value < SUB_BUCKET_COUNT) {
+		return static_cast<size_t>(value);
+	}
+	unsigned msb = 63;
+	while (!(value >> msb)) {
+		--msb;
+	}
+	if (msb >= MAX_BITS) {
+		return BUCKET_COUNT - 1;
+	}
+	unsigned shift = msb - SUB_BUCKET_BITS;
+	return static_cast<size_t>(SUB_BUCKET_COUNT * (shift + 1) + ((value >> shift) - SUB_BUCKET_COUNT));
+}
+
+uint64_t Metrics::Histogram::upper_bound(size_t index)
+{
+	if (index < SUB_BUCKET_COUNT) {
+		return index;
+	}
+	unsigned shift = static_cast<unsigned>(index / SUB_BUCKET_COUNT - 1);
+	uint64_t sub_bucket = index % SUB_BUCKET_COUNT;
+	return ((SUB_BUCKET_COUNT + sub_bucket + 1) << shift) - 1;
+}
+
+uint64_t Metrics::StageSnapshot::percentile(double quantile) const
+{
+	if (count == 0) {
+		return 0;
+	}
+	uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(std::ceil(quantile * count)));
+	uint64_t seen = 0;
+	for (size_t i = 0; i < buckets.size(); ++i) {
+		seen += buckets[i];
+		if (seen >= rank) {
+			return std::min(Histogram::upper_bound(i), max_ns);
+		}
+	}
+	return max_ns;
+}
+
+// =========== recording ===========
+
+void Metrics::record(Stage stage, uint64_t nanoseconds, uint64_t bytes)
+{
+	ThreadCounters::StageCounters& counters = local_counters().stages[static_cast<size_t>(stage)];
+	bump(counters.count, 1);
+	bump(counters.bytes, bytes);
+	bump(counters.busy_ns, nanoseconds);
+	bump(counters.buckets[Histogram::index_of(nanoseconds)], 1);
+	if (nanoseconds > counters.max_ns.load(std::memory_order_relaxed)) {
+		counters.max_ns.store(nanoseconds, std::memory_order_relaxed);
+	}
+}
+
+Metrics::ScopedTimer::ScopedTimer(Stage stage, uint64_t bytes) : stage(stage), bytes(bytes), start(std::chrono::steady_clock::now())
+{
+}
+
+Metrics::ScopedTimer::~ScopedTimer()
+{
+	auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+	record(stage, static_cast<uint64_t>(elapsed.count()), bytes);
+}
+
+void Metrics::ScopedTimer::add_bytes(uint64_t count)
+{
+	bytes += count;
+}
+
+std::array<Metrics::StageSnapshot, Metrics::STAGE_COUNT> Metrics::snapshot()
+{
+	std::lock_guard<std::mutex> lock(registry_mutex);
+	std::array<StageSnapshot, STAGE_COUNT> result = retired;
+	for (const ThreadCounters* counters : registry) {
+		for (size_t stage = 0; stage < STAGE_COUNT; ++stage) {
+			add(result[stage], counters->stages[stage]);
+		}
+	}
+	return result;
+}
+
+// =========== output ===========
+
+bool Metrics::parse_format(const std::string& name, Format& format)
+{
+	if (name == "json") {
+		format = Format::JSON;
+		return true;
+	}
+	if (name == "prometheus") {
+		format = Format::PROMETHEUS;
+		return true;
+	}
+	return false;
+}
+
+void Metrics::dump(std::ostream& out, Format format)
+{
+	std::array<StageSnapshot, STAGE_COUNT> stages = snapshot();
+	std::ios_base::fmtflags flags = out.flags();
+	out << std::setprecision(9);
+	if (format == Format::JSON) {
+		out << "{\"stages\":{";
+		for (size_t i = 0; i < STAGE_COUNT; ++i) {
+			const StageSnapshot& stage = stages[i];
+			out << (i ? "," : "") << "\"" << stage_name(static_cast<Stage>(i)) << "\":{"
+				<< "\"count\":" << stage.count
+				<< ",\"bytes\":" << stage.bytes
+				<< ",\"busy_seconds\":" << stage.busy_ns / 1e9
+				<< ",\"latency_ns\":{";
+			for (size_t q = 0; q < std::size(QUANTILES); ++q) {
+				out << "\"" << QUANTILE_NAMES[q] << "\":" << stage.percentile(QUANTILES[q]) << ",";
+			}
+			out << "\"max\":" << stage.max_ns << "}}";
+		}
+		out << "}}" << std::endl;
+	}
+	else {
+		out << "# TYPE gyf_stage_calls_total counter\n";
+		for (size_t i = 0; i < STAGE_COUNT; ++i) {
+			out << "gyf_stage_calls_total{stage=\"" << stage_name(static_cast<Stage>(i)) << "\"} " << stages[i].count << "\n";
+		}
+		out << "# TYPE gyf_stage_bytes_total counter\n";
+		for (size_t i = 0; i < STAGE_COUNT; ++i) {
+			out << "gyf_stage_bytes_total{stage=\"" << stage_name(static_cast<Stage>(i)) << "\"} " << stages[i].bytes << "\n";
+		}
+		out << "# TYPE gyf_stage_latency_seconds summary\n";
+		for (size_t i = 0; i < STAGE_COUNT; ++i) {
+			const char* name = stage_name(static_cast<Stage>(i));
+			for (double quantile : QUANTILES) {
+				out << "gyf_stage_latency_seconds{stage=\"" << name << "\",quantile=\"" << quantile << "\"} " << stages[i].percentile(quantile) / 1e9 << "\n";
+			}
+			out << "gyf_stage_latency_seconds_sum{stage=\"" << name << "\"} " << stages[i].busy_ns / 1e9 << "\n";
+			out << "gyf_stage_latency_seconds_count{stage=\"" << name << "\"} " << stages[i].count << "\n";
+		}
+		out << std::flush;
+	}
+	out.flags(flags);
+}
+
+void Metrics::configure(Format format, const std::string& path)
+{
+	std::lock_guard<std::mutex> lock(destination_mutex);
+	destination_format = format;
+	destination_path = path;
+}
+
+void Metrics::dump()
+{
+	std::lock_guard<std::mutex> lock(destination_mutex);
+	if (destination_path.empty()) {
+		dump(std::cerr, destination_format);
+		return;
+	}
+	std::ofstream file(destination_path, std::ios::trunc);
+	if (!file.is_open()) {
+		std::cerr << "<Error>: Could not open metrics file " << destination_path << std::endl;
+		return;
+	}
+	dump(file, destination_format);
+}
+
+// =========== SignalReporter ===========
+
+#ifndef _WIN32
+Metrics::SignalReporter::SignalReporter()
+{
+	sigset_t signals;
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGUSR1);
+	pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+	thread = std::thread([this, signals] {
+		int signal_number = 0;
+		while (sigwait(&signals, &signal_number) == 0 && !stopping) {
+			dump();
+		}
+	});
+}
+
+Metrics::SignalReporter::~SignalReporter()
+{
+	stopping = true;
+	pthread_kill(thread.native_handle(), SIGUSR1);
+	thread.join();
+}
+#else
+Metrics::SignalReporter::SignalReporter()
+{
+}
+
+Metrics::SignalReporter::~SignalReporter()
+{
+}
+#endif
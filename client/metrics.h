@@ -0,0 +1,95 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <thread>
+
+// Metrics keeps always-on, per-thread counters for the client's hot paths: calls, bytes, busy time and a log-linear
+// (HDR-style) latency histogram per stage. Recording touches only the calling thread's counters, readers merge them.
+namespace Metrics {
+
+	enum class Stage : uint8_t {
+		SEND_FILE,			// Client::perform_send_file, whole transfer including retries
+		OPERATION,			// Client::perform_operation, one request/response attempt
+		SEND_REQUEST,		// NetworkManager::send_request
+		RECEIVE_RESPONSE,	// NetworkManager::receive_*
+		FILE_LOAD,			// FileChunker reading and encrypting the file
+		FILE_NEXT_CHUNK,	// FileChunker::get_next
+		ZERO_SCAN,			// FileChunker finding the file's zero ranges
+		CRC_CALCULATE,		// CRCHandler over the file
+		CRC_WAIT,			// the send path blocked on the CRC future
+		KEY_GENERATE,		// KeyPool generating an RSA key pair
+		KEY_WAIT,			// the registration blocked on the key pair future
+		CONNECT,			// NetworkManager::establish, resolving and connecting
+		FIRST_BYTE,			// Client::start until the first send file request is written (time to first byte)
+		DOWNLOAD,			// Client::perform_download, the whole download
+		DOWNLOAD_RANGE,		// RangeDownloader, a range from its request to its bytes written
+		COUNT
+	};
+	constexpr size_t STAGE_COUNT = static_cast<size_t>(Stage::COUNT);
+	const char* stage_name(Stage stage);
+
+	// values below 2^SUB_BUCKET_BITS are exact, above that each power of two is split into 2^SUB_BUCKET_BITS buckets (~6% error)
+	class Histogram {
+	public:
+		constexpr static unsigned SUB_BUCKET_BITS = 4;
+		constexpr static uint64_t SUB_BUCKET_COUNT = 1ull << SUB_BUCKET_BITS;
+		constexpr static unsigned MAX_BITS = 48; // ~78 hours in nanoseconds, larger values land in the last bucket
+		constexpr static size_t BUCKET_COUNT = SUB_BUCKET_COUNT * (MAX_BITS - SUB_BUCKET_BITS + 1);
+
+		static size_t index_of(uint64_t value);
+		static uint64_t upper_bound(size_t index); // largest value that lands in the bucket
+	};
+
+	// aggregated over all threads at the time of the call
+	struct StageSnapshot {
+		uint64_t count = 0;
+		uint64_t bytes = 0;
+		uint64_t busy_ns = 0;
+		uint64_t max_ns = 0;
+		std::array<uint64_t, Histogram::BUCKET_COUNT> buckets{};
+
+		uint64_t percentile(double quantile) const; // in nanoseconds
+	};
+	std::array<StageSnapshot, STAGE_COUNT> snapshot();
+
+	void record(Stage stage, uint64_t nanoseconds, uint64_t bytes = 0);
+
+	// times its own scope into a stage
+	class ScopedTimer {
+	private:
+		const Stage stage;
+		uint64_t bytes;
+		const std::chrono::steady_clock::time_point start;
+	public:
+		explicit ScopedTimer(Stage stage, uint64_t bytes = 0);
+		~ScopedTimer();
+		ScopedTimer(const ScopedTimer&) = delete;
+		ScopedTimer& operator=(const ScopedTimer&) = delete;
+		void add_bytes(uint64_t count);
+	};
+
+	enum class Format { JSON, PROMETHEUS };
+	bool parse_format(const std::string& name, Format& format);
+
+	void dump(std::ostream& out, Format format);
+	void configure(Format format, const std::string& path); // where dump() goes, an empty path means stderr
+	void dump(); // to the configured destination (the file is rewritten each time)
+
+	// dumps on SIGUSR1 from a dedicated thread (POSIX only). Construct it first thing in main, before any other thread
+	// starts, so they all inherit the blocked signal and only this thread receives it.
+	class SignalReporter {
+	private:
+		std::thread thread;
+		std::atomic<bool> stopping{ false };
+	public:
+		SignalReporter();
+		~SignalReporter();
+		SignalReporter(const SignalReporter&) = delete;
+		SignalReporter& operator=(const SignalReporter&) = delete;
+	};
+}
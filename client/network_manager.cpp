@@ -2,69 +2,105 @@
 #include <fstream>
 #include <regex>
 #include <boost/asio.hpp>
-#include <iostream>
+#include "logger.h"
 #include "request.h"
 #include "response.h"
+#include "metrics.h"
 
-NetworkManager::NetworkManager(): resolver(io_context), socket(io_context)
+NetworkManager::NetworkManager()
 {
 }
-void NetworkManager::send_request(Request *request) {
-	std::vector<uint8_t> packet = request->create_packet();
-	std::cout << "<Debug>: Sending a request of size " << packet.size() << " bytes." << std::endl;
-	boost::asio::write(socket, boost::asio::buffer(packet, packet.size()));
+void NetworkManager::send_packet(const std::vector<uint8_t>& packet) {
+	GYF_LOG(Debug) << "Sending a request of size " << packet.size() << " bytes.";
+	Metrics::ScopedTimer timer(Metrics::Stage::SEND_REQUEST, packet.size());
+	transport->write(packet.data(), packet.size());
 }
 ResponseHeader NetworkManager::receive_response_header() {
-	std::vector<uint8_t> packet(ResponseHeader::SIZE);
-	boost::asio::read(socket, boost::asio::buffer(packet, ResponseHeader::SIZE));
-	return proto_handler.unpack_response_header(packet);
+	Metrics::ScopedTimer timer(Metrics::Stage::RECEIVE_RESPONSE, ResponseHeader::SIZE);
+	ResponseHeader header = proto_handler.unpack_response_header(reader->require(ResponseHeader::SIZE), ResponseHeader::SIZE);
+	reader->consume(ResponseHeader::SIZE);
+	server_version = header.version;
+	return header;
 }
-std::string NetworkManager::receive_register_payload(const ResponseHeader& header)
+std::string_view NetworkManager::receive_register_payload(const ResponseHeader&)
 {
-	std::vector<uint8_t> packet(ResponsePayload::SIZE_CLIENT_ID);
-	boost::asio::read(socket, boost::asio::buffer(packet, ResponsePayload::SIZE_CLIENT_ID));
-	std::string client_id(packet.begin(), packet.end());
+	Metrics::ScopedTimer timer(Metrics::Stage::RECEIVE_RESPONSE, ResponsePayload::ClientIdLayout::SIZE);
+	auto [client_id] = ResponsePayload::ClientIdLayout::read(reader->require(ResponsePayload::ClientIdLayout::SIZE));
+	reader->consume(ResponsePayload::ClientIdLayout::SIZE);
 	return client_id;
 }
 void NetworkManager::receive_reconnect_failure_payload(const ResponseHeader& header)
 {
-	std::vector<uint8_t> packet(ResponsePayload::SIZE_CLIENT_ID);
-	boost::asio::read(socket, boost::asio::buffer(packet, ResponsePayload::SIZE_CLIENT_ID));
+	skip_payload(header);
 }
-void NetworkManager::receive_confirm_message_payload() {
-	std::vector<uint8_t> packet(ResponsePayload::SIZE_CLIENT_ID);
-	boost::asio::read(socket, boost::asio::buffer(packet, ResponsePayload::SIZE_CLIENT_ID));
-	std::string client_id(packet.begin(), packet.end());
+void NetworkManager::receive_confirm_message_payload(const ResponseHeader& header) {
+	skip_payload(header);
 }
-std::string NetworkManager::receive_aes_key(uint32_t aes_key_size)
+void NetworkManager::skip_payload(const ResponseHeader& header) {
+	Metrics::ScopedTimer timer(Metrics::Stage::RECEIVE_RESPONSE, header.payload_size);
+	reader->take(header.payload_size);
+}
+std::string_view NetworkManager::receive_aes_key(uint32_t aes_key_size)
 {
-	std::vector<uint8_t> packet(aes_key_size);
-	boost::asio::read(socket, boost::asio::buffer(packet, aes_key_size));
-	std::string client_id = std::string(packet.begin(), packet.begin()+ResponsePayload::SIZE_CLIENT_ID);
-	std::string aes_key = std::string(packet.begin() + ResponsePayload::SIZE_CLIENT_ID, packet.end());
-	return aes_key;
+	if (aes_key_size < ResponsePayload::SIZE_CLIENT_ID) {
+		throw std::runtime_error("<Error>: Server sent an invalid AES key size.");
+	}
+	Metrics::ScopedTimer timer(Metrics::Stage::RECEIVE_RESPONSE, aes_key_size);
+	std::string_view payload = reader->take(aes_key_size);
+	return payload.substr(ResponsePayload::SIZE_CLIENT_ID); // after the client id
 }
 uint32_t NetworkManager::receive_send_file_payload() {
-
-	size_t packet_size = 
-		ResponsePayload::SIZE_CLIENT_ID + 
-		ResponsePayload::SIZE_CONTENT + 
-		ResponsePayload::SIZE_FILE_NAME + 
-		ResponsePayload::SIZE_CRC
-	;
-	std::vector<uint8_t> packet(packet_size);
-	boost::asio::read(socket, boost::asio::buffer(packet, packet_size));
-	std::string client_id(packet.begin(), packet.begin() + ResponsePayload::SIZE_CLIENT_ID);
-	std::string content(packet.begin() + ResponsePayload::SIZE_CLIENT_ID, packet.begin() + ResponsePayload::SIZE_CLIENT_ID + ResponsePayload::SIZE_CONTENT);
-	std::string file_name(packet.begin() + ResponsePayload::SIZE_CLIENT_ID + ResponsePayload::SIZE_CONTENT, packet.begin() + ResponsePayload::SIZE_CLIENT_ID + ResponsePayload::SIZE_CONTENT + ResponsePayload::SIZE_FILE_NAME);
-	uint32_t crc = *(uint32_t*)(packet.data() + ResponsePayload::SIZE_CLIENT_ID + ResponsePayload::SIZE_CONTENT + ResponsePayload::SIZE_FILE_NAME);
+	Metrics::ScopedTimer timer(Metrics::Stage::RECEIVE_RESPONSE, ResponsePayload::SendFileLayout::SIZE);
+	auto [client_id, content_size, file_name, crc] = ResponsePayload::SendFileLayout::read(reader->require(ResponsePayload::SendFileLayout::SIZE));
+	reader->consume(ResponsePayload::SendFileLayout::SIZE);
 	return crc;
 }
-void NetworkManager::establish(std::string host, std::string port)
+uint64_t NetworkManager::receive_send_file_digest_payload(uint8_t& algorithm) {
+	Metrics::ScopedTimer timer(Metrics::Stage::RECEIVE_RESPONSE, ResponsePayload::SendFileDigestLayout::SIZE);
+	auto [client_id, content_size, file_name, used_algorithm, checksum] = ResponsePayload::SendFileDigestLayout::read(reader->require(ResponsePayload::SendFileDigestLayout::SIZE));
+	reader->consume(ResponsePayload::SendFileDigestLayout::SIZE);
+	algorithm = used_algorithm;
+	return checksum;
+}
+uint8_t NetworkManager::receive_checksum_selected_payload() {
+	Metrics::ScopedTimer timer(Metrics::Stage::RECEIVE_RESPONSE, ResponsePayload::ChecksumSelectedLayout::SIZE);
+	auto [client_id, algorithm] = ResponsePayload::ChecksumSelectedLayout::read(reader->require(ResponsePayload::ChecksumSelectedLayout::SIZE));
+	reader->consume(ResponsePayload::ChecksumSelectedLayout::SIZE);
+	return algorithm;
+}
+StoredFileInfo NetworkManager::receive_file_info_payload() {
+	Metrics::ScopedTimer timer(Metrics::Stage::RECEIVE_RESPONSE, ResponsePayload::FileInfoLayout::SIZE);
+	auto [client_id, size, data_size, modified, algorithm] = ResponsePayload::FileInfoLayout::read(reader->require(ResponsePayload::FileInfoLayout::SIZE));
+	reader->consume(ResponsePayload::FileInfoLayout::SIZE);
+	return StoredFileInfo{ size, data_size, modified, algorithm };
+}
+RangePayload NetworkManager::receive_range_payload(const ResponseHeader& header) {
+	if (header.payload_size < ResponsePayload::RangeLayout::SIZE) {
+		throw std::runtime_error("<Error>: Server sent an invalid range response.");
+	}
+	Metrics::ScopedTimer timer(Metrics::Stage::RECEIVE_RESPONSE, header.payload_size);
+	const uint8_t* payload = reader->require(header.payload_size);
+	auto [client_id, offset, length, flags, checksum, iv] = ResponsePayload::RangeLayout::read(payload);
+	std::string_view ciphertext(reinterpret_cast<const char*>(payload) + ResponsePayload::RangeLayout::SIZE, header.payload_size - ResponsePayload::RangeLayout::SIZE);
+	reader->consume(header.payload_size);
+	return RangePayload{ offset, length, flags, checksum, iv, ciphertext };
+}
+void NetworkManager::close()
+{
+	if (transport) {
+		transport->shutdown();
+	}
+	reader.reset(); // before the transport it reads from
+	transport.reset();
+	server_version = 0;
+}
+void NetworkManager::establish(const Transport::Address& address)
 {
+	Metrics::ScopedTimer timer(Metrics::Stage::CONNECT);
 	try {
-		boost::asio::connect(socket, resolver.resolve(host, port));
-		std::cout << "<Info>: Successfully connected to the server (" << host << ":" << port << ")" << std::endl;
+		transport = Transport::connect(address);
+		reader.emplace(*transport);
+		GYF_LOG(Info) << "Successfully connected to the server (" << address.to_string() << ")";
 	}
 	catch (const boost::system::system_error& exception) {
 		throw std::runtime_error(std::string("<Error>: Could not establish connection: ") + exception.what());
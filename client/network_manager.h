@@ -1,28 +1,43 @@
 #pragma once
-#include <boost/asio.hpp>
+#include <memory>
+#include <optional>
 #include "request.h"
 #include "protocol_handler.h"
+#include "response_reader.h"
+#include "transport.h"
 
 // acts as the doorway to the server (encapsulates the connection)
 class NetworkManager {
 private:
 
 	// fields for connection
-	boost::asio::io_context io_context;
-	boost::asio::ip::tcp::socket socket;
-	boost::asio::ip::tcp::resolver resolver;
+	std::unique_ptr<Transport> transport; // TCP, Unix domain socket or shared memory, by the address
+	std::optional<ResponseReader<Transport>> reader; // one per connection, the views the receive functions return point into it
+	uint8_t server_version = 0; // from the last response header, 0 before the first one
 
 	// for creating requests, unpacking responses
 	ProtocolHandler& proto_handler = ProtocolHandler::get_instance();
 
 public:
 	NetworkManager();
-	void establish(std::string host, std::string port);
-	void send_request(Request* request);
+	void establish(const Transport::Address& address);
+	void close(); // establish can be called again afterwards
+	// any request type, see Request<Derived>::create_packet
+	template<typename RequestType>
+	void send_request(const RequestType& request) {
+		send_packet(request.create_packet());
+	}
+	void send_packet(const std::vector<uint8_t>& packet);
 	ResponseHeader receive_response_header();
-	std::string receive_register_payload(const ResponseHeader& header);
-	std::string receive_aes_key(uint32_t aes_key_size);
+	uint8_t get_server_version() const { return server_version; }
+	std::string_view receive_register_payload(const ResponseHeader& header); // the client id
+	std::string_view receive_aes_key(uint32_t aes_key_size); // the encrypted AES key
 	void receive_reconnect_failure_payload(const ResponseHeader& header);
-	uint32_t receive_send_file_payload();
-	void receive_confirm_message_payload();
+	uint32_t receive_send_file_payload(); // the CRC the server calculated
+	uint64_t receive_send_file_digest_payload(uint8_t& algorithm); // the checksum the server calculated, and its algorithm
+	uint8_t receive_checksum_selected_payload(); // the algorithm the server picked
+	void receive_confirm_message_payload(const ResponseHeader& header);
+	StoredFileInfo receive_file_info_payload();
+	RangePayload receive_range_payload(const ResponseHeader& header); // valid until the next receive
+	void skip_payload(const ResponseHeader& header); // for responses whose payload is not needed
 };
\ No newline at end of file
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+// PacketLayout describes a wire message as a list of fixed-size fields. Sizes and offsets are compile-time constants, so
+// packing or unpacking a message is straight-line code at constant offsets (no virtual calls, no intermediate buffers).
+namespace PacketLayout {
+
+	// unsigned integer, little-endian on the wire
+	template<typename T>
+	struct LittleEndian {
+		static_assert(std::is_unsigned_v<T>, "LittleEndian fields are unsigned");
+		using Type = T;
+		constexpr static size_t SIZE = sizeof(T);
+
+		static void write(uint8_t* out, T value) {
+			for (size_t i = 0; i < SIZE; ++i) {
+				out[i] = static_cast<uint8_t>(value >> (8 * i));
+			}
+		}
+		static T read(const uint8_t* in) {
+			T value = 0;
+			for (size_t i = 0; i < SIZE; ++i) {
+				value |= static_cast<T>(static_cast<T>(in[i]) << (8 * i));
+			}
+			return value;
+		}
+	};
+
+	// exactly N raw bytes (ids, keys), a shorter value is zero filled
+	template<size_t N>
+	struct FixedBytes {
+		using Type = std::string_view;
+		constexpr static size_t SIZE = N;
+
+		static void write(uint8_t* out, std::string_view value) {
+			size_t length = value.size() < N ? value.size() : N;
+			std::memcpy(out, value.data(), length);
+			std::memset(out + length, 0, N - length);
+		}
+		static std::string_view read(const uint8_t* in) {
+			return std::string_view(reinterpret_cast<const char*>(in), N);
+		}
+	};
+
+	// a string in an N byte field: cut to N - 1 bytes so it stays NUL terminated, then NUL padded
+	template<size_t N>
+	struct PaddedString {
+		using Type = std::string_view;
+		constexpr static size_t SIZE = N;
+
+		static void write(uint8_t* out, std::string_view value) {
+			size_t length = value.size() < N - 1 ? value.size() : N - 1;
+			std::memcpy(out, value.data(), length);
+			std::memset(out + length, 0, N - length);
+		}
+		static std::string_view read(const uint8_t* in) {
+			const void* terminator = std::memchr(in, '\0', N);
+			size_t length = terminator ? static_cast<size_t>(static_cast<const uint8_t*>(terminator) - in) : N;
+			return std::string_view(reinterpret_cast<const char*>(in), length);
+		}
+	};
+
+	template<typename... Fields>
+	struct Layout {
+		constexpr static size_t SIZE = (Fields::SIZE + ... + 0);
+		using Values = std::tuple<typename Fields::Type...>;
+
+		template<size_t I>
+		using Field = std::tuple_element_t<I, std::tuple<Fields...>>;
+
+		template<size_t I>
+		constexpr static size_t offset() {
+			constexpr size_t sizes[] = { Fields::SIZE..., 0 };
+			size_t result = 0;
+			for (size_t i = 0; i < I; ++i) {
+				result += sizes[i];
+			}
+			return result;
+		}
+
+		// out must have room for SIZE bytes
+		static void write(uint8_t* out, const typename Fields::Type&... values) {
+			write_fields(out, std::index_sequence_for<Fields...>{}, values...);
+		}
+		// in must hold SIZE bytes, string fields are views into it
+		static Values read(const uint8_t* in) {
+			return read_fields(in, std::index_sequence_for<Fields...>{});
+		}
+
+	private:
+		template<size_t... I, typename... Types>
+		static void write_fields(uint8_t* out, std::index_sequence<I...>, const Types&... values) {
+			(Field<I>::write(out + offset<I>(), values), ...);
+		}
+		template<size_t... I>
+		static Values read_fields(const uint8_t* in, std::index_sequence<I...>) {
+			return Values(Field<I>::read(in + offset<I>())...);
+		}
+	};
+}
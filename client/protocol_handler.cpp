@@ -1,5 +1,6 @@
 #include "protocol_handler.h"
 #include "client.hpp"
+#include <utility>
 
 ProtocolHandler& ProtocolHandler::get_instance()
 {
@@ -7,52 +8,50 @@ ProtocolHandler& ProtocolHandler::get_instance()
 	return instance;
 }
 
-Request* ProtocolHandler::create_registration_request(const std::string& name) const
+RegisterRequest ProtocolHandler::create_registration_request(const std::string& name) const
 {
 	RequestHeader header = RequestHeader(
 		std::string(RequestHeader::SIZE_CLIENT_ID, '0'), // server will neglect this anyway for registration
 		Client::CLIENT_VERSION,
 		RegisterRequest::CODE,
-		RegisterRequest::SIZE_CLIENT_NAME
+		RegisterRequest::Layout::SIZE
 	);
-	return new RegisterRequest(header, name);
+	return RegisterRequest(header, name);
 }
-Request* ProtocolHandler::create_reconnect_request(const std::string& id, const std::string& name) const
+ReconnectRequest ProtocolHandler::create_reconnect_request(const std::string& id, const std::string& name) const
 {
 	RequestHeader header = RequestHeader(
 		id,
 		Client::CLIENT_VERSION,
 		ReconnectRequest::CODE,
-		ReconnectRequest::SIZE_CLIENT_NAME
+		ReconnectRequest::Layout::SIZE
 	);
-	return new ReconnectRequest(header, name);
+	return ReconnectRequest(header, name);
 }
 
-Request* ProtocolHandler::create_send_file_request(
+SendFileRequest ProtocolHandler::create_send_file_request(
 	const std::string& id,
-	const uint32_t& encrypted_file_size,
-	const uint32_t& original_file_size,
-	const uint16_t& packet_number,
-	const uint16_t& total_packets,
+	const uint8_t& version,
+	const uint64_t& encrypted_file_size,
+	const uint64_t& original_file_size,
+	const uint64_t& offset,
+	const uint32_t& packet_number,
+	const uint32_t& total_packets,
 	const std::string& file_name,
-	const std::string& message_content
+	std::string_view message_content
 ) const
 {
 	RequestHeader header = RequestHeader(
 		id,
-		Client::CLIENT_VERSION,
+		version,
 		SendFileRequest::CODE,
-		SendFileRequest::SIZE_ENCRYPTED_FILE_SIZE +
-		SendFileRequest::SIZE_ORIGINAL_FILE_SIZE +
-		SendFileRequest::SIZE_PACKET_NUMBER +
-		SendFileRequest::SIZE_TOTAL_PACKETS +
-		SendFileRequest::SIZE_FILE_NAME +
-		message_content.size()
+		SendFileRequest::payload_size(message_content.size(), version)
 	);
-	return new SendFileRequest(
+	return SendFileRequest(
 		header,
 		encrypted_file_size,
 		original_file_size,
+		offset,
 		packet_number,
 		total_packets,
 		file_name,
@@ -60,38 +59,85 @@ Request* ProtocolHandler::create_send_file_request(
 	);
 }
 
-Request* ProtocolHandler::create_send_public_key_request(std::string id, std::string name, std::string public_key) const
+SendPublicKeyRequest ProtocolHandler::create_send_public_key_request(std::string id, std::string name, std::string public_key) const
 {
 	RequestHeader header = RequestHeader(
 		id,
 		Client::CLIENT_VERSION,
 		SendPublicKeyRequest::CODE,
-		SendPublicKeyRequest::SIZE_CLIENT_NAME + SendPublicKeyRequest::SIZE_PUBLIC_KEY // I was scared that this will integer overflow, but the compiler will promote to int
+		SendPublicKeyRequest::Layout::SIZE
+	);
+	return SendPublicKeyRequest(header, name, public_key);
+}
+NegotiateChecksumRequest ProtocolHandler::create_negotiate_checksum_request(const std::string& id, const std::string& file_name, const std::vector<Checksum::Algorithm>& preference) const
+{
+	RequestHeader header = RequestHeader(
+		id,
+		Client::CLIENT_VERSION,
+		NegotiateChecksumRequest::CODE,
+		NegotiateChecksumRequest::Layout::SIZE
+	);
+	std::string algorithms;
+	for (Checksum::Algorithm algorithm : preference) {
+		if (algorithms.size() < NegotiateChecksumRequest::MAX_ALGORITHMS) {
+			algorithms.push_back(static_cast<char>(algorithm));
+		}
+	}
+	return NegotiateChecksumRequest(header, file_name, algorithms);
+}
+SendZeroRangesRequest ProtocolHandler::create_send_zero_ranges_request(const std::string& id, const std::string& file_name, uint32_t first_index, std::vector<ZeroRange> ranges) const
+{
+	RequestHeader header = RequestHeader(
+		id,
+		Client::CLIENT_VERSION,
+		SendZeroRangesRequest::CODE,
+		SendZeroRangesRequest::payload_size(ranges.size())
+	);
+	return SendZeroRangesRequest(header, file_name, first_index, std::move(ranges));
+}
+FileInfoRequest ProtocolHandler::create_file_info_request(const std::string& id, const std::string& file_name, const std::vector<Checksum::Algorithm>& preference) const
+{
+	RequestHeader header = RequestHeader(
+		id,
+		Client::CLIENT_VERSION,
+		FileInfoRequest::CODE,
+		FileInfoRequest::Layout::SIZE
+	);
+	std::string algorithms;
+	for (Checksum::Algorithm algorithm : preference) {
+		if (algorithms.size() < FileInfoRequest::MAX_ALGORITHMS) {
+			algorithms.push_back(static_cast<char>(algorithm));
+		}
+	}
+	return FileInfoRequest(header, file_name, algorithms);
+}
+ReadRangeRequest ProtocolHandler::create_read_range_request(const std::string& id, const std::string& file_name, uint64_t offset, uint32_t length, Checksum::Algorithm algorithm) const
+{
+	RequestHeader header = RequestHeader(
+		id,
+		Client::CLIENT_VERSION,
+		ReadRangeRequest::CODE,
+		ReadRangeRequest::Layout::SIZE
 	);
-	return new SendPublicKeyRequest(header, name, public_key);
+	return ReadRangeRequest(header, file_name, offset, length, static_cast<uint8_t>(algorithm));
 }
-Request* ProtocolHandler::create_crc_state_request(const std::string& id, const std::string& file_name, const uint8_t& state) const
+SendCRCStateRequest ProtocolHandler::create_crc_state_request(const std::string& id, const std::string& file_name, const uint8_t& state) const
 {
 	RequestHeader header = RequestHeader(
 		id,
 		Client::CLIENT_VERSION,
 		static_cast<uint16_t>(SendCRCStateRequest::CODE_CORRECT+state),
-		SendCRCStateRequest::SIZE_FILE_NAME
+		SendCRCStateRequest::Layout::SIZE
 	);
-	return new SendCRCStateRequest(header, file_name);
+	return SendCRCStateRequest(header, file_name);
 }
 
-ResponseHeader ProtocolHandler::unpack_response_header(const std::vector<uint8_t>& raw_data) const
+ResponseHeader ProtocolHandler::unpack_response_header(const uint8_t* raw_data, size_t size) const
 {
-	constexpr size_t min_expected_size = ResponseHeader::SIZE_VERSION + ResponseHeader::SIZE_CODE + ResponseHeader::SIZE_PAYLOAD_SIZE;
-	if (raw_data.size() < min_expected_size) {
+	if (size < ResponseHeader::SIZE) {
 		throw std::runtime_error("<Error>: Packet is too small to unpack ResponseHeader");
 	}
-	uint8_t version = raw_data[0];
-	uint16_t code; uint32_t payload_size;
-	memcpy(&code, &raw_data[ResponseHeader::SIZE_VERSION], sizeof(code));
-	memcpy(&payload_size, &raw_data[ResponseHeader::SIZE_VERSION + ResponseHeader::SIZE_CODE], sizeof(payload_size));
-	return ResponseHeader(version, code, payload_size);
+	return ResponseHeader::unpack(raw_data);
 }
 std::string ProtocolHandler::get_response_code_description(uint16_t code) const
 {
@@ -2,6 +2,8 @@
 
 #include "request.h"
 #include "response.h"
+#include "checksum.h"
+#include <vector>
 #include <mutex>
 #include <map>
 
@@ -18,6 +20,10 @@ private:
 		{ResponseCode::RECONNECT_REJECTED, "Reconnection failed"},
 		{ResponseCode::MESSAGE_CONFIRM, "Message confirmed"},
 		{ResponseCode::GENERAL_FAILURE, "General failure"},
+		{ResponseCode::CHECKSUM_SELECTED, "Checksum selected"},
+		{ResponseCode::SEND_FILE_DIGEST, "File sending success"},
+		{ResponseCode::FILE_INFO, "File info"},
+		{ResponseCode::RANGE, "File range"},
 	};
 public:
 	// number of attempts in total to send a request
@@ -27,20 +33,28 @@ public:
 	ProtocolHandler& operator=(const ProtocolHandler&) = delete;
 	static ProtocolHandler& get_instance();
 
-	Request* create_registration_request(const std::string& name) const;
-	Request* create_send_public_key_request(std::string id, std::string name, std::string public_key) const;
-	Request* create_reconnect_request(const std::string& id, const std::string& name) const;
-	Request* create_send_file_request(
+	RegisterRequest create_registration_request(const std::string& name) const;
+	SendPublicKeyRequest create_send_public_key_request(std::string id, std::string name, std::string public_key) const;
+	ReconnectRequest create_reconnect_request(const std::string& id, const std::string& name) const;
+	// version picks the layout, see SendFileRequest::LARGE_FILES_VERSION
+	SendFileRequest create_send_file_request(
 		const std::string& id,
-		const uint32_t& encrypted_file_size,
-		const uint32_t& original_file_size,
-		const uint16_t& packet_number,
-		const uint16_t& total_packets,
+		const uint8_t& version,
+		const uint64_t& encrypted_file_size,
+		const uint64_t& original_file_size,
+		const uint64_t& offset,
+		const uint32_t& packet_number,
+		const uint32_t& total_packets,
 		const std::string& file_name,
-		const std::string& message_content
+		std::string_view message_content
 	) const;
-	Request* create_crc_state_request(const std::string& id, const std::string& file_name, const uint8_t& state) const;
-	ResponseHeader unpack_response_header(const std::vector<uint8_t>& raw_data) const;
+	NegotiateChecksumRequest create_negotiate_checksum_request(const std::string& id, const std::string& file_name, const std::vector<Checksum::Algorithm>& preference) const;
+	// at most SendZeroRangesRequest::MAX_RANGES ranges
+	SendZeroRangesRequest create_send_zero_ranges_request(const std::string& id, const std::string& file_name, uint32_t first_index, std::vector<ZeroRange> ranges) const;
+	FileInfoRequest create_file_info_request(const std::string& id, const std::string& file_name, const std::vector<Checksum::Algorithm>& preference) const;
+	ReadRangeRequest create_read_range_request(const std::string& id, const std::string& file_name, uint64_t offset, uint32_t length, Checksum::Algorithm algorithm) const;
+	SendCRCStateRequest create_crc_state_request(const std::string& id, const std::string& file_name, const uint8_t& state) const;
+	ResponseHeader unpack_response_header(const uint8_t* raw_data, size_t size) const;
 	std::string get_response_code_description(uint16_t code) const;
 
 };
\ No newline at end of file
@@ -0,0 +1,244 @@
+#include "range_downloader.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <deque>
+#include <exception>
+#include <filesystem>
+#include <future>
+#include <stdexcept>
+#include <cryptlib.h>
+#include "metrics.h"
+#include "protocol_handler.h"
+#ifdef __linux__
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace {
+	constexpr const char* RESUME_MAGIC = "gyf-download";
+}
+
+RangeDownloader::RangeDownloader(const std::string& id, const std::string& aes_key, const std::string& file_name, const std::string& output, const StoredFileInfo& info) :
+	id(id), aes_key(aes_key), file_name(file_name), output(output), resume_path(output + RESUME_SUFFIX), info(info),
+	algorithm(static_cast<Checksum::Algorithm>(info.algorithm))
+{
+}
+
+size_t RangeDownloader::prepare()
+{
+	range_count = static_cast<size_t>((info.size + RANGE_SIZE - 1) / RANGE_SIZE);
+	std::vector<bool> done(range_count);
+	resumed = load_resume(done);
+	if (!resumed) {
+		{
+			std::ofstream create(output, std::ios::binary | std::ios::trunc);
+			if (!create.is_open()) {
+				throw std::runtime_error("<Error>: Could not create " + output);
+			}
+		}
+		std::filesystem::resize_file(output, info.size);
+		if (info.data_size == info.size) {
+			preallocate();
+		}
+		std::ofstream header(resume_path, std::ios::trunc);
+		header << RESUME_MAGIC << ' ' << info.size << ' ' << info.modified << ' ' << RANGE_SIZE << ' ' << file_name << '\n';
+		if (!header) {
+			throw std::runtime_error("<Error>: Could not create " + resume_path);
+		}
+	}
+	for (size_t index = 0; index < range_count; ++index) {
+		if (!done[index]) {
+			missing.push_back(index);
+		}
+	}
+	resume_file.open(resume_path, std::ios::app);
+	return missing.size();
+}
+
+bool RangeDownloader::load_resume(std::vector<bool>& done) const
+{
+	std::ifstream in(resume_path);
+	std::error_code error;
+	if (!in.is_open() || std::filesystem::file_size(output, error) != info.size || error) {
+		return false;
+	}
+	std::string magic, name;
+	uint64_t size, modified, range_size;
+	if (!(in >> magic >> size >> modified >> range_size) || magic != RESUME_MAGIC || size != info.size ||
+		modified != info.modified || range_size != RANGE_SIZE) {
+		return false;
+	}
+	in.get(); // the space before the name, which may hold spaces itself
+	if (!std::getline(in, name) || name != file_name) {
+		return false;
+	}
+	std::string line;
+	while (std::getline(in, line) && !in.eof()) { // a last line without its newline was cut off
+		uint64_t index = std::strtoull(line.c_str(), nullptr, 10);
+		if (index < done.size()) {
+			done[index] = true;
+		}
+	}
+	return true;
+}
+
+void RangeDownloader::preallocate() const
+{
+#ifdef __linux__
+	// the blocks are reserved at once, instead of one range at a time and in whatever order the ranges land
+	int fd = ::open(output.c_str(), O_WRONLY);
+	if (fd >= 0) {
+		if (info.size > 0 && posix_fallocate(fd, 0, static_cast<off_t>(info.size)) != 0) {
+			GYF_LOG(Debug) << "Could not preallocate " << output << ", writing it as it comes.";
+		}
+		::close(fd);
+	}
+#endif
+}
+
+bool RangeDownloader::take(uint64_t& index)
+{
+	if (failed) {
+		return false;
+	}
+	size_t position = next++;
+	if (position >= missing.size()) {
+		return false;
+	}
+	index = missing[position];
+	return true;
+}
+
+void RangeDownloader::run(const std::vector<NetworkManager*>& connections)
+{
+	progress.emplace("Ranges received", missing.size());
+	std::vector<std::future<void>> workers;
+	for (NetworkManager* connection : connections) {
+		workers.push_back(std::async(std::launch::async, [this, connection]() {
+			try {
+				download(*connection);
+			}
+			catch (...) {
+				failed = true;
+				throw;
+			}
+		}));
+	}
+	std::exception_ptr error;
+	for (std::future<void>& worker : workers) {
+		try {
+			worker.get();
+		}
+		catch (...) {
+			if (!error) {
+				error = std::current_exception();
+			}
+		}
+	}
+	resume_file.close();
+	if (error) {
+		GYF_LOG(Info) << completed << " ranges were written, run the download again to resume it.";
+		std::rethrow_exception(error);
+	}
+	std::filesystem::remove(resume_path);
+}
+
+void RangeDownloader::download(NetworkManager& connection)
+{
+	const ProtocolHandler& proto_handler = ProtocolHandler::get_instance();
+	std::fstream out(output, std::ios::in | std::ios::out | std::ios::binary); // one per thread, each writes its own ranges
+	if (!out.is_open()) {
+		throw std::runtime_error("<Error>: Could not open " + output);
+	}
+	AESWrapper aes(aes_key.data(), static_cast<unsigned int>(aes_key.size()));
+	struct InFlight {
+		uint64_t index;
+		int attempt;
+		std::chrono::steady_clock::time_point sent;
+	};
+	std::deque<InFlight> in_flight; // the server answers a connection's requests in order
+	auto request = [&](uint64_t index, int attempt) {
+		uint64_t offset = index * RANGE_SIZE;
+		uint32_t length = static_cast<uint32_t>(std::min<uint64_t>(RANGE_SIZE, info.size - offset));
+		connection.send_request(proto_handler.create_read_range_request(id, file_name, offset, length, algorithm));
+		in_flight.push_back({ index, attempt, std::chrono::steady_clock::now() });
+	};
+	uint64_t index;
+	while (in_flight.size() < WINDOW && take(index)) {
+		request(index, 1);
+	}
+	while (!in_flight.empty()) {
+		InFlight expected = in_flight.front();
+		in_flight.pop_front();
+		ResponseHeader header = connection.receive_response_header();
+		if (header.code != ResponseCode::RANGE) {
+			throw std::runtime_error("<Error>: Server responded to a range request with " + proto_handler.get_response_code_description(header.code));
+		}
+		RangePayload range = connection.receive_range_payload(header);
+		if (range.offset != expected.index * RANGE_SIZE) {
+			throw std::runtime_error("<Error>: Server sent the range at " + std::to_string(range.offset) + " instead of " + std::to_string(expected.index * RANGE_SIZE));
+		}
+		if (write_range(out, range, aes)) {
+			auto elapsed = std::chrono::steady_clock::now() - expected.sent;
+			Metrics::record(Metrics::Stage::DOWNLOAD_RANGE, static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()), range.length);
+			complete(expected.index);
+		}
+		else if (expected.attempt < ProtocolHandler::NUMBER_OF_ATTEMPTS) {
+			GYF_LOG(Warning) << "The range at " << range.offset << " failed its checksum, asking for it again..";
+			request(expected.index, expected.attempt + 1);
+			continue;
+		}
+		else {
+			throw std::runtime_error("<Error>: The range at " + std::to_string(range.offset) + " failed its checksum " +
+				std::to_string(ProtocolHandler::NUMBER_OF_ATTEMPTS) + " times.");
+		}
+		if (take(index)) {
+			request(index, 1);
+		}
+	}
+}
+
+bool RangeDownloader::write_range(std::fstream& out, const RangePayload& range, AESWrapper& aes) const
+{
+	static const std::string zeros(RANGE_SIZE, '\0');
+	if (range.length != std::min<uint64_t>(RANGE_SIZE, info.size - range.offset)) {
+		throw std::runtime_error("<Error>: Server sent a range of " + std::to_string(range.length) + " bytes at " + std::to_string(range.offset));
+	}
+	std::string plain;
+	std::string_view data;
+	if (range.flags & ResponsePayload::RANGE_ZEROS) {
+		data = std::string_view(zeros.data(), range.length);
+	}
+	else {
+		try {
+			plain = aes.decrypt(range.ciphertext.data(), static_cast<unsigned int>(range.ciphertext.size()), reinterpret_cast<const unsigned char*>(range.iv.data()));
+		}
+		catch (const CryptoPP::Exception&) { // the padding, a damaged range
+			return false;
+		}
+		data = plain;
+	}
+	Checksum::Digest digest(algorithm);
+	digest.update(reinterpret_cast<const unsigned char*>(data.data()), data.size());
+	if (data.size() != range.length || digest.finish(data.size()) != range.checksum) {
+		return false;
+	}
+	if (!(range.flags & ResponsePayload::RANGE_ZEROS) || resumed) { // a new output reads zeros there already, and keeps the hole
+		out.seekp(static_cast<std::streamoff>(range.offset));
+		out.write(data.data(), static_cast<std::streamsize>(data.size()));
+		out.flush(); // before complete() records the range
+		if (!out) {
+			throw std::runtime_error("<Error>: Could not write to " + output);
+		}
+	}
+	return true;
+}
+
+void RangeDownloader::complete(uint64_t index)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	resume_file << index << '\n';
+	resume_file.flush();
+	progress->update(++completed);
+}
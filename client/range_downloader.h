@@ -0,0 +1,61 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+#include "aes_wrapper.h"
+#include "checksum.h"
+#include "logger.h"
+#include "network_manager.h"
+#include "response.h"
+
+// RangeDownloader fetches a stored file from the server (protocol 6) in ranges of RANGE_SIZE, spread over one or more
+// connections, with WINDOW range requests in flight on each so the server reads the next range while one is on the wire.
+// A range arrives encrypted with the session's AES key together with the checksum of its plaintext, and is checked
+// before it is written at its offset of the output file. The file is sized up front, and preallocated unless the stored
+// file has zero ranges, which the server flags instead of sending and which stay holes.
+// Every range written is appended to <output>.resume, a download that stopped (the client or the connection) picks up
+// the ranges missing there, unless the stored file changed meanwhile (its size and modification time).
+class RangeDownloader {
+public:
+	static constexpr uint32_t RANGE_SIZE = 1 << 20; // at most ReadRangeRequest::MAX_LENGTH
+	static constexpr size_t WINDOW = 4; // range requests in flight per connection
+	static constexpr const char* RESUME_SUFFIX = ".resume";
+
+	RangeDownloader(const std::string& id, const std::string& aes_key, const std::string& file_name, const std::string& output, const StoredFileInfo& info);
+	size_t prepare(); // creates the output, or picks up an earlier download of it; the number of ranges still missing
+	size_t get_range_count() const { return range_count; }
+	// one thread per connection, each an open session of this client (the same id, and so the same AES key), throws the
+	// first error of any of them once all stopped; the output is complete when it returns
+	void run(const std::vector<NetworkManager*>& connections);
+
+private:
+	const std::string id;
+	const std::string aes_key;
+	const std::string file_name;
+	const std::string output;
+	const std::string resume_path;
+	const StoredFileInfo info;
+	const Checksum::Algorithm algorithm;
+	size_t range_count = 0;
+	bool resumed = false; // the output holds an earlier download, ranges of zeros have to be written
+	std::vector<uint64_t> missing; // range indexes, the connections take them in order
+	std::atomic<size_t> next{ 0 };
+	std::atomic<bool> failed{ false }; // a connection gave up, the others only finish what they asked for
+
+	std::mutex mutex; // the resume file and the progress line
+	std::ofstream resume_file;
+	std::optional<Log::Progress> progress;
+	size_t completed = 0;
+
+	bool load_resume(std::vector<bool>& done) const;
+	void preallocate() const;
+	bool take(uint64_t& index);
+	void download(NetworkManager& connection);
+	bool write_range(std::fstream& out, const RangePayload& range, AESWrapper& aes) const; // false when the range is damaged
+	void complete(uint64_t index);
+};
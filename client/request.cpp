@@ -1,7 +1,6 @@
 #include "request.h"
-#include <iostream>
-#include <stdexcept>
-#include "packet_utils.h"
+#include <cstring>
+#include <utility>
 
 // =========== RequestHeader ===========
 
@@ -10,95 +9,55 @@ RequestHeader::RequestHeader(std::string client_id, uint8_t version, uint16_t co
 {
 }
 
-const RequestHeader& Request::get_header() const
-{
-	return header;
-}
 std::vector<uint8_t> RequestHeader::pack() const {
-	std::vector<uint8_t> packet;
-	try {
-		packet.insert(packet.end(), client_id.begin(), client_id.end());
-		packet.push_back(version);
-		PacketUtils::insert_to_packet(packet, &code, sizeof(code));
-		PacketUtils::insert_to_packet(packet, &payload_size, sizeof(payload_size));
-	}
-	catch (std::exception& e) {
-		throw std::runtime_error("<Error>: Failed to pack the request header: " + std::string(e.what()));
-	}
+	std::vector<uint8_t> packet(SIZE);
+	pack_into(packet.data());
 	return packet;
 }
-
-// =========== Request ===========
-
-Request::Request(const RequestHeader& header) : header(header)
-{
+void RequestHeader::pack_into(uint8_t* out) const {
+	Layout::write(out, client_id, version, code, payload_size);
 }
 
-std::vector<uint8_t>& Request::get_cached_packet() const
-{
-	return cached_packet;
-}
+// =========== Requests ===========
 
 RegisterRequest::RegisterRequest(const RequestHeader& header, const std::string& name) : Request(header), name(name)
 {
 }
-const std::vector<uint8_t>& RegisterRequest::create_packet() const {
-	std::vector<uint8_t>& cached_packet = get_cached_packet();
-	if (cached_packet.empty()) {
-		cached_packet = get_header().pack();
-		std::string client_name = name; // I decided to not change the original client name (in-case data loss for packet creation)
-		PacketUtils::terminate_payload_string(client_name, SIZE_CLIENT_NAME);
-		cached_packet.insert(cached_packet.end(), client_name.begin(), client_name.end());
-	}
-	return cached_packet;
+void RegisterRequest::write_payload(uint8_t* out) const {
+	Layout::write(out, name); // a longer name loses its tail, the client truncates it up front anyway
 }
 
 SendPublicKeyRequest::SendPublicKeyRequest(const RequestHeader& header, const std::string& name, const std::string& public_key) :
 	Request(header), name(name), public_key(public_key)
 {
 }
-
-const std::vector<uint8_t>& SendPublicKeyRequest::create_packet() const
+void SendPublicKeyRequest::write_payload(uint8_t* out) const
 {
-	std::vector<uint8_t>& cached_packet = get_cached_packet();
-	if (cached_packet.empty()) {
-		cached_packet = get_header().pack();
-		std::string client_name = name; // I decided to not change the original client name (in-case data loss for packet creation)
-		PacketUtils::terminate_payload_string(client_name, SIZE_CLIENT_NAME); // will take care in-case name is longer :-)
-		cached_packet.insert(cached_packet.end(), client_name.begin(), client_name.end());
-		cached_packet.insert(cached_packet.end(), public_key.begin(), public_key.end()); // guaranteed to be 160 bytes
-	}
-	return cached_packet;
+	Layout::write(out, name, public_key); // public key is guaranteed to be 160 bytes
 }
 
 ReconnectRequest::ReconnectRequest(const RequestHeader& header, const std::string& name) : Request(header), name(name)
 {
 }
-
-const std::vector<uint8_t>& ReconnectRequest::create_packet() const
+void ReconnectRequest::write_payload(uint8_t* out) const
 {
-	std::vector<uint8_t>& cached_packet = get_cached_packet();
-	if (cached_packet.empty()) {
-		cached_packet = get_header().pack();
-		std::string client_name = name; // I decided to not change the original client name (in-case data loss for packet creation)
-		PacketUtils::terminate_payload_string(client_name, SIZE_CLIENT_NAME); // will take care in-case name is longer :-)
-		cached_packet.insert(cached_packet.end(), client_name.begin(), client_name.end());
-	}
-	return cached_packet;
+	Layout::write(out, name);
 }
 
 SendFileRequest::SendFileRequest(
 	const RequestHeader& header,
-	const uint32_t& encrypted_file_size,
-	const uint32_t& original_file_size,
-	const uint16_t& packet_number,
-	const uint16_t& total_packets,
+	const uint64_t& encrypted_file_size,
+	const uint64_t& original_file_size,
+	const uint64_t& offset,
+	const uint32_t& packet_number,
+	const uint32_t& total_packets,
 	const std::string& file_name,
-	const std::string& message_content
+	std::string_view message_content
 ) :
 	Request(header),
 	encrypted_file_size(encrypted_file_size),
 	original_file_size(original_file_size),
+	offset(offset),
 	packet_number(packet_number),
 	total_packets(total_packets),
 	file_name(file_name),
@@ -107,34 +66,86 @@ SendFileRequest::SendFileRequest(
 
 }
 
-const std::vector<uint8_t>& SendFileRequest::create_packet() const
+void SendFileRequest::reset(
+	const std::string& id,
+	const uint8_t& version,
+	const uint64_t& encrypted_file_size,
+	const uint64_t& original_file_size,
+	const uint64_t& offset,
+	const uint32_t& packet_number,
+	const uint32_t& total_packets,
+	const std::string& file_name,
+	std::string_view message_content
+)
 {
-	std::vector<uint8_t>& cached_packet = get_cached_packet();
-	if (cached_packet.empty()) {
-		cached_packet = get_header().pack();
-		PacketUtils::insert_to_packet(cached_packet, &encrypted_file_size, sizeof(encrypted_file_size));
-		PacketUtils::insert_to_packet(cached_packet, &original_file_size, sizeof(original_file_size));
-		PacketUtils::insert_to_packet(cached_packet, &packet_number, sizeof(packet_number));
-		PacketUtils::insert_to_packet(cached_packet, &total_packets, sizeof(total_packets));
-		std::string file_name_str = file_name;
-		PacketUtils::terminate_payload_string(file_name_str, SIZE_FILE_NAME);
-		cached_packet.insert(cached_packet.end(), file_name_str.begin(), file_name_str.end());
-		cached_packet.insert(cached_packet.end(), message_content.begin(), message_content.end());
+	RequestHeader& header = get_mutable_header();
+	header.client_id.assign(id); // assign rather than copy-construct, so the existing buffers are reused
+	header.version = version;
+	header.payload_size = payload_size(message_content.size(), version);
+	this->encrypted_file_size = encrypted_file_size;
+	this->original_file_size = original_file_size;
+	this->offset = offset;
+	this->packet_number = packet_number;
+	this->total_packets = total_packets;
+	this->file_name.assign(file_name);
+	this->message_content.assign(message_content);
+	clear_cached_packet();
+}
+void SendFileRequest::write_payload(uint8_t* out) const
+{
+	size_t fields_size;
+	if (get_header().version >= LARGE_FILES_VERSION) {
+		Layout::write(out, encrypted_file_size, original_file_size, offset, packet_number, total_packets, file_name);
+		fields_size = Layout::SIZE;
 	}
-	return cached_packet;
+	else { // the caller checked fits_legacy
+		LegacyLayout::write(out, static_cast<uint32_t>(encrypted_file_size), static_cast<uint32_t>(original_file_size),
+			static_cast<uint16_t>(packet_number), static_cast<uint16_t>(total_packets), file_name);
+		fields_size = LegacyLayout::SIZE;
+	}
+	std::memcpy(out + fields_size, message_content.data(), message_content.size());
 }
 
-SendCRCStateRequest::SendCRCStateRequest(const RequestHeader& header, const std::string& file_name) : Request(header), file_name(file_name) {
-
+NegotiateChecksumRequest::NegotiateChecksumRequest(const RequestHeader& header, const std::string& file_name, const std::string& algorithms) :
+	Request(header), file_name(file_name), algorithms(algorithms)
+{
+}
+void NegotiateChecksumRequest::write_payload(uint8_t* out) const {
+	Layout::write(out, file_name, algorithms);
 }
 
-const std::vector<uint8_t>& SendCRCStateRequest::create_packet() const {
-	std::vector<uint8_t>& cached_packet = get_cached_packet();
-	if (cached_packet.empty()) {
-		cached_packet = get_header().pack();
-		std::string file_name_str = file_name;
-		PacketUtils::terminate_payload_string(file_name_str, SIZE_FILE_NAME);
-		cached_packet.insert(cached_packet.end(), file_name_str.begin(), file_name_str.end());
+SendZeroRangesRequest::SendZeroRangesRequest(const RequestHeader& header, const std::string& file_name, uint32_t first_index, std::vector<ZeroRange> ranges) :
+	Request(header), file_name(file_name), first_index(first_index), ranges(std::move(ranges))
+{
+}
+void SendZeroRangesRequest::write_payload(uint8_t* out) const {
+	Layout::write(out, file_name, first_index, static_cast<uint32_t>(ranges.size()));
+	out += Layout::SIZE;
+	for (const ZeroRange& range : ranges) {
+		RangeLayout::write(out, range.offset, range.length);
+		out += RangeLayout::SIZE;
 	}
-	return cached_packet;
+}
+
+FileInfoRequest::FileInfoRequest(const RequestHeader& header, const std::string& file_name, const std::string& algorithms) :
+	Request(header), file_name(file_name), algorithms(algorithms)
+{
+}
+void FileInfoRequest::write_payload(uint8_t* out) const {
+	Layout::write(out, file_name, algorithms);
+}
+
+ReadRangeRequest::ReadRangeRequest(const RequestHeader& header, const std::string& file_name, uint64_t offset, uint32_t length, uint8_t algorithm) :
+	Request(header), file_name(file_name), offset(offset), length(length), algorithm(algorithm)
+{
+}
+void ReadRangeRequest::write_payload(uint8_t* out) const {
+	Layout::write(out, file_name, offset, length, algorithm);
+}
+
+SendCRCStateRequest::SendCRCStateRequest(const RequestHeader& header, const std::string& file_name) : Request(header), file_name(file_name) {
+
+}
+void SendCRCStateRequest::write_payload(uint8_t* out) const {
+	Layout::write(out, file_name);
 }
@@ -4,6 +4,8 @@
 #include <array>
 #include <vector>
 #include <string>
+#include <string_view>
+#include "packet_layout.h"
 
 //encapsulates a request header in a request packet
 struct RequestHeader {
@@ -14,6 +16,14 @@ struct RequestHeader {
 	constexpr static uint8_t SIZE_CODE = 2;
 	constexpr static uint8_t SIZE_PAYLOAD_SIZE = 4;
 
+	using Layout = PacketLayout::Layout<
+		PacketLayout::FixedBytes<SIZE_CLIENT_ID>,
+		PacketLayout::LittleEndian<uint8_t>,
+		PacketLayout::LittleEndian<uint16_t>,
+		PacketLayout::LittleEndian<uint32_t>
+	>;
+	constexpr static size_t SIZE = Layout::SIZE;
+
 	std::string client_id;
 	uint8_t version;
 	uint16_t code;
@@ -22,32 +32,45 @@ struct RequestHeader {
 	RequestHeader(std::string client_id, uint8_t version, uint16_t code, uint32_t payload_size);
 
 	std::vector<uint8_t> pack() const;
+	void pack_into(uint8_t* out) const; // writes SIZE bytes
 };
 
+// Request is the (non-virtual) base of every request. The concrete request passes itself as Derived and provides
+// `Layout` (its fixed payload fields) and `write_payload(uint8_t*)`; the packet is built once, in a single buffer.
+template<typename Derived>
 class Request {
 private:
-	const RequestHeader header;
+	RequestHeader header;
 	mutable std::vector<uint8_t> cached_packet;
 protected:
-	Request(const RequestHeader& header);
-	std::vector<uint8_t>& get_cached_packet() const;
+	Request(const RequestHeader& header) : header(header) {}
+	RequestHeader& get_mutable_header() { return header; } // for requests that are reused, see clear_cached_packet
+	void clear_cached_packet() { cached_packet.clear(); } // keeps the capacity
 public:
-	virtual ~Request() = default;
-	const RequestHeader& get_header() const;
-	virtual const std::vector<uint8_t>& create_packet() const = 0;
+	const RequestHeader& get_header() const { return header; }
+	const std::vector<uint8_t>& create_packet() const {
+		if (cached_packet.empty()) {
+			cached_packet.resize(RequestHeader::SIZE + header.payload_size);
+			header.pack_into(cached_packet.data());
+			static_cast<const Derived&>(*this).write_payload(cached_packet.data() + RequestHeader::SIZE);
+		}
+		return cached_packet;
+	}
 };
 
-class RegisterRequest : public Request {
+class RegisterRequest : public Request<RegisterRequest> {
 private:
 	std::string name;
 public:
 	constexpr static uint8_t SIZE_CLIENT_NAME = 255; // including '\0'
 	constexpr static uint16_t CODE = 825;
+	using Layout = PacketLayout::Layout<PacketLayout::PaddedString<SIZE_CLIENT_NAME>>;
+
 	RegisterRequest(const RequestHeader& header, const std::string& name);
-	const std::vector<uint8_t>& create_packet() const override;
+	void write_payload(uint8_t* out) const;
 };
 
-class SendPublicKeyRequest : public Request {
+class SendPublicKeyRequest : public Request<SendPublicKeyRequest> {
 	std::string name;
 	std::string public_key;
 
@@ -55,58 +78,199 @@ public:
 	constexpr static uint8_t SIZE_CLIENT_NAME = 255; // including '\0'
 	constexpr static uint8_t SIZE_PUBLIC_KEY = 160;
 	constexpr static uint16_t CODE = 826;
+	using Layout = PacketLayout::Layout<PacketLayout::PaddedString<SIZE_CLIENT_NAME>, PacketLayout::FixedBytes<SIZE_PUBLIC_KEY>>;
+
 	SendPublicKeyRequest(const RequestHeader& header, const std::string& name, const std::string& public_key);
-	const std::vector<uint8_t>& create_packet() const override;
+	void write_payload(uint8_t* out) const;
 };
 
-class ReconnectRequest : public Request {
+class ReconnectRequest : public Request<ReconnectRequest> {
 private:
 	std::string name;
 public:
 	constexpr static uint8_t SIZE_CLIENT_NAME = 255; // including '\0'
 	constexpr static uint16_t CODE = 827;
+	using Layout = PacketLayout::Layout<PacketLayout::PaddedString<SIZE_CLIENT_NAME>>;
+
 	ReconnectRequest(const RequestHeader& header, const std::string& name);
-	const std::vector<uint8_t>& create_packet() const override;
+	void write_payload(uint8_t* out) const;
 };
 
-class SendFileRequest : public Request {
+class SendFileRequest : public Request<SendFileRequest> {
 private:
-	uint32_t encrypted_file_size;
-	uint32_t original_file_size;
-	uint16_t packet_number;
-	uint16_t total_packets;
+	uint64_t encrypted_file_size;
+	uint64_t original_file_size;
+	uint64_t offset; // of the content in the encrypted file
+	uint32_t packet_number;
+	uint32_t total_packets;
 	std::string file_name;
 	std::string message_content; // encrypted file content
 
 public:
 	constexpr static uint16_t CODE = 828;
-	constexpr static uint8_t SIZE_ENCRYPTED_FILE_SIZE = 4;
-	constexpr static uint8_t SIZE_ORIGINAL_FILE_SIZE = 4;
-	constexpr static uint8_t SIZE_PACKET_NUMBER = 2;
-	constexpr static uint8_t SIZE_TOTAL_PACKETS = 2;
+	// from this header version on the sizes and the offset are 64-bit and the packet counters 32-bit; the server tells
+	// its version in every response header, and older servers get the LegacyLayout (files up to 4 GB and 65,535 packets)
+	constexpr static uint8_t LARGE_FILES_VERSION = 4;
 	constexpr static uint8_t SIZE_FILE_NAME = 255; // including '\0'
+	// the fixed fields, the content follows them
+	using Layout = PacketLayout::Layout<
+		PacketLayout::LittleEndian<uint64_t>, // encrypted file size
+		PacketLayout::LittleEndian<uint64_t>, // original file size
+		PacketLayout::LittleEndian<uint64_t>, // offset
+		PacketLayout::LittleEndian<uint32_t>, // packet number, from 1
+		PacketLayout::LittleEndian<uint32_t>, // total packets
+		PacketLayout::PaddedString<SIZE_FILE_NAME>
+	>;
+	using LegacyLayout = PacketLayout::Layout<
+		PacketLayout::LittleEndian<uint32_t>,
+		PacketLayout::LittleEndian<uint32_t>,
+		PacketLayout::LittleEndian<uint16_t>,
+		PacketLayout::LittleEndian<uint16_t>,
+		PacketLayout::PaddedString<SIZE_FILE_NAME>
+	>;
 
 	SendFileRequest(
 		const RequestHeader& header,
-		const uint32_t& encrypted_file_size,
-		const uint32_t& original_file_size,
-		const uint16_t& packet_number,
-		const uint16_t& total_packets,
+		const uint64_t& encrypted_file_size,
+		const uint64_t& original_file_size,
+		const uint64_t& offset,
+		const uint32_t& packet_number,
+		const uint32_t& total_packets,
+		const std::string& file_name,
+		std::string_view message_content
+	);
+
+	constexpr static uint32_t payload_size(size_t content_size, uint8_t version) {
+		return static_cast<uint32_t>((version >= LARGE_FILES_VERSION ? Layout::SIZE : LegacyLayout::SIZE) + content_size);
+	}
+	// whether a file can be sent with the LegacyLayout
+	constexpr static bool fits_legacy(uint64_t encrypted_file_size, uint64_t total_packets) {
+		return encrypted_file_size <= UINT32_MAX && total_packets <= UINT16_MAX;
+	}
+
+	// turns this request into the one for another chunk, keeping the strings' and the packet's buffers; version is the
+	// session's, it may differ from the one the request was created with (a daemon that reconnected to another server)
+	void reset(
+		const std::string& id,
+		const uint8_t& version,
+		const uint64_t& encrypted_file_size,
+		const uint64_t& original_file_size,
+		const uint64_t& offset,
+		const uint32_t& packet_number,
+		const uint32_t& total_packets,
 		const std::string& file_name,
-		const std::string& message_content
+		std::string_view message_content
 	);
 
-	const std::vector<uint8_t>& create_packet() const override;
+	void write_payload(uint8_t* out) const;
+};
+
+// proposes checksum algorithms for a file, in order of preference (the server picks one, see Checksum::Algorithm)
+class NegotiateChecksumRequest : public Request<NegotiateChecksumRequest> {
+private:
+	std::string file_name;
+	std::string algorithms; // one id per byte
+public:
+	constexpr static uint16_t CODE = 829;
+	// servers from this version on take the request, older ones verify every file with cksum and are not asked
+	constexpr static uint8_t NEGOTIATE_VERSION = 4;
+	constexpr static uint8_t SIZE_FILE_NAME = 255; // including '\0'
+	constexpr static uint8_t MAX_ALGORITHMS = 8; // zero padded, and 0 (cksum) is always acceptable
+	using Layout = PacketLayout::Layout<PacketLayout::PaddedString<SIZE_FILE_NAME>, PacketLayout::FixedBytes<MAX_ALGORITHMS>>;
+
+	NegotiateChecksumRequest(const RequestHeader& header, const std::string& file_name, const std::string& algorithms);
+	void write_payload(uint8_t* out) const;
+};
+
+// a byte range of the original file that is all zeros (a hole or zero blocks), see SendZeroRangesRequest
+struct ZeroRange {
+	uint64_t offset;
+	uint64_t length;
+};
+
+// lists zero ranges of the file that are not in the encrypted stream, the server leaves them as holes in the stored file.
+// Every attempt to send a file to a SPARSE_VERSION server starts with one (without ranges for a file that has none), more
+// follow for more than MAX_RANGES ranges; first_index numbers a batch's first range in the file's list, 0 starts it over
+class SendZeroRangesRequest : public Request<SendZeroRangesRequest> {
+private:
+	std::string file_name;
+	uint32_t first_index;
+	std::vector<ZeroRange> ranges;
+public:
+	constexpr static uint16_t CODE = 830;
+	// servers from this version on take the request, the client sends older ones every byte
+	constexpr static uint8_t SPARSE_VERSION = 5;
+	constexpr static uint8_t SIZE_FILE_NAME = 255; // including '\0'
+	constexpr static uint32_t MAX_RANGES = 4096;
+	// the fixed fields, count ranges follow them
+	using Layout = PacketLayout::Layout<
+		PacketLayout::PaddedString<SIZE_FILE_NAME>,
+		PacketLayout::LittleEndian<uint32_t>, // first index
+		PacketLayout::LittleEndian<uint32_t> // count
+	>;
+	using RangeLayout = PacketLayout::Layout<
+		PacketLayout::LittleEndian<uint64_t>, // offset in the original file
+		PacketLayout::LittleEndian<uint64_t> // length
+	>;
+
+	SendZeroRangesRequest(const RequestHeader& header, const std::string& file_name, uint32_t first_index, std::vector<ZeroRange> ranges);
+
+	constexpr static uint32_t payload_size(size_t count) {
+		return static_cast<uint32_t>(Layout::SIZE + count * RangeLayout::SIZE);
+	}
+
+	void write_payload(uint8_t* out) const;
+};
+
+// asks for a stored file before downloading it: the server answers with its size and picks the checksum algorithm its
+// ranges are verified with out of the proposed ones, as for NegotiateChecksumRequest
+class FileInfoRequest : public Request<FileInfoRequest> {
+private:
+	std::string file_name;
+	std::string algorithms; // one id per byte
+public:
+	constexpr static uint16_t CODE = 831;
+	// servers from this version on serve downloads
+	constexpr static uint8_t DOWNLOAD_VERSION = 6;
+	constexpr static uint8_t SIZE_FILE_NAME = 255; // including '\0'
+	constexpr static uint8_t MAX_ALGORITHMS = 8;
+	using Layout = PacketLayout::Layout<PacketLayout::PaddedString<SIZE_FILE_NAME>, PacketLayout::FixedBytes<MAX_ALGORITHMS>>;
+
+	FileInfoRequest(const RequestHeader& header, const std::string& file_name, const std::string& algorithms);
+	void write_payload(uint8_t* out) const;
+};
+
+// asks for a range of a stored file, which comes back encrypted with the session's AES key along with its checksum
+class ReadRangeRequest : public Request<ReadRangeRequest> {
+private:
+	std::string file_name;
+	uint64_t offset;
+	uint32_t length;
+	uint8_t algorithm;
+public:
+	constexpr static uint16_t CODE = 832;
+	constexpr static uint8_t SIZE_FILE_NAME = 255; // including '\0'
+	constexpr static uint32_t MAX_LENGTH = 4 << 20; // the server refuses longer ranges
+	using Layout = PacketLayout::Layout<
+		PacketLayout::PaddedString<SIZE_FILE_NAME>,
+		PacketLayout::LittleEndian<uint64_t>, // offset
+		PacketLayout::LittleEndian<uint32_t>, // length
+		PacketLayout::LittleEndian<uint8_t> // checksum algorithm, the one FileInfoRequest picked
+	>;
+
+	ReadRangeRequest(const RequestHeader& header, const std::string& file_name, uint64_t offset, uint32_t length, uint8_t algorithm);
+	void write_payload(uint8_t* out) const;
 };
 
-class SendCRCStateRequest : public Request {
+class SendCRCStateRequest : public Request<SendCRCStateRequest> {
 	std::string file_name;
 public:
 	constexpr static uint16_t CODE_CORRECT = 900;
 	constexpr static uint16_t CODE_INCORRECT = 901;
 	constexpr static uint16_t CODE_ELIMINATE = 902;
 	constexpr static uint8_t SIZE_FILE_NAME = 255; // including '\0'
+	using Layout = PacketLayout::Layout<PacketLayout::PaddedString<SIZE_FILE_NAME>>;
 
 	SendCRCStateRequest(const RequestHeader& header, const std::string& file_name);
-	const std::vector<uint8_t>& create_packet() const override;
+	void write_payload(uint8_t* out) const;
 };
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+// RequestPool keeps released requests, and the packet buffers they own, for reuse. A steady stream of requests of one
+// kind stops allocating once the pool is warm. Handles return their request to the pool, so they must not outlive it.
+template<typename T>
+class RequestPool {
+public:
+	struct Releaser {
+		RequestPool* pool;
+		void operator()(T* request) const {
+			pool->release(request);
+		}
+	};
+	using Handle = std::unique_ptr<T, Releaser>;
+
+private:
+	std::vector<std::unique_ptr<T>> idle;
+	size_t created = 0;
+	size_t reused = 0;
+
+	void release(T* request) {
+		idle.emplace_back(request);
+	}
+
+public:
+	RequestPool() = default;
+	RequestPool(const RequestPool&) = delete;
+	RequestPool& operator=(const RequestPool&) = delete;
+
+	// hands out an idle request after reset_request(request), or a new one from create_request() when none is idle
+	template<typename CreateFunc, typename ResetFunc>
+	Handle acquire(CreateFunc create_request, ResetFunc reset_request) {
+		if (idle.empty()) {
+			++created;
+			return Handle(create_request(), Releaser{ this });
+		}
+		T* request = idle.back().release();
+		idle.pop_back();
+		reset_request(*request);
+		++reused;
+		return Handle(request, Releaser{ this });
+	}
+
+	size_t get_created() const { return created; } // heap allocated requests, flat after warm-up
+	size_t get_reused() const { return reused; }
+};
@@ -4,3 +4,12 @@ ResponseHeader::ResponseHeader(uint8_t version, uint16_t code, uint32_t payload_
 	: version(version), code(code), payload_size(payload_size)
 {
 }
+ResponseHeader ResponseHeader::unpack(const uint8_t* in)
+{
+	auto [version, code, payload_size] = Layout::read(in);
+	return ResponseHeader(version, code, payload_size);
+}
+void ResponseHeader::pack_into(uint8_t* out) const
+{
+	Layout::write(out, version, code, payload_size);
+}
@@ -2,6 +2,8 @@
 
 #include <cstdint>
 #include <string>
+#include <string_view>
+#include "packet_layout.h"
 
 class ResponseHeader {
 public:
@@ -11,12 +13,20 @@ public:
 	constexpr static uint8_t SIZE_CODE = 2;
 	constexpr static uint8_t SIZE_PAYLOAD_SIZE = 4;
 	constexpr static uint8_t SIZE = ResponseHeader::SIZE_VERSION + ResponseHeader::SIZE_CODE + ResponseHeader::SIZE_PAYLOAD_SIZE;
+	using Layout = PacketLayout::Layout<
+		PacketLayout::LittleEndian<uint8_t>,
+		PacketLayout::LittleEndian<uint16_t>,
+		PacketLayout::LittleEndian<uint32_t>
+	>;
+	static_assert(Layout::SIZE == SIZE, "response header layout does not match its field sizes");
 
 	uint8_t version;
 	uint16_t code;
 	uint32_t payload_size;
 
 	ResponseHeader(uint8_t version, uint16_t code, uint32_t payload_size);
+	static ResponseHeader unpack(const uint8_t* in); // reads SIZE bytes
+	void pack_into(uint8_t* out) const; // writes SIZE bytes
 };
 
 namespace ResponsePayload {
@@ -24,6 +34,66 @@ namespace ResponsePayload {
 	constexpr uint8_t SIZE_CONTENT = 4; // size of the file after encryption
 	constexpr uint8_t SIZE_FILE_NAME = 255;
 	constexpr uint8_t SIZE_CRC = 4;
+
+	// client id (register success, reconnect rejected, message confirm), also the start of the AES key payloads
+	using ClientIdLayout = PacketLayout::Layout<PacketLayout::FixedBytes<SIZE_CLIENT_ID>>;
+	// send file success: client id, encrypted content size, file name, CRC
+	using SendFileLayout = PacketLayout::Layout<
+		PacketLayout::FixedBytes<SIZE_CLIENT_ID>,
+		PacketLayout::LittleEndian<uint32_t>,
+		PacketLayout::PaddedString<SIZE_FILE_NAME>,
+		PacketLayout::LittleEndian<uint32_t>
+	>;
+	// checksum selected: client id, the algorithm the server picked for the file
+	using ChecksumSelectedLayout = PacketLayout::Layout<
+		PacketLayout::FixedBytes<SIZE_CLIENT_ID>,
+		PacketLayout::LittleEndian<uint8_t>
+	>;
+	// send file success with a negotiated checksum: client id, encrypted content size, file name, algorithm, checksum
+	using SendFileDigestLayout = PacketLayout::Layout<
+		PacketLayout::FixedBytes<SIZE_CLIENT_ID>,
+		PacketLayout::LittleEndian<uint32_t>,
+		PacketLayout::PaddedString<SIZE_FILE_NAME>,
+		PacketLayout::LittleEndian<uint8_t>,
+		PacketLayout::LittleEndian<uint64_t>
+	>;
+	// file info: client id, size, bytes outside zero ranges, modification time (ns), algorithm of the range checksums
+	using FileInfoLayout = PacketLayout::Layout<
+		PacketLayout::FixedBytes<SIZE_CLIENT_ID>,
+		PacketLayout::LittleEndian<uint64_t>,
+		PacketLayout::LittleEndian<uint64_t>,
+		PacketLayout::LittleEndian<uint64_t>,
+		PacketLayout::LittleEndian<uint8_t>
+	>;
+	// range: client id, offset, length, flags, checksum of the plaintext, IV, then the ciphertext (none with RANGE_ZEROS)
+	constexpr uint8_t SIZE_IV = 16;
+	constexpr uint8_t RANGE_ZEROS = 1; // the range is all zeros
+	using RangeLayout = PacketLayout::Layout<
+		PacketLayout::FixedBytes<SIZE_CLIENT_ID>,
+		PacketLayout::LittleEndian<uint64_t>,
+		PacketLayout::LittleEndian<uint32_t>,
+		PacketLayout::LittleEndian<uint8_t>,
+		PacketLayout::LittleEndian<uint64_t>,
+		PacketLayout::FixedBytes<SIZE_IV>
+	>;
+};
+
+// a stored file, as a file info response describes it
+struct StoredFileInfo {
+	uint64_t size = 0;
+	uint64_t data_size = 0; // size less the zero ranges (holes)
+	uint64_t modified = 0; // changes when the file is sent again
+	uint8_t algorithm = 0; // of the range checksums
+};
+
+// a range response, the views point into the connection's buffer
+struct RangePayload {
+	uint64_t offset;
+	uint32_t length;
+	uint8_t flags;
+	uint64_t checksum;
+	std::string_view iv;
+	std::string_view ciphertext;
 };
 
 namespace ResponseCode {
@@ -35,4 +105,8 @@ namespace ResponseCode {
 	constexpr uint16_t RECONNECT_SUCCESS = 1605;
 	constexpr uint16_t RECONNECT_REJECTED = 1606;
 	constexpr uint16_t GENERAL_FAILURE = 1607;
+	constexpr uint16_t CHECKSUM_SELECTED = 1608;
+	constexpr uint16_t SEND_FILE_DIGEST = 1609; // instead of SEND_FILE_SUCCESS when the file's checksum is not cksum
+	constexpr uint16_t FILE_INFO = 1610;
+	constexpr uint16_t RANGE = 1611;
 };
\ No newline at end of file
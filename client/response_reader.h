@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+#include <vector>
+#include <boost/asio.hpp>
+
+// ResponseReader buffers what the server sends. Each read takes whatever the socket has, so a response (header and
+// payload) usually arrives in a single syscall and is then decoded in place. The views it returns point into the buffer
+// and stay valid until the next call to require, the buffer itself is kept for the whole connection.
+template<typename Stream>
+class ResponseReader {
+private:
+	Stream& stream;
+	std::vector<uint8_t> buffer;
+	size_t begin = 0; // first unread byte
+	size_t end = 0; // one past the last received byte
+
+public:
+	constexpr static size_t INITIAL_CAPACITY = 4096; // more than any response the server sends
+
+	explicit ResponseReader(Stream& stream) : stream(stream), buffer(INITIAL_CAPACITY) {}
+	ResponseReader(const ResponseReader&) = delete;
+	ResponseReader& operator=(const ResponseReader&) = delete;
+
+	// returns the next size bytes, reading from the stream only when fewer are buffered
+	const uint8_t* require(size_t size) {
+		if (end - begin < size) {
+			make_room(size);
+			while (end - begin < size) {
+				end += stream.read_some(boost::asio::buffer(buffer.data() + end, buffer.size() - end));
+			}
+		}
+		return buffer.data() + begin;
+	}
+	void consume(size_t size) {
+		begin += size;
+		if (begin == end) { // the common case, everything received was decoded
+			begin = end = 0;
+		}
+	}
+	// require and consume in one step, for payloads that are used as they are
+	std::string_view take(size_t size) {
+		const uint8_t* data = require(size);
+		consume(size);
+		return std::string_view(reinterpret_cast<const char*>(data), size);
+	}
+	size_t buffered() const { return end - begin; }
+	void clear() { begin = end = 0; } // drops what is left of a connection that was closed
+
+private:
+	// moves the unread bytes to the front, and grows the buffer only for a response larger than it
+	void make_room(size_t size) {
+		if (buffer.size() - begin >= size) {
+			return;
+		}
+		std::memmove(buffer.data(), buffer.data() + begin, end - begin);
+		end -= begin;
+		begin = 0;
+		if (buffer.size() < size) {
+			buffer.resize(size);
+		}
+	}
+};
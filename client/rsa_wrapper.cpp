@@ -1,6 +1,47 @@
 #include "rsa_wrapper.h"
 
 
+RSAPublicWrapper::RSAPublicWrapper(const char* key, unsigned int length)
+{
+	CryptoPP::StringSource ss(reinterpret_cast<const CryptoPP::byte*>(key), length, true);
+	_publicKey.Load(ss);
+}
+
+RSAPublicWrapper::RSAPublicWrapper(const std::string& key)
+{
+	CryptoPP::StringSource ss(key, true);
+	_publicKey.Load(ss);
+}
+
+RSAPublicWrapper::~RSAPublicWrapper()
+{
+}
+
+std::string RSAPublicWrapper::getPublicKey() const
+{
+	std::string key;
+	CryptoPP::StringSink ss(key);
+	_publicKey.Save(ss);
+	return key;
+}
+
+std::string RSAPublicWrapper::encrypt(const std::string& plain)
+{
+	std::string cipher;
+	CryptoPP::RSAES_OAEP_SHA_Encryptor e(_publicKey);
+	CryptoPP::StringSource ss(plain, true, new CryptoPP::PK_EncryptorFilter(_rng, e, new CryptoPP::StringSink(cipher)));
+	return cipher;
+}
+
+std::string RSAPublicWrapper::encrypt(const char* plain, unsigned int length)
+{
+	std::string cipher;
+	CryptoPP::RSAES_OAEP_SHA_Encryptor e(_publicKey);
+	CryptoPP::StringSource ss(reinterpret_cast<const CryptoPP::byte*>(plain), length, true, new CryptoPP::PK_EncryptorFilter(_rng, e, new CryptoPP::StringSink(cipher)));
+	return cipher;
+}
+
+
 RSAPrivateWrapper::RSAPrivateWrapper()
 {
 	_privateKey.Initialize(_rng, BITS);
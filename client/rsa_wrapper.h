@@ -5,6 +5,28 @@
 
 #include <string>
 
+class RSAPublicWrapper
+{
+public:
+	static const unsigned int KEYSIZE = 160;
+	static const unsigned int BITS = 1024;
+
+private:
+	CryptoPP::AutoSeededRandomPool _rng;
+	CryptoPP::RSA::PublicKey _publicKey;
+
+	RSAPublicWrapper(const RSAPublicWrapper& rsapublic);
+public:
+	RSAPublicWrapper(const char* key, unsigned int length);
+	RSAPublicWrapper(const std::string& key);
+	~RSAPublicWrapper();
+
+	std::string getPublicKey() const;
+
+	std::string encrypt(const std::string& plain);
+	std::string encrypt(const char* plain, unsigned int length);
+};
+
 class RSAPrivateWrapper
 {
 public:
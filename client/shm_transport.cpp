@@ -0,0 +1,349 @@
+#include "shm_transport.h"
+#include <stdexcept>
+
+#ifdef __linux__
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <thread>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace {
+
+	constexpr size_t MEMORY_SIZE = ShmTransport::DATA_OFFSET + 2 * size_t(ShmTransport::RING_SIZE);
+	constexpr size_t RING_SIZE_OFFSET = 8;
+	constexpr size_t CLOSED_OFFSET = 12;
+	constexpr int FD_COUNT = 3; // memfd, wake the server, wake the client
+	// the memfd's size is fixed before it is passed: a client that shrank it would fault the server on its next access
+	constexpr int SIZE_SEALS = F_SEAL_SHRINK | F_SEAL_GROW;
+	constexpr int SPIN_LIMIT = 4096; // checks before blocking, the other side usually catches up within a few microseconds
+
+	// on a single core the other side cannot run while this one spins
+	int spin_limit() {
+		static const int limit = std::thread::hardware_concurrency() > 1 ? SPIN_LIMIT : 0;
+		return limit;
+	}
+
+	inline void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+		__builtin_ia32_pause();
+#endif
+	}
+
+	static_assert(std::atomic<uint64_t>::is_always_lock_free && std::atomic<uint32_t>::is_always_lock_free,
+		"the ring counters are shared with another process");
+	static_assert((ShmTransport::RING_SIZE & (ShmTransport::RING_SIZE - 1)) == 0, "RING_SIZE must be a power of two");
+
+	[[noreturn]] void throw_errno(const std::string& what) {
+		throw std::runtime_error("<Error>: " + what + ": " + std::strerror(errno));
+	}
+
+	// a view of one ring in the mapping
+	struct Ring {
+		std::atomic<uint64_t>* head; // written by the producer
+		std::atomic<uint64_t>* tail; // written by the consumer
+		std::atomic<uint32_t>* reader_waiting;
+		std::atomic<uint32_t>* writer_waiting;
+		uint8_t* data;
+
+		Ring(uint8_t* memory, int index) {
+			uint8_t* control = memory + ShmTransport::RING_OFFSET + index * ShmTransport::RING_CONTROL_SIZE;
+			head = reinterpret_cast<std::atomic<uint64_t>*>(control);
+			tail = reinterpret_cast<std::atomic<uint64_t>*>(control + 64);
+			reader_waiting = reinterpret_cast<std::atomic<uint32_t>*>(control + 128);
+			writer_waiting = reinterpret_cast<std::atomic<uint32_t>*>(control + 192);
+			data = memory + ShmTransport::DATA_OFFSET + index * size_t(ShmTransport::RING_SIZE);
+		}
+	};
+
+	class Connection : public Transport {
+	private:
+		int control; // the Unix domain socket
+		uint8_t* memory;
+		int own_event; // rung by the other side
+		int peer_event;
+		uint32_t own_closed;
+		uint32_t peer_closed;
+		Ring out;
+		Ring in;
+		std::atomic<uint32_t>* closed;
+		bool peer_left = false; // the socket was closed
+
+		// the other side is told only when it announced it is blocked, the fence orders the counter store before the flag load
+		void notify(std::atomic<uint32_t>* waiting) {
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			if (waiting->load(std::memory_order_relaxed) != 0) {
+				uint64_t one = 1;
+				if (::write(peer_event, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+					throw_errno("Could not wake the other side");
+				}
+			}
+		}
+
+		// spins for a moment, then blocks until ready(), with waiting set so that the other side rings the doorbell once it changed the ring
+		template<typename Ready>
+		void wait(std::atomic<uint32_t>* waiting, Ready ready) {
+			for (int spin = spin_limit(); spin > 0; --spin) {
+				if (ready()) {
+					return;
+				}
+				cpu_relax();
+			}
+			waiting->store(1, std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			while (!ready()) {
+				uint32_t state = closed->load(std::memory_order_acquire);
+				if (state & own_closed) {
+					throw boost::system::system_error(boost::asio::error::shut_down);
+				}
+				if (peer_left || (state & peer_closed)) {
+					throw boost::system::system_error(boost::asio::error::eof);
+				}
+				pollfd fds[2] = { { own_event, POLLIN, 0 }, { control, POLLIN, 0 } };
+				if (::poll(fds, 2, -1) < 0) {
+					if (errno == EINTR) {
+						continue;
+					}
+					throw_errno("Could not wait for the other side");
+				}
+				if (fds[0].revents & POLLIN) {
+					uint64_t count;
+					(void)::read(own_event, &count, sizeof(count)); // resets it, EAGAIN when the other side took it meanwhile
+				}
+				if (fds[1].revents & (POLLIN | POLLHUP | POLLERR)) {
+					peer_left = true; // nothing is sent on the socket after the handshake
+				}
+			}
+			waiting->store(0, std::memory_order_relaxed);
+		}
+
+	public:
+		Connection(bool server, int control, uint8_t* memory, int own_event, int peer_event) :
+			control(control), memory(memory), own_event(own_event), peer_event(peer_event),
+			own_closed(server ? ShmTransport::CLOSED_SERVER : ShmTransport::CLOSED_CLIENT),
+			peer_closed(server ? ShmTransport::CLOSED_CLIENT : ShmTransport::CLOSED_SERVER),
+			out(memory, server ? 1 : 0), in(memory, server ? 0 : 1),
+			closed(reinterpret_cast<std::atomic<uint32_t>*>(memory + CLOSED_OFFSET)) {}
+
+		~Connection() override {
+			::munmap(memory, MEMORY_SIZE);
+			::close(own_event);
+			::close(peer_event);
+			::close(control);
+		}
+
+		void write(const uint8_t* data, size_t size) override {
+			while (size > 0) {
+				uint64_t head = out.head->load(std::memory_order_relaxed);
+				uint64_t free = ShmTransport::RING_SIZE - (head - out.tail->load(std::memory_order_acquire));
+				if (free == 0) {
+					wait(out.writer_waiting, [&]() { return out.tail->load(std::memory_order_acquire) != head - ShmTransport::RING_SIZE; });
+					continue;
+				}
+				size_t n = static_cast<size_t>(std::min<uint64_t>(size, free));
+				size_t position = static_cast<size_t>(head & (ShmTransport::RING_SIZE - 1));
+				size_t first = std::min<size_t>(n, ShmTransport::RING_SIZE - position);
+				std::memcpy(out.data + position, data, first);
+				std::memcpy(out.data, data + first, n - first);
+				out.head->store(head + n, std::memory_order_release);
+				notify(out.reader_waiting);
+				data += n;
+				size -= n;
+			}
+		}
+
+		size_t read_some(uint8_t* data, size_t size) override {
+			if (size == 0) {
+				return 0;
+			}
+			uint64_t tail = in.tail->load(std::memory_order_relaxed);
+			uint64_t available = in.head->load(std::memory_order_acquire) - tail;
+			if (available == 0) {
+				wait(in.reader_waiting, [&]() { return in.head->load(std::memory_order_acquire) != tail; });
+				available = in.head->load(std::memory_order_acquire) - tail;
+			}
+			size_t n = static_cast<size_t>(std::min<uint64_t>(size, available));
+			size_t position = static_cast<size_t>(tail & (ShmTransport::RING_SIZE - 1));
+			size_t first = std::min<size_t>(n, ShmTransport::RING_SIZE - position);
+			std::memcpy(data, in.data + position, first);
+			std::memcpy(data + first, in.data, n - first);
+			in.tail->store(tail + n, std::memory_order_release);
+			notify(in.writer_waiting);
+			return n;
+		}
+
+		void shutdown() override {
+			closed->fetch_or(own_closed, std::memory_order_acq_rel);
+			uint64_t one = 1;
+			(void)::write(own_event, &one, sizeof(one)); // a read or write blocked in another thread
+			(void)::write(peer_event, &one, sizeof(one));
+			::shutdown(control, SHUT_RDWR);
+		}
+	};
+
+	// owns the descriptors until the connection takes them
+	struct Descriptors {
+		int fds[FD_COUNT] = { -1, -1, -1 };
+		~Descriptors() {
+			for (int fd : fds) {
+				if (fd >= 0) {
+					::close(fd);
+				}
+			}
+		}
+	};
+
+	uint8_t* map(int memfd) {
+		void* memory = ::mmap(nullptr, MEMORY_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+		if (memory == MAP_FAILED) {
+			throw_errno("Could not map the shared memory");
+		}
+		return static_cast<uint8_t*>(memory);
+	}
+
+}
+
+std::unique_ptr<Transport> ShmTransport::connect(const std::string& path)
+{
+	sockaddr_un address{};
+	if (path.size() >= sizeof(address.sun_path)) {
+		throw std::runtime_error("<Error>: The socket path is too long: " + path);
+	}
+	address.sun_family = AF_UNIX;
+	std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+	int control = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (control < 0) {
+		throw_errno("Could not create a socket");
+	}
+	Descriptors owned;
+	owned.fds[0] = control;
+	if (::connect(control, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0) {
+		throw boost::system::system_error(boost::system::error_code(errno, boost::system::system_category()), "connect");
+	}
+
+	// the descriptors passed to the server: the memory, wake the server, wake the client
+	Descriptors passed;
+	passed.fds[0] = ::memfd_create("gyf-shm", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	passed.fds[1] = ::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	passed.fds[2] = ::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (passed.fds[0] < 0 || passed.fds[1] < 0 || passed.fds[2] < 0) {
+		throw_errno("Could not create the shared memory");
+	}
+	if (::ftruncate(passed.fds[0], MEMORY_SIZE) < 0) {
+		throw_errno("Could not size the shared memory");
+	}
+	if (::fcntl(passed.fds[0], F_ADD_SEALS, SIZE_SEALS) < 0) {
+		throw_errno("Could not seal the shared memory");
+	}
+	uint8_t* memory = map(passed.fds[0]);
+	std::memcpy(memory, MAGIC, sizeof(MAGIC));
+	std::memcpy(memory + RING_SIZE_OFFSET, &RING_SIZE, sizeof(RING_SIZE)); // a fresh memfd is zeroed, so are the rings
+	// the server maps the memory only after the first request may have been written, until then it wants the doorbell
+	Ring(memory, 0).reader_waiting->store(1, std::memory_order_relaxed);
+	Ring(memory, 1).writer_waiting->store(1, std::memory_order_relaxed);
+
+	char marker[sizeof(MAGIC)];
+	std::memcpy(marker, MAGIC, sizeof(MAGIC));
+	iovec vector{ marker, sizeof(marker) };
+	alignas(cmsghdr) char space[CMSG_SPACE(sizeof(int) * FD_COUNT)] = {};
+	msghdr message{};
+	message.msg_iov = &vector;
+	message.msg_iovlen = 1;
+	message.msg_control = space;
+	message.msg_controllen = sizeof(space);
+	cmsghdr* header = CMSG_FIRSTHDR(&message);
+	header->cmsg_level = SOL_SOCKET;
+	header->cmsg_type = SCM_RIGHTS;
+	header->cmsg_len = CMSG_LEN(sizeof(int) * FD_COUNT);
+	std::memcpy(CMSG_DATA(header), passed.fds, sizeof(int) * FD_COUNT);
+	if (::sendmsg(control, &message, MSG_NOSIGNAL) != static_cast<ssize_t>(sizeof(marker))) {
+		int error = errno;
+		::munmap(memory, MEMORY_SIZE);
+		errno = error;
+		throw_errno("Could not hand the shared memory to the server");
+	}
+
+	auto connection = std::make_unique<Connection>(false, control, memory, passed.fds[2], passed.fds[1]);
+	owned.fds[0] = passed.fds[1] = passed.fds[2] = -1; // the connection owns them now, the mapping outlives the memfd
+	return connection;
+}
+
+std::unique_ptr<Transport> ShmTransport::accept(boost::asio::local::stream_protocol::socket& socket, std::string& received)
+{
+	char data[sizeof(MAGIC)];
+	iovec vector{ data, sizeof(data) };
+	alignas(cmsghdr) char space[CMSG_SPACE(sizeof(int) * FD_COUNT)] = {};
+	msghdr message{};
+	message.msg_iov = &vector;
+	message.msg_iovlen = 1;
+	message.msg_control = space;
+	message.msg_controllen = sizeof(space);
+	ssize_t size = ::recvmsg(socket.native_handle(), &message, MSG_CMSG_CLOEXEC);
+	if (size < 0) {
+		throw boost::system::system_error(boost::system::error_code(errno, boost::system::system_category()), "recvmsg");
+	}
+	if (size == 0) {
+		throw boost::system::system_error(boost::asio::error::eof);
+	}
+
+	Descriptors passed;
+	cmsghdr* header = CMSG_FIRSTHDR(&message);
+	if (header != nullptr && header->cmsg_level == SOL_SOCKET && header->cmsg_type == SCM_RIGHTS) {
+		size_t count = std::min<size_t>((header->cmsg_len - CMSG_LEN(0)) / sizeof(int), FD_COUNT);
+		std::memcpy(passed.fds, CMSG_DATA(header), sizeof(int) * count);
+	}
+	if (passed.fds[0] < 0) { // a plain Unix domain socket client, this was the start of its first request
+		received.assign(data, static_cast<size_t>(size));
+		return nullptr;
+	}
+	if (passed.fds[2] < 0 || static_cast<size_t>(size) != sizeof(MAGIC) || std::memcmp(data, MAGIC, sizeof(MAGIC)) != 0) {
+		throw std::runtime_error("<Error>: The client sent an invalid shared memory handshake.");
+	}
+	int seals = ::fcntl(passed.fds[0], F_GET_SEALS);
+	struct stat status;
+	if (seals < 0 || (seals & SIZE_SEALS) != SIZE_SEALS || ::fstat(passed.fds[0], &status) < 0 ||
+		static_cast<uint64_t>(status.st_size) < MEMORY_SIZE) {
+		throw std::runtime_error("<Error>: The client's shared memory is not sealed at its size.");
+	}
+	uint8_t* memory = map(passed.fds[0]);
+	uint32_t ring_size;
+	std::memcpy(&ring_size, memory + RING_SIZE_OFFSET, sizeof(ring_size));
+	if (std::memcmp(memory, MAGIC, sizeof(MAGIC)) != 0 || ring_size != RING_SIZE) {
+		::munmap(memory, MEMORY_SIZE);
+		throw std::runtime_error("<Error>: The client's shared memory has an unknown layout.");
+	}
+	int control = ::dup(socket.native_handle()); // the socket object stays with the caller
+	if (control < 0) {
+		int error = errno;
+		::munmap(memory, MEMORY_SIZE);
+		errno = error;
+		throw_errno("Could not keep the socket");
+	}
+	auto connection = std::make_unique<Connection>(true, control, memory, passed.fds[1], passed.fds[2]);
+	passed.fds[1] = passed.fds[2] = -1;
+	return connection;
+}
+
+#else
+
+std::unique_ptr<Transport> ShmTransport::connect(const std::string& path)
+{
+	throw std::runtime_error("<Error>: The shared memory transport is only supported on Linux, use unix: or host:port in transfer.info.");
+}
+
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+std::unique_ptr<Transport> ShmTransport::accept(boost::asio::local::stream_protocol::socket& socket, std::string& received)
+{
+	return nullptr; // no client on this platform sends the shared memory
+}
+#endif
+
+#endif
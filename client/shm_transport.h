@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <boost/asio.hpp>
+#include "transport.h"
+
+// ShmTransport carries the stream through shared memory, for a client on the same host as the server (Linux only).
+// The client creates a memfd and two eventfds and passes them (SCM_RIGHTS) on the server's Unix domain socket, after that
+// a request is copied once into a ring and read by the server in place, no socket buffers in between. The memfd holds:
+//   0     MAGIC, u32 ring size, u32 closed (CLOSED_CLIENT / CLOSED_SERVER, set by shutdown)
+//   64    ring 0 (client to server): u64 head (bytes written), +64 u64 tail (bytes read),
+//         +128 u32 reader waiting, +192 u32 writer waiting, each on its own cache line
+//   320   ring 1 (server to client), the same
+//   4096  ring 0 data, then ring 1 data, RING_SIZE each
+// A side about to block sets its waiting flag and looks again, the other side rings its eventfd only when the flag is set,
+// so a busy stream costs no syscalls. The server's flags start set, as it maps the memory only after the client may have
+// written, a side that cannot order its loads and stores (the Python server) keeps them set.
+// The eventfds are "wake the server" and "wake the client", the socket stays open only to tell that the other side left.
+// The memfd is sealed at its size (F_SEAL_SHRINK | F_SEAL_GROW) before it is passed, the server refuses one that is not.
+namespace ShmTransport {
+
+	constexpr char MAGIC[8] = "GYFSHM1";
+	constexpr uint32_t RING_SIZE = 4 << 20; // a power of two
+	constexpr size_t RING_OFFSET = 64;
+	constexpr size_t RING_CONTROL_SIZE = 256;
+	constexpr size_t DATA_OFFSET = 4096;
+	constexpr uint32_t CLOSED_CLIENT = 1;
+	constexpr uint32_t CLOSED_SERVER = 2;
+
+	std::unique_ptr<Transport> connect(const std::string& path);
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+	// the server end, nullptr when the client did not send the shared memory (a UNIX client), what it sent instead is in received
+	std::unique_ptr<Transport> accept(boost::asio::local::stream_protocol::socket& socket, std::string& received);
+#endif
+}
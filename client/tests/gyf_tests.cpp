@@ -0,0 +1,76 @@
+// gyf-tests: checks of the client's wire formats that need no server, run by ctest.
+// usage: gyf-tests
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "protocol_handler.h"
+#include "request.h"
+#include "request_pool.h"
+
+namespace {
+
+	int failures = 0;
+
+	void check(bool condition, const std::string& what) {
+		if (!condition) {
+			std::cerr << "FAILED: " << what << std::endl;
+			++failures;
+		}
+	}
+
+	const std::string CLIENT_ID(RequestHeader::SIZE_CLIENT_ID, '\x5a');
+	const std::string CHUNK(4096, '\x11');
+
+	uint32_t packed_payload_size(const std::vector<uint8_t>& packet) {
+		auto [id, version, code, payload_size] = RequestHeader::Layout::read(packet.data());
+		return payload_size;
+	}
+
+	// a pooled request created for a v3 session and reset for a v4 one has to be packed with the v4 layout and size
+	void send_file_request_reset_changes_version() {
+		const ProtocolHandler& proto_handler = ProtocolHandler::get_instance();
+		RequestPool<SendFileRequest> pool;
+		const uint8_t legacy = SendFileRequest::LARGE_FILES_VERSION - 1;
+		const uint8_t large = SendFileRequest::LARGE_FILES_VERSION;
+		{
+			RequestPool<SendFileRequest>::Handle request = pool.acquire(
+				[&]() { return new SendFileRequest(proto_handler.create_send_file_request(CLIENT_ID, legacy, 8192, 8000, 0, 1, 2, "a.bin", CHUNK)); },
+				[&](SendFileRequest&) { check(false, "a fresh pool has no idle request"); }
+			);
+			const std::vector<uint8_t>& packet = request->create_packet();
+			check(packet.size() == RequestHeader::SIZE + SendFileRequest::LegacyLayout::SIZE + CHUNK.size(), "v3 packet size");
+			check(packet[RequestHeader::SIZE_CLIENT_ID] == legacy, "v3 header version");
+		}
+		RequestPool<SendFileRequest>::Handle request = pool.acquire(
+			[&]() { check(false, "the released request is reused"); return nullptr; },
+			[&](SendFileRequest& reused) { reused.reset(CLIENT_ID, large, 8192, 8000, 4096, 2, 2, "a.bin", CHUNK); }
+		);
+		const std::vector<uint8_t>& packet = request->create_packet();
+		check(packet.size() == RequestHeader::SIZE + SendFileRequest::Layout::SIZE + CHUNK.size(), "reset to v4: packet size");
+		check(packet[RequestHeader::SIZE_CLIENT_ID] == large, "reset to v4: header version");
+		check(packed_payload_size(packet) == SendFileRequest::Layout::SIZE + CHUNK.size(), "reset to v4: header payload size");
+		auto [encrypted_size, original_size, offset, packet_number, total_packets, file_name] =
+			SendFileRequest::Layout::read(packet.data() + RequestHeader::SIZE);
+		check(encrypted_size == 8192 && original_size == 8000 && offset == 4096 && packet_number == 2 && total_packets == 2,
+			"reset to v4: fields");
+		check(std::memcmp(packet.data() + RequestHeader::SIZE + SendFileRequest::Layout::SIZE, CHUNK.data(), CHUNK.size()) == 0,
+			"reset to v4: content");
+
+		request->reset(CLIENT_ID, legacy, 8192, 8000, 0, 1, 2, "a.bin", CHUNK);
+		check(request->create_packet().size() == RequestHeader::SIZE + SendFileRequest::LegacyLayout::SIZE + CHUNK.size(),
+			"reset back to v3: packet size");
+	}
+}
+
+int main()
+{
+	send_file_request_reset_changes_version();
+	if (failures) {
+		std::cerr << failures << " check(s) failed" << std::endl;
+		return 1;
+	}
+	std::cout << "all checks passed" << std::endl;
+	return 0;
+}
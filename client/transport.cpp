@@ -0,0 +1,96 @@
+#include "transport.h"
+#include <stdexcept>
+#include "shm_transport.h"
+
+namespace {
+
+	// TCP and UNIX differ only in the socket type
+	template<typename Protocol>
+	class SocketTransport : public Transport {
+	private:
+		boost::asio::io_context io_context; // before the socket, which uses it; unused when accepted
+		typename Protocol::socket socket;
+		std::string received; // what the server end read before knowing the transport, handed out first
+
+	public:
+		SocketTransport() : socket(io_context) {}
+		SocketTransport(typename Protocol::socket&& accepted, std::string received = "") : socket(std::move(accepted)), received(std::move(received)) {}
+
+		typename Protocol::socket& get_socket() { return socket; }
+
+		void write(const uint8_t* data, size_t size) override {
+			boost::asio::write(socket, boost::asio::buffer(data, size));
+		}
+		size_t read_some(uint8_t* data, size_t size) override {
+			if (!received.empty()) {
+				size_t n = received.copy(reinterpret_cast<char*>(data), size);
+				received.erase(0, n);
+				return n;
+			}
+			return socket.read_some(boost::asio::buffer(data, size));
+		}
+		void shutdown() override {
+			boost::system::error_code ignored;
+			socket.shutdown(Protocol::socket::shutdown_both, ignored);
+		}
+	};
+
+}
+
+std::string Transport::Address::to_string() const
+{
+	switch (kind) {
+	case Kind::UNIX:
+		return "unix:" + path;
+	case Kind::SHM:
+		return "shm:" + path;
+	default:
+		return host + ":" + std::to_string(port);
+	}
+}
+
+void Transport::read(uint8_t* data, size_t size)
+{
+	while (size > 0) {
+		size_t n = read_some(data, size);
+		data += n;
+		size -= n;
+	}
+}
+
+std::unique_ptr<Transport> Transport::connect(const Address& address)
+{
+	if (address.kind == Kind::SHM) {
+		return ShmTransport::connect(address.path);
+	}
+	if (address.kind == Kind::UNIX) {
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+		auto transport = std::make_unique<SocketTransport<boost::asio::local::stream_protocol>>();
+		transport->get_socket().connect(boost::asio::local::stream_protocol::endpoint(address.path));
+		return transport;
+#else
+		throw std::runtime_error("<Error>: Unix domain sockets are not supported on this platform, use host:port in transfer.info.");
+#endif
+	}
+	auto transport = std::make_unique<SocketTransport<boost::asio::ip::tcp>>();
+	boost::asio::ip::tcp::resolver resolver(transport->get_socket().get_executor());
+	boost::asio::connect(transport->get_socket(), resolver.resolve(address.host, std::to_string(address.port)));
+	return transport;
+}
+
+std::unique_ptr<Transport> Transport::accept(boost::asio::ip::tcp::socket socket)
+{
+	return std::make_unique<SocketTransport<boost::asio::ip::tcp>>(std::move(socket));
+}
+
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+std::unique_ptr<Transport> Transport::accept(boost::asio::local::stream_protocol::socket socket)
+{
+	std::string received;
+	std::unique_ptr<Transport> shm = ShmTransport::accept(socket, received);
+	if (shm) {
+		return shm;
+	}
+	return std::make_unique<SocketTransport<boost::asio::local::stream_protocol>>(std::move(socket), std::move(received));
+}
+#endif
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <boost/asio.hpp>
+
+// Transport is the byte stream between the client and the server. TCP works everywhere, a client on the same host as the
+// server can skip the TCP/IP stack with a Unix domain socket, or skip the socket for the data altogether with shared memory:
+// two ring buffers in a memfd both processes map, with an eventfd per side as the doorbell (shm_transport.h).
+// The first line of transfer.info picks it: "host:port", "unix:<socket path>" or "shm:<socket path>", the shared memory
+// is handed over on the server's Unix domain socket, which then only tells either side that the other one left.
+class Transport {
+public:
+	enum class Kind { TCP, UNIX, SHM };
+
+	struct Address {
+		Kind kind = Kind::TCP;
+		std::string host; // TCP
+		uint16_t port = 0; // TCP
+		std::string path; // the server's Unix domain socket, UNIX and SHM
+
+		std::string to_string() const; // as written in transfer.info
+	};
+
+	virtual ~Transport() = default; // releases the connection
+	virtual void write(const uint8_t* data, size_t size) = 0; // blocks until all of it was taken
+	virtual size_t read_some(uint8_t* data, size_t size) = 0; // blocks until something arrived, throws boost::system::system_error like a socket
+	virtual void shutdown() = 0; // the other side sees the connection closed, also wakes a read or write blocked in another thread
+
+	// the read_some ResponseReader calls
+	size_t read_some(const boost::asio::mutable_buffer& buffer) { return read_some(static_cast<uint8_t*>(buffer.data()), buffer.size()); }
+	void read(uint8_t* data, size_t size); // all size bytes
+
+	static std::unique_ptr<Transport> connect(const Address& address);
+	// the server ends, for the mock server
+	static std::unique_ptr<Transport> accept(boost::asio::ip::tcp::socket socket);
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+	static std::unique_ptr<Transport> accept(boost::asio::local::stream_protocol::socket socket); // either UNIX or SHM, the client decides
+#endif
+};
+
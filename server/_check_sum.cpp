@@ -0,0 +1,129 @@
+// Native accelerator for check_sum.py and checksums.py, built on the client's CRCCore and CRC32CCore so both sides
+// compute the same checksums.
+// Build it in place with: python setup.py build_ext --inplace
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include <cstdio>
+#include <vector>
+#include "crc_core.h"
+#include "crc32c_core.h"
+
+namespace {
+
+	constexpr size_t READ_BLOCK_SIZE = 1 << 20; // 1 MB per read
+
+	// update(crc, data) -> crc, feeds a bytes-like object into a running (not finalized) state
+	PyObject* update(PyObject*, PyObject* args) {
+		unsigned long crc;
+		Py_buffer data;
+		if (!PyArg_ParseTuple(args, "ky*", &crc, &data)) {
+			return nullptr;
+		}
+		uint32_t s = static_cast<uint32_t>(crc);
+		Py_BEGIN_ALLOW_THREADS
+		s = CRCCore::update(s, static_cast<const unsigned char*>(data.buf), static_cast<size_t>(data.len));
+		Py_END_ALLOW_THREADS
+		PyBuffer_Release(&data);
+		return PyLong_FromUnsignedLong(s);
+	}
+
+	// finalize(crc, length) -> checksum, applies the cksum length folding and inversion
+	PyObject* finalize(PyObject*, PyObject* args) {
+		unsigned long crc;
+		unsigned long long length;
+		if (!PyArg_ParseTuple(args, "kK", &crc, &length)) {
+			return nullptr;
+		}
+		return PyLong_FromUnsignedLong(CRCCore::finalize(static_cast<uint32_t>(crc), length));
+	}
+
+	// feeds the whole file to update(block, size) without holding the GIL, false (and a Python error) if it could not be read
+	template<typename Update>
+	bool read_file(PyObject* path_obj, Update update) {
+		const char* path = PyBytes_AsString(path_obj);
+		bool failed = false;
+		Py_BEGIN_ALLOW_THREADS
+		FILE* file = std::fopen(path, "rb");
+		if (file) {
+			std::vector<unsigned char> block(READ_BLOCK_SIZE);
+			size_t read_bytes;
+			while ((read_bytes = std::fread(block.data(), 1, block.size(), file)) > 0) {
+				update(block.data(), read_bytes);
+			}
+			failed = std::ferror(file) != 0;
+			std::fclose(file);
+		}
+		else {
+			failed = true;
+		}
+		Py_END_ALLOW_THREADS
+		if (failed) {
+			PyErr_SetFromErrnoWithFilenameObject(PyExc_OSError, path_obj);
+		}
+		return !failed;
+	}
+
+	// calculate(path) -> checksum, reads the whole file without holding the GIL
+	PyObject* calculate(PyObject*, PyObject* args) {
+		PyObject* path_obj;
+		if (!PyArg_ParseTuple(args, "O&", PyUnicode_FSConverter, &path_obj)) {
+			return nullptr;
+		}
+		uint32_t s = 0;
+		uint64_t length = 0;
+		bool read = read_file(path_obj, [&](const unsigned char* data, size_t size) {
+			s = CRCCore::update(s, data, size);
+			length += size;
+		});
+		Py_DECREF(path_obj);
+		return read ? PyLong_FromUnsignedLong(CRCCore::finalize(s, length)) : nullptr;
+	}
+
+	// crc32c_update(crc, data) -> crc, feeds a bytes-like object into a running CRC32C state (starts at 0xffffffff)
+	PyObject* crc32c_update(PyObject*, PyObject* args) {
+		unsigned long crc;
+		Py_buffer data;
+		if (!PyArg_ParseTuple(args, "ky*", &crc, &data)) {
+			return nullptr;
+		}
+		uint32_t s = static_cast<uint32_t>(crc);
+		Py_BEGIN_ALLOW_THREADS
+		s = CRC32CCore::update(s, static_cast<const unsigned char*>(data.buf), static_cast<size_t>(data.len));
+		Py_END_ALLOW_THREADS
+		PyBuffer_Release(&data);
+		return PyLong_FromUnsignedLong(s);
+	}
+
+	// calculate_crc32c(path) -> checksum, the CRC32C of a file (SSE4.2 when the CPU has it)
+	PyObject* calculate_crc32c(PyObject*, PyObject* args) {
+		PyObject* path_obj;
+		if (!PyArg_ParseTuple(args, "O&", PyUnicode_FSConverter, &path_obj)) {
+			return nullptr;
+		}
+		uint32_t s = CRC32CCore::START;
+		bool read = read_file(path_obj, [&](const unsigned char* data, size_t size) {
+			s = CRC32CCore::update(s, data, size);
+		});
+		Py_DECREF(path_obj);
+		return read ? PyLong_FromUnsignedLong(CRC32CCore::finish(s)) : nullptr;
+	}
+
+	PyMethodDef methods[] = {
+		{"update", update, METH_VARARGS, "Feed bytes into a running cksum state."},
+		{"finalize", finalize, METH_VARARGS, "Fold the length into the state and invert it."},
+		{"calculate", calculate, METH_VARARGS, "Compute the cksum of a file."},
+		{"crc32c_update", crc32c_update, METH_VARARGS, "Feed bytes into a running CRC32C state."},
+		{"calculate_crc32c", calculate_crc32c, METH_VARARGS, "Compute the CRC32C of a file."},
+		{nullptr, nullptr, 0, nullptr}
+	};
+
+	PyModuleDef module = {
+		PyModuleDef_HEAD_INIT, "_check_sum", "Native POSIX cksum (slicing-by-8) and CRC32C.", -1, methods,
+		nullptr, nullptr, nullptr, nullptr // slots, traverse, clear, free
+	};
+}
+
+PyMODINIT_FUNC PyInit__check_sum(void) {
+	return PyModule_Create(&module);
+}
@@ -2,10 +2,17 @@
 This module implements the cksum command found in most UNIXes in pure
 python.
 
-The constants and routine are cribbed from the POSIX man page
+The constants and routine are cribbed from the POSIX man page.
+When the native _check_sum extension is built (see setup.py) it is used instead of the
+pure python loop, it shares its tables with the client's CRCHandler.
 """
 import sys
 
+try:
+    import _check_sum
+except ImportError:
+    _check_sum = None
+
 crctab = [ 0x00000000, 0x04c11db7, 0x09823b6e, 0x0d4326d9, 0x130476dc,
         0x17c56b6b, 0x1a864db2, 0x1e475005, 0x2608edb8, 0x22c9f00f,
         0x2f8ad6d6, 0x2b4bcb61, 0x350c9b64, 0x31cd86d3, 0x3c8ea00a,
@@ -61,26 +68,45 @@ crctab = [ 0x00000000, 0x04c11db7, 0x09823b6e, 0x0d4326d9, 0x130476dc,
 
 UNSIGNED = lambda n: n & 0xffffffff
 
-def memcrc(b):
-    n = len(b)
-    i = c = s = 0
+# Size of each read when calculating a file's checksum
+READ_BLOCK_SIZE = 1 << 20
+
+
+def update(s, b):
+    """Feed bytes into a running (not finalized) checksum state."""
+    if _check_sum:
+        return _check_sum.update(s, b)
     for ch in b:
         tabidx = (s>>24)^ch
         s = UNSIGNED((s << 8)) ^ crctab[tabidx]
+    return s
 
+def finalize(s, n):
+    """Fold the total length n into the state and invert it."""
+    if _check_sum:
+        return _check_sum.finalize(s, n)
     while n:
         c = n & 0o377
         n = n >> 8
         s = UNSIGNED(s << 8) ^ crctab[(s >> 24) ^ c]
     return UNSIGNED(~s)
 
+def memcrc(b):
+    return finalize(update(0, b), len(b))
+
 def calculate(fname):
     try:
-        buffer = open(fname, 'rb').read()
-        return memcrc(buffer)
+        if _check_sum:
+            return _check_sum.calculate(fname)
+        s = n = 0
+        with open(fname, 'rb') as file:
+            while block := file.read(READ_BLOCK_SIZE):
+                s = update(s, block)
+                n += len(block)
+        return finalize(s, n)
     except IOError:
         print ("Unable to open input file", fname)
         exit (-1)
     except Exception as err:
         print ("Error processing the file", err)
-        exit (-1)
\ No newline at end of file
+        exit (-1)
@@ -0,0 +1,132 @@
+"""
+Checksum algorithms a transfer can be verified with, negotiated per file (request 829). The ids match the client's
+Checksum::Algorithm. cksum (check_sum.py) is always there, CRC32C uses the native _check_sum extension when it is built
+(hardware crc32 instruction) and a pure python table otherwise, xxHash3 needs the xxhash package.
+"""
+try:
+    import _check_sum
+except ImportError:
+    _check_sum = None
+
+try:
+    import xxhash
+except ImportError:
+    xxhash = None
+
+import check_sum
+
+CKSUM = 0
+CRC32C = 1
+XXH3_64 = 2
+
+NAMES = {CKSUM: "cksum", CRC32C: "crc32c", XXH3_64: "xxh3"}
+
+# Size of each read when calculating a file's checksum
+READ_BLOCK_SIZE = 1 << 20
+
+_CRC32C_POLYNOMIAL = 0x82f63b78
+
+
+def _make_crc32c_table() -> list[int]:
+    table = []
+    for i in range(256):
+        crc = i
+        for _ in range(8):
+            crc = (crc >> 1) ^ (_CRC32C_POLYNOMIAL if crc & 1 else 0)
+        table.append(crc)
+    return table
+
+
+_crc32c_table = _make_crc32c_table()
+
+# algorithm selected for each (client id, file name), kept until the client confirms or gives up on the file
+_selected: dict[tuple[str, str], int] = {}
+
+
+def is_available(algorithm: int) -> bool:
+    if algorithm == XXH3_64:
+        return xxhash is not None
+    return algorithm in (CKSUM, CRC32C)
+
+
+def pick(proposed: bytes) -> int:
+    """The first proposed algorithm this server supports, cksum if none."""
+    return next((a for a in proposed if is_available(a)), CKSUM)
+
+
+def select(client_id: str, file_name: str, proposed: bytes) -> int:
+    """Pick an algorithm (see pick) and remember it for the file."""
+    algorithm = pick(proposed)
+    _selected[(client_id, file_name)] = algorithm
+    return algorithm
+
+
+def selected(client_id: str, file_name: str) -> int:
+    return _selected.get((client_id, file_name), CKSUM)
+
+
+def forget(client_id: str, file_name: str) -> None:
+    _selected.pop((client_id, file_name), None)
+
+
+def _crc32c_update(crc: int, block: bytes) -> int:
+    if _check_sum:
+        return _check_sum.crc32c_update(crc, block)
+    for ch in block:
+        crc = (crc >> 8) ^ _crc32c_table[(crc ^ ch) & 0xff]
+    return crc
+
+
+class Running:
+    """A checksum fed in pieces, for content that is never written to a file (a stored-encrypted file is checked by
+    decrypting it into one of these)."""
+    _ZEROS = bytes(READ_BLOCK_SIZE)
+
+    def __init__(self, algorithm: int = CKSUM):
+        self.algorithm = algorithm
+        self._length = 0
+        if algorithm == XXH3_64:
+            self._state = xxhash.xxh3_64()
+        else:
+            self._state = 0xffffffff if algorithm == CRC32C else 0
+
+    def update(self, block: bytes) -> None:
+        if self.algorithm == XXH3_64:
+            self._state.update(block)
+        elif self.algorithm == CRC32C:
+            self._state = _crc32c_update(self._state, block)
+        else:
+            self._state = check_sum.update(self._state, block)
+        self._length += len(block)
+
+    def update_zeros(self, length: int) -> None:
+        while length > 0:
+            block = memoryview(Running._ZEROS)[:min(length, READ_BLOCK_SIZE)]
+            self.update(block)
+            length -= len(block)
+
+    def value(self) -> int:
+        if self.algorithm == XXH3_64:
+            return self._state.intdigest()
+        if self.algorithm == CRC32C:
+            return self._state ^ 0xffffffff
+        return check_sum.finalize(self._state, self._length)
+
+
+def calculate(fname: str, algorithm: int = CKSUM) -> int:
+    """Checksum of the file with the given algorithm (cksum values are identical to check_sum.calculate)."""
+    if algorithm == CKSUM:
+        return check_sum.calculate(fname)
+    if algorithm == CRC32C and _check_sum:
+        return _check_sum.calculate_crc32c(fname)
+    if algorithm == XXH3_64:
+        state = xxhash.xxh3_64()
+        with open(fname, 'rb') as file:
+            while block := file.read(READ_BLOCK_SIZE):
+                state.update(block)
+        return state.intdigest()
+    crc = 0xffffffff
+    with open(fname, 'rb') as file:
+        while block := file.read(READ_BLOCK_SIZE):
+            crc = _crc32c_update(crc, block)
+    return crc ^ 0xffffffff
@@ -0,0 +1,214 @@
+import fcntl
+import mmap
+import os
+import socket
+import struct
+
+from protocol_handler import ProtocolHandler
+from request import RequestHeader
+
+
+class Connection:
+    """Per-client connection state, buffers incoming bytes until whole requests arrived and queues outgoing responses."""
+
+    # Upper bound of bytes read on a single readiness event
+    RECV_SIZE = 65536
+    # Largest payload a header may announce before the framing is considered corrupt
+    MAX_PAYLOAD_SIZE = 1 << 24
+
+    def __init__(self, sock: socket.socket, address, received: bytes = b''):
+        self.socket = sock
+        self.address = address
+        self._in_buffer = bytearray(received)
+        self._out_buffer = bytearray()
+        self._header: RequestHeader | None = None  # header of the request whose payload is still arriving
+        self.paused = False  # set while a request of this connection runs in the worker pool, keeps requests in order
+
+    def receive(self) -> bool:
+        """Read whatever is available without blocking, returns False once the client closed the connection."""
+        try:
+            data = self.socket.recv(Connection.RECV_SIZE)
+        except (BlockingIOError, InterruptedError):
+            return True
+        if not data:
+            return False
+        self._in_buffer += data
+        return True
+
+    def next_frame(self) -> tuple[RequestHeader, bytes] | None:
+        """Pop the next complete request (header and payload) from the buffer, None if it has not fully arrived."""
+        if self._header is None:
+            if len(self._in_buffer) < RequestHeader.SIZE:
+                return None
+            self._header = ProtocolHandler().unpack_request_header(bytes(self._in_buffer[:RequestHeader.SIZE]))
+            del self._in_buffer[:RequestHeader.SIZE]
+            if self._header.payload_size > Connection.MAX_PAYLOAD_SIZE:
+                raise ConnectionAbortedError(f"payload of {self._header.payload_size} bytes is too large")
+
+        payload_size = self._header.payload_size
+        if len(self._in_buffer) < payload_size:
+            return None
+        header, payload = self._header, bytes(self._in_buffer[:payload_size])
+        del self._in_buffer[:payload_size]
+        self._header = None
+        return header, payload
+
+    def queue(self, packet: bytes) -> None:
+        """Queue a packet to be sent and try to send it right away."""
+        self._out_buffer += packet
+        self.flush()
+
+    def flush(self) -> None:
+        """Send as much of the queued output as the socket accepts without blocking."""
+        if not self._out_buffer:
+            return
+        try:
+            sent = self.socket.send(self._out_buffer)
+        except (BlockingIOError, InterruptedError):
+            return
+        del self._out_buffer[:sent]
+
+    def has_pending_output(self) -> bool:
+        return bool(self._out_buffer)
+
+    def wants_write_event(self) -> bool:
+        """Whether the selector has to tell when the connection takes more output."""
+        return self.has_pending_output()
+
+    def fileobjs(self) -> list:
+        """What the selector watches for the connection."""
+        return [self.socket]
+
+    def close(self) -> None:
+        self.socket.close()
+
+
+class ShmConnection(Connection):
+    """A client on the same host that handed over shared memory on the Unix domain socket (transfer.info "shm:<path>",
+    the layout is documented in the client's shm_transport.h). Requests are read from one ring of the memory and responses
+    written to the other, the eventfds only tell that a ring changed; the socket stays open to tell that the client left.
+    Python cannot order a store before a later load, so this side keeps its waiting flags set (the client always rings)
+    and always rings the client."""
+
+    MAGIC = b'GYFSHM1\0'
+    FD_COUNT = 3  # the memory, wake the server, wake the client
+    # the client fixes the memory's size before passing it, shrinking it under the mapping would kill the process
+    SIZE_SEALS = fcntl.F_SEAL_SHRINK | fcntl.F_SEAL_GROW
+    RING_OFFSET = 64
+    RING_CONTROL_SIZE = 256
+    DATA_OFFSET = 4096
+    CLOSED_OFFSET = 12
+    CLOSED_CLIENT = 1
+    CLOSED_SERVER = 2
+
+    def __init__(self, sock: socket.socket, address, received: bytes, fds: list[int]):
+        super().__init__(sock, address)
+        self._memory = None
+        self._words = self._flags = None
+        self._events = list(fds[1:])
+        try:
+            if len(fds) != ShmConnection.FD_COUNT or received != ShmConnection.MAGIC:
+                raise ConnectionAbortedError("invalid shared memory handshake")
+            if fcntl.fcntl(fds[0], fcntl.F_GET_SEALS) & ShmConnection.SIZE_SEALS != ShmConnection.SIZE_SEALS:
+                raise ConnectionAbortedError("shared memory not sealed at its size")
+            size = os.fstat(fds[0]).st_size
+            self._memory = mmap.mmap(fds[0], size)
+            self._ring_size = struct.unpack_from('<I', self._memory, 8)[0]
+            if (self._memory[:len(ShmConnection.MAGIC)] != ShmConnection.MAGIC or self._ring_size == 0
+                    or self._ring_size & (self._ring_size - 1) or size < ShmConnection.DATA_OFFSET + 2 * self._ring_size):
+                raise ConnectionAbortedError("unknown shared memory layout")
+        except (OSError, ValueError, ConnectionAbortedError):
+            self.close()
+            raise
+        finally:
+            os.close(fds[0])  # the mapping stays
+        self._server_event, self._client_event = self._events
+        os.set_blocking(self._server_event, False)
+        self._words = memoryview(self._memory).cast('Q')  # the counters, aligned 64-bit stores as the client expects
+        self._flags = memoryview(self._memory).cast('I')
+        self._flags[self._control(0, 128) // 4] = 1  # reader waiting, ring 0 (client to server)
+        self._flags[self._control(1, 192) // 4] = 1  # writer waiting, ring 1 (server to client)
+
+    @staticmethod
+    def _control(ring: int, field: int) -> int:
+        return ShmConnection.RING_OFFSET + ring * ShmConnection.RING_CONTROL_SIZE + field
+
+    def _data(self, ring: int, counter: int) -> int:
+        return ShmConnection.DATA_OFFSET + ring * self._ring_size + (counter & (self._ring_size - 1))
+
+    def _check_used(self, used: int) -> None:
+        """The counters live in memory the client writes, a ring can never hold more than its size."""
+        if not 0 <= used <= self._ring_size:
+            raise ConnectionAbortedError(f"shared memory ring counters are {used} bytes apart")
+
+    def _ring_client(self) -> None:
+        try:
+            os.eventfd_write(self._client_event, 1)
+        except BlockingIOError:
+            pass  # the counter is full, the client is woken anyway
+
+    def receive(self) -> bool:
+        try:
+            os.eventfd_read(self._server_event)
+        except (BlockingIOError, InterruptedError):
+            pass
+        self.flush()  # the client may have made room for queued responses
+        head_index, tail_index = self._control(0, 0) // 8, self._control(0, 64) // 8
+        head, tail = self._words[head_index], self._words[tail_index]
+        self._check_used(head - tail)
+        if head != tail:
+            while tail != head:
+                start = self._data(0, tail)
+                n = min(head - tail, ShmConnection.DATA_OFFSET + self._ring_size - start)
+                self._in_buffer += self._memory[start:start + n]
+                tail += n
+            self._words[tail_index] = tail
+            self._ring_client()
+            return True
+        if struct.unpack_from('<I', self._memory, ShmConnection.CLOSED_OFFSET)[0] & ShmConnection.CLOSED_CLIENT:
+            return False
+        try:
+            return self.socket.recv(1) != b''  # the client sends nothing on it after the handshake
+        except (BlockingIOError, InterruptedError):
+            return True
+
+    def flush(self) -> None:
+        if not self._out_buffer:
+            return
+        head_index, tail_index = self._control(1, 0) // 8, self._control(1, 64) // 8
+        head = self._words[head_index]
+        used = head - self._words[tail_index]
+        self._check_used(used)
+        n = min(self._ring_size - used, len(self._out_buffer))
+        if n == 0:
+            return  # the client rings once it read
+        written = 0
+        while written < n:
+            start = self._data(1, head + written)
+            part = min(n - written, ShmConnection.DATA_OFFSET + 2 * self._ring_size - start)
+            self._memory[start:start + part] = self._out_buffer[written:written + part]
+            written += part
+        self._words[head_index] = head + n
+        del self._out_buffer[:n]
+        self._ring_client()
+
+    def wants_write_event(self) -> bool:
+        return False  # the eventfd is always writable, the client rings once it made room instead
+
+    def fileobjs(self) -> list:
+        return [self.socket, self._server_event]
+
+    def close(self) -> None:
+        for view in (self._words, self._flags):
+            if view is not None:
+                view.release()
+        if self._memory is not None:
+            if self._words is not None:
+                closed = struct.unpack_from('<I', self._memory, ShmConnection.CLOSED_OFFSET)[0]
+                struct.pack_into('<I', self._memory, ShmConnection.CLOSED_OFFSET, closed | ShmConnection.CLOSED_SERVER)
+                self._ring_client()
+            self._memory.close()
+        for event in self._events:
+            os.close(event)
+        self._events = []
+        super().close()
@@ -1,3 +1,4 @@
+import os
 import secrets
 from Crypto.PublicKey import RSA
 from Crypto.Cipher import AES, PKCS1_OAEP
@@ -17,6 +18,19 @@ class SingletonMeta(type):
         return cls._instances[cls]
 
 
+class AESDecryptor:
+    """Decrypts one AES-CBC message in pieces of whole blocks, the last one through unpad."""
+
+    def __init__(self, aes_key: bytes, iv: bytes | None = None):
+        self._cipher = AES.new(aes_key, AES.MODE_CBC, iv or bytes(AES.block_size))
+
+    def decrypt(self, data: bytes) -> bytes:
+        return self._cipher.decrypt(data)
+
+    def unpad(self, data: bytes) -> bytes:
+        return unpad(self._cipher.decrypt(data), AES.block_size)
+
+
 class CryptoManager(metaclass=SingletonMeta):
     # Length of a UUID in bytes
     LENGTH_UUID = 16
@@ -24,6 +38,13 @@ class CryptoManager(metaclass=SingletonMeta):
     # Length of an AES key in bytes
     LENGTH_AES = 32
 
+    # Length of an AES block, and so of a CBC IV, in bytes
+    LENGTH_IV = 16
+
+    # Lengths of the AES-GCM nonce and tag of a wrapped key in bytes
+    LENGTH_NONCE = 12
+    LENGTH_TAG = 16
+
     def generate_uuid(self) -> str:
         """Generate a UUID."""
         random_bytes = secrets.token_bytes(CryptoManager.LENGTH_UUID)
@@ -44,7 +65,48 @@ class CryptoManager(metaclass=SingletonMeta):
             print("Error: RSA encryption failed.")
             return None
 
+    def load_master_key(self, path: str) -> bytes:
+        """The server's master key, which wraps the keys of files stored encrypted; created (readable by the owner only)
+        when the file does not exist yet. Server processes starting together all end up with the first one written."""
+        if not os.path.exists(path):
+            temporary_path = f"{path}.{os.getpid()}"
+            with open(os.open(temporary_path, os.O_WRONLY | os.O_CREAT | os.O_TRUNC, 0o600), "wb") as file:
+                file.write(self.generate_aes())
+            try:
+                os.link(temporary_path, path)  # fails if another process was first
+            except FileExistsError:
+                pass
+            finally:
+                os.unlink(temporary_path)
+        with open(path, "rb") as file:
+            master_key = file.read()
+        if len(master_key) != CryptoManager.LENGTH_AES:
+            raise ValueError(f"{path} does not hold a {CryptoManager.LENGTH_AES} byte key")
+        return master_key
+
+    def wrap_key(self, master_key: bytes, key: bytes) -> bytes:
+        """Encrypt and authenticate a key with the master key (AES-GCM): nonce, encrypted key and tag."""
+        nonce = secrets.token_bytes(CryptoManager.LENGTH_NONCE)
+        cipher = AES.new(master_key, AES.MODE_GCM, nonce=nonce)
+        encrypted_key, tag = cipher.encrypt_and_digest(key)
+        return nonce + encrypted_key + tag
+
+    def unwrap_key(self, master_key: bytes, wrapped: bytes) -> bytes:
+        """The key wrap_key wrapped, raises ValueError for another master key or a modified one."""
+        nonce = wrapped[:CryptoManager.LENGTH_NONCE]
+        encrypted_key = wrapped[CryptoManager.LENGTH_NONCE:-CryptoManager.LENGTH_TAG]
+        tag = wrapped[-CryptoManager.LENGTH_TAG:]
+        return AES.new(master_key, AES.MODE_GCM, nonce=nonce).decrypt_and_verify(encrypted_key, tag)
+
     def aes_decrypt(self, encrypted_data: bytes, aes_key: bytes) -> bytes:
-        cipher = AES.new(aes_key, AES.MODE_CBC, bytes(AES.block_size))
-        decrypted = unpad(cipher.decrypt(encrypted_data), AES.block_size)
-        return decrypted
+        return self.aes_decryptor(aes_key).unpad(encrypted_data)
+
+    def aes_decryptor(self, aes_key: bytes, iv: bytes | None = None) -> AESDecryptor:
+        """For content too large to decrypt at once, or decrypted from the middle (iv is the ciphertext block before)."""
+        return AESDecryptor(aes_key, iv)
+
+    def aes_encrypt(self, data: bytes, aes_key: bytes) -> tuple[bytes, bytes]:
+        """Encrypt with AES-CBC under a fresh random IV, so no two messages under one key start alike; returns the IV
+        and the padded ciphertext."""
+        iv = secrets.token_bytes(AES.block_size)
+        return iv, AES.new(aes_key, AES.MODE_CBC, iv).encrypt(pad(data, AES.block_size))
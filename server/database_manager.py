@@ -1,8 +1,10 @@
+import time
 from sqlite3 import *
 from threading import Lock
 
 from client import Client
 from crypto_manager import SingletonMeta, CryptoManager
+from lru_cache import LRUCache
 from request import RequestHeader, RegisterRequest
 from transferred_file import TransferredFile
 
@@ -14,6 +16,14 @@ class DatabaseManager(metaclass=SingletonMeta):
     DB_FILE_NAME = 'defensive.db'
     # Size of the last seen field in bytes
     SIZE_LAST_SEEN = 100
+    # How long (in seconds) a connection waits for another server process to release the database
+    BUSY_TIMEOUT = 30
+    # last_seen updates are coalesced in memory and written in one transaction every interval (in seconds)
+    # or once this many clients have a pending update, whichever comes first
+    LAST_SEEN_FLUSH_INTERVAL = 5
+    LAST_SEEN_BATCH_SIZE = 512
+    # In lazy mode records are read on demand and at most this many clients (and files) are kept in memory
+    LAZY_CACHE_SIZE = 10000
 
     # Create table query for clients
     DB_CREATE_TABLE_CLIENTS_QUERY = f"""
@@ -34,18 +44,52 @@ class DatabaseManager(metaclass=SingletonMeta):
             verified BOOLEAN
         );
     """
+    # Registration looks clients up by name, the unique index also keeps two clients from sharing one
+    DB_CREATE_INDEX_CLIENTS_NAME_QUERY = "CREATE UNIQUE INDEX IF NOT EXISTS clients_name ON clients (name)"
+    DB_CREATE_INDEX_FILES_ID_QUERY = "CREATE INDEX IF NOT EXISTS files_id ON files (id)"
 
     def __init__(self):
-        self.clients = {}
-        self.transferred_files = {}
+        self.clients = LRUCache()
+        self.transferred_files = LRUCache()
         self._sql_connection = None
+        # True when several server processes share the database, the dicts above are then only caches
+        self._shared = False
+        # True when records are read on demand instead of all at startup, the dicts above are then bounded caches
+        self._lazy = False
+        # client id -> last_seen not written yet, they only need to be eventually persistent
+        self._pending_last_seen = {}
+        self._last_flush = time.monotonic()
 
     def _connect(self):
         """Connect to the database."""
         self._sql_connection = connect(
             DatabaseManager.DB_FILE_NAME,
+            timeout=DatabaseManager.BUSY_TIMEOUT,
             check_same_thread=False
         )
+        # WAL makes every commit a single append to the log and lets other server processes keep reading meanwhile
+        self._sql_connection.execute("PRAGMA journal_mode=WAL")
+
+    def _commit(self) -> None:
+        """Commit the current transaction, the pending last_seen updates are written along with it."""
+        if self._pending_last_seen:
+            cursor = self._sql_connection.cursor()
+            cursor.executemany("UPDATE clients SET last_seen = ? WHERE id = ?",
+                               [(last_seen, id) for id, last_seen in self._pending_last_seen.items()])
+            cursor.close()
+            self._pending_last_seen.clear()
+        self._sql_connection.commit()
+        self._last_flush = time.monotonic()
+
+    def flush(self) -> None:
+        """Write the pending last_seen updates in one transaction."""
+        if self._pending_last_seen:
+            self._commit()
+
+    def flush_if_due(self) -> None:
+        """Flush the pending updates if the interval passed, meant to be called periodically from the event loop."""
+        if time.monotonic() - self._last_flush >= DatabaseManager.LAST_SEEN_FLUSH_INTERVAL:
+            self.flush()
 
     def _create_tables(self) -> None:
         """Create tables if they don't exist."""
@@ -53,9 +97,22 @@ class DatabaseManager(metaclass=SingletonMeta):
         cursor = self._sql_connection.cursor()
         cursor.execute(DatabaseManager.DB_CREATE_TABLE_CLIENTS_QUERY)
         cursor.execute(DatabaseManager.DB_CREATE_TABLE_FILES_QUERY)
+        try:
+            cursor.execute(DatabaseManager.DB_CREATE_INDEX_CLIENTS_NAME_QUERY)
+        except IntegrityError:
+            # a database from before the index may hold duplicated names, they still get a (non unique) index
+            print("<Warning>: Client names in the database are not unique, indexing them without the constraint..")
+            cursor.execute("CREATE INDEX IF NOT EXISTS clients_name_non_unique ON clients (name)")
+        cursor.execute(DatabaseManager.DB_CREATE_INDEX_FILES_ID_QUERY)
         cursor.close()
         self._sql_connection.commit()
 
+    def _count(self, table: str) -> int:
+        cursor = self._sql_connection.cursor()
+        count = cursor.execute(f"SELECT COUNT(*) FROM {table}").fetchone()[0]
+        cursor.close()
+        return count
+
     def _load_clients(self) -> None:
         """Load all clients from the database."""
         query = "SELECT id, name, last_seen, rsa_public_key, aes_key FROM clients"
@@ -81,34 +138,78 @@ class DatabaseManager(metaclass=SingletonMeta):
         self._load_clients()
         self._load_files()
 
-    def load_up(self) -> None:
-        """Load up the database"""
+    def load_up(self, shared: bool = False, print_content: bool = True, lazy: bool = False) -> None:
+        """Load up the database, shared means other server processes use it at the same time, lazy that records are
+        only read when a request needs them (kept in an LRU cache) instead of all of them at startup"""
+        self._shared = shared
+        self._lazy = lazy
         self._connect()
         self._create_tables()
+        if lazy:
+            self.clients = LRUCache(DatabaseManager.LAZY_CACHE_SIZE)
+            self.transferred_files = LRUCache(DatabaseManager.LAZY_CACHE_SIZE)
+            if print_content:
+                print(f"<Info>: {self._count('clients')} clients and {self._count('files')} files in the database, "
+                      f"loaded on demand.")
+            return
         self._get_all_data()
-        self.print_clients()
-        self.print_files()
+        if print_content:
+            self.print_clients()
+            self.print_files()
+
+    def _fetch_client(self, client_id: str) -> Client | None:
+        """Re-read a single client from the database, it might have been changed by another server process."""
+        query = "SELECT id, name, last_seen, rsa_public_key, aes_key FROM clients WHERE id = ?"
+        cursor = self._sql_connection.cursor()
+        row = cursor.execute(query, (client_id,)).fetchone()
+        cursor.close()
+        if row:
+            self.clients[client_id] = Client(*row)
+            return self.clients[client_id]
+        return None
+
+    def _fetch_file(self, path_name: str) -> TransferredFile | None:
+        """Read a single file from the database."""
+        query = "SELECT id, name, path_name, verified FROM files WHERE path_name = ?"
+        cursor = self._sql_connection.cursor()
+        row = cursor.execute(query, (path_name,)).fetchone()
+        cursor.close()
+        if row:
+            self.transferred_files[path_name] = TransferredFile(*row)
+            return self.transferred_files[path_name]
+        return None
 
     def _client_exists(self, client_id: str) -> bool:
-        return client_id in self.clients
+        return client_id in self.clients or (
+                (self._shared or self._lazy) and self._fetch_client(client_id) is not None)
+
+    def _file_exists(self, path_name: str) -> bool:
+        return path_name in self.transferred_files or (
+                (self._shared or self._lazy) and self._fetch_file(path_name) is not None)
 
     def get_client(self, id: str, name: str) -> Client | None:
         """Matches a client from the database using its name and ID together."""
-        if id in self.clients and name == self.clients[id].get_name():
+        if self._shared:
+            self._fetch_client(id)
+        if self._client_exists(id) and name == self.clients[id].get_name():
             return self.clients[id]
         return None
 
     def _check_client_name_exists(self, name: str) -> bool:
-        """Check if a client name exists in the database."""
-        for client in self.clients.values():
-            if client.get_name() == name:
-                return True
-        return False
+        """Check if a client name exists in the database (an index lookup)."""
+        cursor = self._sql_connection.cursor()
+        row = cursor.execute("SELECT 1 FROM clients WHERE name = ?", (name,)).fetchone()
+        cursor.close()
+        return row is not None
 
     def create_client(self, name: str, last_seen: str) -> str | None:
         """Create a new client in the database."""
 
+        if self._shared:
+            # holds the write lock from the name check until the commit, so two processes can't take the same name
+            self._sql_connection.execute("BEGIN IMMEDIATE")
         if self._check_client_name_exists(name):  # 2 clients cannot have same name
+            self._sql_connection.rollback()
             return None
 
         new_id = CryptoManager().generate_uuid()
@@ -117,14 +218,19 @@ class DatabaseManager(metaclass=SingletonMeta):
         while self._client_exists(new_id):
             new_id = CryptoManager().generate_uuid()
 
-        self.clients[new_id] = Client(new_id, name, last_seen)
         cursor = self._sql_connection.cursor()
-        cursor.execute(
-            "INSERT INTO clients (id, name, last_seen, rsa_public_key, aes_key) VALUES (?, ?, ?, ?, ?)",
-            (new_id, name, last_seen, None, None)
-        )
-        cursor.close()
-        self._sql_connection.commit()
+        try:
+            cursor.execute(
+                "INSERT INTO clients (id, name, last_seen, rsa_public_key, aes_key) VALUES (?, ?, ?, ?, ?)",
+                (new_id, name, last_seen, None, None)
+            )
+        except IntegrityError:  # the unique name index, should another process have taken the name meanwhile
+            self._sql_connection.rollback()
+            return None
+        finally:
+            cursor.close()
+        self.clients[new_id] = Client(new_id, name, last_seen)
+        self._commit()
         return new_id
 
     def create_file(self, id: str, file_name: str) -> bool:
@@ -139,37 +245,42 @@ class DatabaseManager(metaclass=SingletonMeta):
         cursor.execute("INSERT OR REPLACE INTO files (id, name, path_name, verified) VALUES (?, ?, ?, ?)",
                        (id, file_name, file_path, False))
         cursor.close()
-        self._sql_connection.commit()
+        self._commit()
         return True
 
     def print_clients(self) -> None:
-        msg = "~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~\n"
-        msg += "~~~~~~~ Current clients in database ~~~~~~~\n"
-        msg += "~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~\n"
+        # one record at a time, so the output is never built as one string
+        print("~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~\n"
+              "~~~~~~~ Current clients in database ~~~~~~~\n"
+              "~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~")
         for client in list(self.clients.values()):
-            msg += str(client)
-            msg += "\n~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~\n"
-        msg += "Printed all clients in the database.\n"
-        print(msg)
+            print(client)
+            print("~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~")
+        print("Printed all clients in the database.\n")
 
     def print_files(self) -> None:
-        msg = "~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~\n"
-        msg += "~~~~~~~ Current files in database ~~~~~~~\n"
-        msg += "~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~\n"
+        print("~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~\n"
+              "~~~~~~~ Current files in database ~~~~~~~\n"
+              "~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~")
         for file in list(self.transferred_files.values()):
-            msg += str(file)
-            msg += "\n~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~\n"
-        msg += "Printed all files in the database.\n"
-        print(msg)
+            print(file)
+            print("~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~")
+        print("Printed all files in the database.\n")
 
     def verify_file(self, path_name: str) -> None:
         """Verify a file in the database."""
-        if path_name in self.transferred_files:
+        if self._file_exists(path_name):
             self.transferred_files[path_name].set_verified(True)
             cursor = self._sql_connection.cursor()
             cursor.execute("UPDATE files SET verified = ? WHERE path_name = ?", (True, path_name))
             cursor.close()
-            self._sql_connection.commit()
+            self._commit()
+
+    def is_file_verified(self, path_name: str) -> bool:
+        """Whether the client confirmed the file's checksum, only those can be downloaded."""
+        if self._shared:
+            self._fetch_file(path_name)  # another server process may have verified it
+        return self._file_exists(path_name) and bool(self.transferred_files[path_name].verified)
 
     def update_aes_key(self, id: str, aes_key: bytes) -> None:
         """Update the AES key of a client."""
@@ -178,10 +289,13 @@ class DatabaseManager(metaclass=SingletonMeta):
             cursor = self._sql_connection.cursor()
             cursor.execute("UPDATE clients SET aes_key = ? WHERE id = ?", (aes_key, id))
             cursor.close()
-            self._sql_connection.commit()
+            self._commit()
 
     def get_aes_key(self, id: str) -> bytes | None:
-        if id in self.clients:
+        """The client's AES key from its last handshake, which may have been with another server process."""
+        if self._shared:
+            self._fetch_client(id)  # a download's extra connections skip the handshake and may land on this process
+        if self._client_exists(id):
             return self.clients[id].get_aes_key()
         return None
 
@@ -192,13 +306,12 @@ class DatabaseManager(metaclass=SingletonMeta):
             cursor = self._sql_connection.cursor()
             cursor.execute("UPDATE clients SET rsa_public_key = ? WHERE id = ?", (rsa_public_key, id))
             cursor.close()
-            self._sql_connection.commit()
+            self._commit()
 
     def update_last_seen(self, id: str, last_seen: str) -> None:
-        """Update the last seen of a client."""
+        """Update the last seen of a client, it's written to the database with the next batch."""
         if self._client_exists(id):
             self.clients[id].set_last_seen(last_seen)
-            cursor = self._sql_connection.cursor()
-            cursor.execute("UPDATE clients SET last_seen = ? WHERE id = ?", (last_seen, id))
-            cursor.close()
-            self._sql_connection.commit()
+            self._pending_last_seen[id] = last_seen
+            if len(self._pending_last_seen) >= DatabaseManager.LAST_SEEN_BATCH_SIZE:
+                self.flush()
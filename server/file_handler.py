@@ -1,35 +1,285 @@
 from crypto_manager import SingletonMeta
+import hashlib
+import json
 import os
+import shutil
 
 
 class FileHandler(metaclass=SingletonMeta):
     # root directory where transferred files are stored
     ROOT_DIR = 'transferred_files'
+    # files are spread over SHARD_LEVELS levels of 256 directories each by the hash of (client id, file name), so no
+    # directory grows with the number of clients or files; the files table maps each file to its path
+    SHARD_LEVELS = 2
+    SHARD_WIDTH = 2  # hex characters per level
+    # bytes decrypted at once, a whole number of AES blocks
+    DECRYPT_BLOCK_SIZE = 1 << 20
+    DECRYPTING_SUFFIX = '.decrypting'
+    # next to a file stored encrypted: its key wrapped with the master key, its size and zero ranges (JSON)
+    ENVELOPE_SUFFIX = '.envelope'
 
-    def get_path(self, clientid: str, file_name: str):
-        """Get the path of the file."""
-        return os.path.join(FileHandler.ROOT_DIR, clientid, file_name)
+    def __init__(self):
+        # zero ranges (offset, length) of the file being received, by (client id, file name), see SendZeroRangesRequest
+        self._zero_ranges: dict[tuple[str, str], list[tuple[int, int]]] = {}
+        # set in store-encrypted mode: files are kept as received and their keys wrapped with it, see seal_file
+        self.master_key: bytes | None = None
 
-    def save_in_dir(self, client_id: str, file_name: str, content: bytes, mode: str = "wb") -> None:
-        """Save the file in the directory."""
+    @staticmethod
+    def _hash(client_id: str, file_name: str) -> str:
+        return hashlib.sha256(f"{client_id}/{file_name}".encode()).hexdigest()
 
+    def get_path(self, clientid: str, file_name: str):
+        """Get the path of the file: transferred_files/<h[0:2]>/<h[2:4]>/<h> with h the hash of the client id and name."""
         # protection against directory traversal attacks for e.g. ../../../../some/important/file, will take file
-        file_name = os.path.basename(file_name)
-        os.makedirs(FileHandler.ROOT_DIR, exist_ok=True)
-
-        client_dir_path = os.path.join(FileHandler.ROOT_DIR, client_id)
-        os.makedirs(client_dir_path, exist_ok=True)
+        digest = FileHandler._hash(clientid, os.path.basename(file_name))
+        shards = [digest[level * FileHandler.SHARD_WIDTH:(level + 1) * FileHandler.SHARD_WIDTH]
+                  for level in range(FileHandler.SHARD_LEVELS)]
+        return os.path.join(FileHandler.ROOT_DIR, *shards, digest)
 
-        file_path = os.path.join(client_dir_path, file_name)
+    def save_in_dir(self, client_id: str, file_name: str, content: bytes, mode: str = "wb",
+                    offset: int | None = None) -> None:
+        """Save the file in the directory, its shard directories are only created with the first packet. With an offset
+        (protocol 4) a later packet is written at that position of the file instead of appended."""
+        file_path = self.get_path(client_id, file_name)
+        if mode == "wb":
+            os.makedirs(os.path.dirname(file_path), exist_ok=True)
+        elif offset is not None:
+            mode = "r+b"
         with open(file_path, mode) as file:
+            if offset is not None and mode == "r+b":
+                file.seek(offset)
             file.write(content)
 
-    def decrypt_file(self, file_path: str, aes_key: bytes) -> None:
-        """Decrypt the file and override encrypted content with decrypted content."""
+    def add_zero_ranges(self, client_id: str, file_name: str, first_index: int,
+                        ranges: list[tuple[int, int]]) -> bool:
+        """Append a batch of the file's zero ranges, first index 0 starts over. False (and the file's ranges dropped) when
+        the batch does not continue the list or its ranges are not sorted and apart."""
+        key = (client_id, file_name)
+        known = [] if first_index == 0 else self._zero_ranges.get(key, [])
+        end = known[-1][0] + known[-1][1] if known else 0
+        for offset, length in ranges:
+            if offset < end or length == 0:
+                first_index = -1
+                break
+            end = offset + length
+        if first_index != len(known):
+            self._zero_ranges.pop(key, None)
+            return False
+        self._zero_ranges[key] = known + ranges
+        return True
+
+    def take_zero_ranges(self, client_id: str, file_name: str) -> list[tuple[int, int]]:
+        """The file's zero ranges, for its last packet, each attempt sends them again."""
+        return self._zero_ranges.pop((client_id, file_name), [])
+
+    def has_legacy_layout(self) -> bool:
+        """True when the root still holds transferred_files/<client_id>/<file_name> directories (see migrate_layout.py)."""
+        if not os.path.isdir(FileHandler.ROOT_DIR):
+            return False
+        with os.scandir(FileHandler.ROOT_DIR) as entries:
+            return any(entry.is_dir() and len(entry.name) != FileHandler.SHARD_WIDTH for entry in entries)
+
+    def _decrypt_into(self, file_path: str, aes_key: bytes, out, zero_ranges: list[tuple[int, int]] | None) -> None:
+        """Decrypt the file a block at a time into out (written and seeked like a file), around the zero ranges."""
+        from crypto_manager import CryptoManager
+        decryptor = CryptoManager().aes_decryptor(aes_key)
+        writer = _SparseWriter(out, zero_ranges or [])
+        with open(file_path, "rb") as file:
+            previous = b""
+            while block := file.read(FileHandler.DECRYPT_BLOCK_SIZE):
+                writer.write(decryptor.decrypt(previous))
+                previous = block
+            writer.write(decryptor.unpad(previous))  # the last block holds the padding
+
+    def decrypt_file(self, file_path: str, aes_key: bytes, zero_ranges: list[tuple[int, int]] | None = None,
+                     original_size: int = 0) -> None:
+        """Decrypt the file and override encrypted content with decrypted content. It is decrypted a block at a time
+        into a file next to it that then replaces it, so files larger than memory work. The zero ranges were left out of
+        the encrypted stream: the decrypted data is written around them, seeking over a range leaves a hole, and the file
+        is truncated to its original size, so a sparse file takes the space of its data."""
+        decrypted_path = file_path + FileHandler.DECRYPTING_SUFFIX
+        with open(decrypted_path, "wb") as final_file:
+            self._decrypt_into(file_path, aes_key, final_file, zero_ranges)
+            if zero_ranges:
+                final_file.truncate(original_size)  # the ranges at the end
+        os.replace(decrypted_path, file_path)
+        if os.path.exists(file_path + FileHandler.ENVELOPE_SUFFIX):  # the file was stored encrypted before
+            os.remove(file_path + FileHandler.ENVELOPE_SUFFIX)
+
+    def verify_encrypted(self, file_path: str, aes_key: bytes, algorithm: int,
+                         zero_ranges: list[tuple[int, int]] | None = None) -> int:
+        """Checksum of the plaintext of a received file, decrypted into the checksum only: one read, nothing written."""
+        import checksums
+        checksum = _ChecksumWriter(checksums.Running(algorithm))
+        self._decrypt_into(file_path, aes_key, checksum, zero_ranges)
+        return checksum.value()
+
+    def seal_file(self, file_path: str, master_key: bytes, aes_key: bytes, zero_ranges: list[tuple[int, int]] | None,
+                  original_size: int) -> None:
+        """Keep the received file encrypted: write its envelope, with its key wrapped with the master key, since the
+        client's key in the database changes with every reconnect."""
         from crypto_manager import CryptoManager
-        crypto_manager = CryptoManager()
+        envelope = {
+            "key": CryptoManager().wrap_key(master_key, aes_key).hex(),
+            "size": original_size,
+            "zero_ranges": zero_ranges or [],
+        }
+        envelope_path = file_path + FileHandler.ENVELOPE_SUFFIX
+        with open(envelope_path + FileHandler.DECRYPTING_SUFFIX, "w") as file:
+            json.dump(envelope, file)
+        os.replace(envelope_path + FileHandler.DECRYPTING_SUFFIX, envelope_path)
+
+    def is_sealed(self, file_path: str) -> bool:
+        return os.path.exists(file_path + FileHandler.ENVELOPE_SUFFIX)
+
+    def export_plain(self, file_path: str, out_path: str, master_key: bytes | None = None) -> None:
+        """Write the plaintext of a stored file to out_path; a file stored encrypted is decrypted now (zero ranges left
+        as holes), which needs the master key it was sealed with."""
+        if not self.is_sealed(file_path):
+            shutil.copyfile(file_path, out_path)
+            return
+        envelope = self._read_envelope(file_path)
+        aes_key = self._unwrap(file_path, envelope, master_key)
+        with open(out_path, "wb") as out:
+            self._decrypt_into(file_path, aes_key, out, envelope["zero_ranges"])
+            out.truncate(envelope["size"])
+
+    def stat_stored(self, file_path: str) -> tuple[int, int, int]:
+        """Size of the plaintext of a stored file, the bytes of it outside zero ranges (holes, for a file stored
+        decrypted) and the file's modification time in nanoseconds, for a download."""
+        modified = os.stat(file_path).st_mtime_ns
+        if self.is_sealed(file_path):
+            envelope = self._read_envelope(file_path)
+            return envelope["size"], envelope["size"] - sum(length for _, length in envelope["zero_ranges"]), modified
+        return os.path.getsize(file_path), FileHandler._data_size(file_path), modified
+
+    def read_plain(self, file_path: str, offset: int, length: int, master_key: bytes | None = None) -> bytes:
+        """Up to length bytes of the plaintext of a stored file from offset, nothing past its end. Of a file stored
+        encrypted only the range is decrypted: the zero ranges are not in its ciphertext, and CBC decrypts from any
+        block given the one before it."""
+        if not self.is_sealed(file_path):
+            with open(file_path, "rb") as file:
+                file.seek(offset)
+                return file.read(length)
+        envelope = self._read_envelope(file_path)
+        end = min(offset + length, envelope["size"])
+        if offset >= end:
+            return b""
+        aes_key = self._unwrap(file_path, envelope, master_key)
+        plain = bytearray(end - offset)  # the zero ranges stay as they are
         with open(file_path, "rb") as file:
-            content = file.read()
-            decrypted = crypto_manager.aes_decrypt(content, aes_key)
-            with open(file_path, "wb") as final_file:
-                final_file.write(decrypted)
+            for start, stop, data_offset in _data_segments(envelope["zero_ranges"], offset, end):
+                plain[start - offset:stop - offset] = FileHandler._decrypt_range(file, aes_key, data_offset, stop - start)
+        return bytes(plain)
+
+    @staticmethod
+    def _read_envelope(file_path: str) -> dict:
+        with open(file_path + FileHandler.ENVELOPE_SUFFIX) as file:
+            envelope = json.load(file)
+        envelope["zero_ranges"] = [tuple(zero_range) for zero_range in envelope["zero_ranges"]]
+        return envelope
+
+    @staticmethod
+    def _unwrap(file_path: str, envelope: dict, master_key: bytes | None) -> bytes:
+        from crypto_manager import CryptoManager
+        if master_key is None:
+            raise ValueError(f"{file_path} is stored encrypted, its master key is needed")
+        return CryptoManager().unwrap_key(master_key, bytes.fromhex(envelope["key"]))
+
+    @staticmethod
+    def _decrypt_range(file, aes_key: bytes, data_offset: int, length: int) -> bytes:
+        """length bytes from data_offset of the decrypted stream of an encrypted file, read from the AES block before."""
+        from crypto_manager import CryptoManager
+        block_size = CryptoManager.LENGTH_IV
+        first = data_offset - data_offset % block_size
+        iv = None
+        if first:
+            file.seek(first - block_size)
+            iv = file.read(block_size)
+        file.seek(first)
+        ciphertext = file.read(-(-(data_offset + length) // block_size) * block_size - first)  # whole blocks
+        plain = CryptoManager().aes_decryptor(aes_key, iv).decrypt(ciphertext)
+        return plain[data_offset - first:data_offset - first + length]
+
+    @staticmethod
+    def _data_size(file_path: str) -> int:
+        """Bytes of the file outside its holes, all of them where the file system does not tell (SEEK_DATA)."""
+        size = os.path.getsize(file_path)
+        if not hasattr(os, "SEEK_DATA"):
+            return size
+        data_size = 0
+        with open(file_path, "rb") as file:
+            position = 0
+            while position < size:
+                try:
+                    start = os.lseek(file.fileno(), position, os.SEEK_DATA)
+                except OSError:  # ENXIO, only a hole is left
+                    break
+                position = os.lseek(file.fileno(), start, os.SEEK_HOLE)
+                data_size += min(position, size) - start
+        return data_size
+
+
+def _data_segments(zero_ranges: list[tuple[int, int]], offset: int, end: int) -> list[tuple[int, int, int]]:
+    """The parts (start, stop) of [offset, end) of a file outside its zero ranges, each with the offset of start in the
+    file's stream without the ranges."""
+    segments = []
+    skipped = 0  # zero range bytes before position
+    position = 0
+    for zero_offset, zero_length in [*zero_ranges, (end, 0)]:
+        start, stop = max(position, offset), min(zero_offset, end)
+        if start < stop:
+            segments.append((start, stop, start - skipped))
+        if zero_offset >= end:
+            break
+        skipped += zero_length
+        position = zero_offset + zero_length
+    return segments
+
+
+class _ChecksumWriter:
+    """Takes the decrypted stream like a file would, a seek over a zero range feeds the zeros."""
+
+    def __init__(self, checksum):
+        self._checksum = checksum
+        self._position = 0
+
+    def write(self, data) -> None:
+        self._checksum.update(data)
+        self._position += len(data)
+
+    def seek(self, position: int) -> None:
+        self._checksum.update_zeros(position - self._position)
+        self._position = position
+
+    def value(self) -> int:
+        return self._checksum.value()
+
+
+class _SparseWriter:
+    """Writes the decrypted stream into the file between the zero ranges (sorted and apart, see add_zero_ranges)."""
+
+    def __init__(self, file, zero_ranges: list[tuple[int, int]]):
+        self._file = file
+        self._zero_ranges = zero_ranges
+        self._next = 0
+        self._position = 0
+
+    def _skip_zero_ranges(self) -> None:
+        while self._next < len(self._zero_ranges) and self._zero_ranges[self._next][0] == self._position:
+            self._position += self._zero_ranges[self._next][1]
+            self._next += 1
+            self._file.seek(self._position)
+
+    def write(self, data: bytes) -> None:
+        view = memoryview(data)
+        while True:
+            self._skip_zero_ranges()
+            if not view:
+                return
+            length = len(view)
+            if self._next < len(self._zero_ranges):
+                length = min(length, self._zero_ranges[self._next][0] - self._position)
+            self._file.write(view[:length])
+            self._position += length
+            view = view[length:]
@@ -0,0 +1,40 @@
+"""CPU-bound stages handed to the WorkerPool, kept at module level so worker processes can unpickle them."""
+import checksums
+from crypto_manager import CryptoManager
+from file_handler import FileHandler
+
+
+def rsa_encrypt(public_key: bytes, data: bytes) -> bytes | None:
+    """Encrypt data (the AES key) with the client's RSA public key."""
+    return CryptoManager().rsa_encrypt(public_key, data)
+
+
+def finalize_file(file_path: str, aes_key: bytes, algorithm: int = checksums.CKSUM,
+                  zero_ranges: list[tuple[int, int]] | None = None, original_size: int = 0,
+                  master_key: bytes | None = None) -> int:
+    """Decrypt a fully received file in place, recreating its zero ranges as holes, and return its checksum with the
+    negotiated algorithm. With a master key (store-encrypted mode) the file stays encrypted instead: it is decrypted
+    into the checksum only and sealed, see FileHandler.seal_file."""
+    file_handler = FileHandler()
+    if master_key:
+        checksum = file_handler.verify_encrypted(file_path, aes_key, algorithm, zero_ranges)
+        file_handler.seal_file(file_path, master_key, aes_key, zero_ranges, original_size)
+        return checksum
+    file_handler.decrypt_file(file_path, aes_key, zero_ranges, original_size)
+    return checksums.calculate(file_path, algorithm)
+
+
+def read_range(file_path: str, offset: int, length: int, algorithm: int, aes_key: bytes,
+               master_key: bytes | None = None) -> tuple[int, int, bytes, bytes] | None:
+    """Read up to length bytes of a stored file's plaintext from offset for a download, and return their length,
+    checksum, and encryption with the client's AES key (IV and ciphertext, both empty for a range of zeros). None when
+    offset is not inside the file."""
+    plain = FileHandler().read_plain(file_path, offset, length, master_key)
+    if not plain:
+        return None
+    checksum = checksums.Running(algorithm)
+    checksum.update(plain)
+    if plain.count(0) == len(plain):  # a hole or zero range, usually
+        return len(plain), checksum.value(), b"", b""
+    iv, ciphertext = CryptoManager().aes_encrypt(plain, aes_key)
+    return len(plain), checksum.value(), iv, ciphertext
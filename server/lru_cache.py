@@ -0,0 +1,22 @@
+from collections import OrderedDict
+
+
+class LRUCache(OrderedDict):
+    """A dict that keeps at most capacity entries, dropping the least recently used one (no capacity: unbounded)."""
+
+    def __init__(self, capacity: int | None = None):
+        super().__init__()
+        self.capacity = capacity
+
+    def __getitem__(self, key):
+        value = super().__getitem__(key)
+        if self.capacity is not None:
+            self.move_to_end(key)
+        return value
+
+    def __setitem__(self, key, value):
+        super().__setitem__(key, value)
+        if self.capacity is not None:
+            self.move_to_end(key)
+            while len(self) > self.capacity:
+                self.popitem(last=False)
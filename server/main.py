@@ -1,13 +1,82 @@
+import argparse
+import multiprocessing
+import signal
+import socket
+import sys
+
 from port_retriever import PortRetriever
 from server import Server
 
 
+def exit_on_terminate() -> None:
+    """Turn SIGTERM into SystemExit, so the worker pools are shut down on the way out."""
+    signal.signal(signal.SIGTERM, lambda signum, frame: sys.exit(0))
+
+
+def run_server(host: str, port: int, workers: int, worker_index: int, lazy_db: bool, unix_path: str | None,
+               master_key_path: str | None):
+    """Entry point of a single server process."""
+    exit_on_terminate()
+    try:
+        server = Server(host, port, workers, worker_index, lazy_db, unix_path, master_key_path)
+        server.start()
+
+    except Exception as e:
+        print('An error occurred:', e)
+
+
+def run_workers(host: str, port: int, workers: int, lazy_db: bool, unix_path: str | None,
+                master_key_path: str | None):
+    """Start the server processes, they all bind the same port and the kernel spreads the clients between them. A path
+    cannot be shared that way, so only the first process listens on the Unix domain socket."""
+    context = multiprocessing.get_context('spawn')
+    processes = [context.Process(target=run_server, args=(host, port, workers, index, lazy_db,
+                                                          unix_path if index == 0 else None, master_key_path))
+                 for index in range(workers)]
+    for process in processes:
+        process.start()
+    try:
+        for process in processes:
+            process.join()
+    except (KeyboardInterrupt, SystemExit):
+        for process in processes:
+            process.terminate()
+
+
 def main():
+    parser = argparse.ArgumentParser(description='gyf secure file transfer server')
+    parser.add_argument('--workers', type=int, default=1,
+                        help='number of server processes sharing the port through SO_REUSEPORT (default: 1)')
+    parser.add_argument('--lazy-db', action='store_true',
+                        help='read clients and files from the database on demand (LRU cached) instead of all at startup')
+    parser.add_argument('--unix', metavar='PATH',
+                        help='also listen on this Unix domain socket, for clients on the same host '
+                             '(unix:PATH or shm:PATH in their transfer.info)')
+    parser.add_argument('--store-encrypted', action='store_true',
+                        help='keep received files encrypted at rest, checked by decrypting them into the checksum only '
+                             '(export them with retrieve.py)')
+    parser.add_argument('--master-key', metavar='PATH', default='master.key',
+                        help='the key that wraps the keys of files stored encrypted, created if missing '
+                             '(default: master.key)')
+    args = parser.parse_args()
+    exit_on_terminate()
     try:
         server_host = 'localhost'  # I set this deterministically
         port = PortRetriever().get_port()
-        server = Server(server_host, port)
-        server.start()
+        workers = max(1, args.workers)
+        if workers > 1 and not hasattr(socket, 'SO_REUSEPORT'):
+            print('<Warning>: SO_REUSEPORT is not supported on this platform, running a single server process..')
+            workers = 1
+        if args.unix and not hasattr(socket, 'AF_UNIX'):
+            print('<Warning>: Unix domain sockets are not supported on this platform, listening on TCP only..')
+            args.unix = None
+        master_key_path = args.master_key if args.store_encrypted else None
+        if workers == 1:
+            server = Server(server_host, port, lazy_db=args.lazy_db, unix_path=args.unix,
+                            master_key_path=master_key_path)
+            server.start()
+        else:
+            run_workers(server_host, port, workers, args.lazy_db, args.unix, master_key_path)
 
     except Exception as e:
         print('An error occurred:', e)
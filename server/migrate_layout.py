@@ -0,0 +1,80 @@
+"""
+One-time migration of transferred_files from the old transferred_files/<client_id>/<file_name> layout to the sharded
+one of FileHandler.get_path, updating the path of every moved file in the files table. Run it from the server directory
+while the server is stopped; it can be interrupted and run again, files already moved are not touched.
+
+usage: python migrate_layout.py [--dry-run]
+"""
+import argparse
+import os
+from sqlite3 import connect
+
+from database_manager import DatabaseManager
+from file_handler import FileHandler
+
+# moved paths are written to the files table in transactions of this many
+COMMIT_BATCH_SIZE = 1000
+
+
+def legacy_files():
+    """(client id, file name, old path) of every file still in the old layout."""
+    with os.scandir(FileHandler.ROOT_DIR) as clients:
+        for client in clients:
+            if not client.is_dir() or len(client.name) == FileHandler.SHARD_WIDTH:
+                continue
+            with os.scandir(client.path) as files:
+                for file in files:
+                    if file.is_file():
+                        yield client.name, file.name, file.path
+
+
+def migrate(dry_run: bool) -> None:
+    if not os.path.isdir(FileHandler.ROOT_DIR):
+        print(f"<Info>: No {FileHandler.ROOT_DIR} directory, nothing to migrate.")
+        return
+    file_handler = FileHandler()
+    sql_connection = connect(DatabaseManager.DB_FILE_NAME, timeout=DatabaseManager.BUSY_TIMEOUT)
+    moved = 0
+    try:
+        for client_id, file_name, old_path in legacy_files():
+            new_path = file_handler.get_path(client_id, file_name)
+            if dry_run:
+                print(f"{old_path} -> {new_path}")
+            elif os.path.exists(new_path):  # sent again since the upgrade, the newer copy wins
+                os.remove(old_path)
+                sql_connection.execute("DELETE FROM files WHERE id = ? AND name = ? AND path_name != ?",
+                                       (client_id, file_name, new_path))
+            else:
+                os.makedirs(os.path.dirname(new_path), exist_ok=True)
+                os.replace(old_path, new_path)
+                # by client and name, the old paths were written with the separator of the platform of the time
+                sql_connection.execute("UPDATE OR REPLACE files SET path_name = ? WHERE id = ? AND name = ?",
+                                       (new_path, client_id, file_name))
+            moved += 1
+            if moved % COMMIT_BATCH_SIZE == 0:
+                sql_connection.commit()
+                print(f"<Info>: {moved} files moved..")
+        sql_connection.commit()
+    finally:
+        sql_connection.close()
+    if not dry_run:
+        # the old client directories are empty by now
+        with os.scandir(FileHandler.ROOT_DIR) as clients:
+            for client in clients:
+                if client.is_dir() and len(client.name) != FileHandler.SHARD_WIDTH:
+                    try:
+                        os.rmdir(client.path)
+                    except OSError:
+                        print(f"<Warning>: {client.path} is not empty, left in place.")
+    print(f"<Info>: {moved} files {'would be' if dry_run else 'were'} moved to the sharded layout.")
+
+
+def main():
+    parser = argparse.ArgumentParser(description='move transferred files to the sharded layout')
+    parser.add_argument('--dry-run', action='store_true', help='only print what would be moved')
+    args = parser.parse_args()
+    migrate(args.dry_run)
+
+
+if __name__ == '__main__':
+    main()
@@ -1,11 +1,12 @@
-import socket
 import struct
 from selectors import DefaultSelector
 
+from connection import Connection
 from crypto_manager import CryptoManager
 from protocol_handler import ProtocolHandler
 from request import Request, RequestHeader, RegisterRequest, SendPublicKeyRequest, ReconnectRequest, SendFileRequest, \
-    CRCOkRequest, CRCNotOkRequest, CRCTerminateRequest
+    NegotiateChecksumRequest, SendZeroRangesRequest, FileInfoRequest, ReadRangeRequest, CRCOkRequest, CRCNotOkRequest, \
+    CRCTerminateRequest
 from response import Response
 from transferred_file import TransferredFile
 
@@ -16,69 +17,70 @@ class NetworkManager:
         self._protocol_handler = ProtocolHandler()
         self._crypto_manager = CryptoManager()
 
-    def close_connection(self, selector: DefaultSelector, connection: socket.socket, reason: str):
+    def close_connection(self, selector: DefaultSelector, connection: Connection, reason: str):
         """Handle connection closure and cleanup."""
         print(f"<Info>: A connection is being closed, reason: {reason}")
-        print(f"<Info>: Connection closed: {connection}")
-        selector.unregister(connection)
+        print(f"<Info>: Connection closed: {connection.socket}")
+        for fileobj in connection.fileobjs():
+            selector.unregister(fileobj)
         connection.close()
 
     def is_valid_header(self, header: RequestHeader) -> bool:
         """Check if the request header is valid."""
         return self._protocol_handler.is_valid_request_code(header.code)
 
-    def get_header(self, selector: DefaultSelector, connection: socket.socket) -> RequestHeader | None:
-        """Retrieve and unpack the request header from a connection."""
-        try:
-            header_raw_data = connection.recv(RequestHeader.SIZE)
-
-            if not header_raw_data[:RequestHeader.SIZE_CLIENT_ID]:
-                self.close_connection(selector, connection, "Client left the server (no data received)")
-                return None
-
-            return self._protocol_handler.unpack_request_header(header_raw_data)
-
-        except (ConnectionResetError, ConnectionAbortedError):
-            self.close_connection(selector, connection, "Connection error")
-            return None
-
     def create_failure_response(self) -> Response:
         return self._protocol_handler.create_failure_response()
 
-    def send_response(self, connection: socket.socket, response: Response) -> None:
-        """Send a response to the client."""
-        connection.send(response.create_packet())
+    def send_response(self, connection: Connection, response: Response) -> None:
+        """Queue a response to the client, whatever the socket does not take now is flushed on EVENT_WRITE."""
+        connection.queue(response.create_packet())
 
-    def get_register_payload(self, connection: socket.socket, header: RequestHeader) -> Request:
-        raw_data = connection.recv(RegisterRequest.SIZE_CLIENT_NAME)
+    def get_register_payload(self, payload: bytes, header: RequestHeader) -> Request:
+        raw_data = payload[:RegisterRequest.SIZE_CLIENT_NAME]
         client_name = self._protocol_handler.remove_null(raw_data).decode()
         return RegisterRequest(header, client_name)
 
-    def get_public_key_payload(self, connection: socket.socket, header: RequestHeader) -> Request:
-        raw_data = connection.recv(SendPublicKeyRequest.SIZE_CLIENT_NAME)
+    def get_public_key_payload(self, payload: bytes, header: RequestHeader) -> Request:
+        raw_data = payload[:SendPublicKeyRequest.SIZE_CLIENT_NAME]
         client_name = self._protocol_handler.remove_null(raw_data).decode()
-        public_key = connection.recv(SendPublicKeyRequest.SIZE_PUBLIC_KEY)
+        public_key = payload[SendPublicKeyRequest.SIZE_CLIENT_NAME:
+                             SendPublicKeyRequest.SIZE_CLIENT_NAME + SendPublicKeyRequest.SIZE_PUBLIC_KEY]
         return SendPublicKeyRequest(header, client_name, public_key)
 
-    def get_reconnect_payload(self, connection: socket.socket, header: RequestHeader) -> Request:
-        raw_data = connection.recv(RegisterRequest.SIZE_CLIENT_NAME)
+    def get_reconnect_payload(self, payload: bytes, header: RequestHeader) -> Request:
+        raw_data = payload[:RegisterRequest.SIZE_CLIENT_NAME]
         client_name = self._protocol_handler.remove_null(raw_data).decode()
         return ReconnectRequest(header, client_name)
 
-    def get_send_file_payload(self, connection: socket.socket, header: RequestHeader) -> Request:
-        pre_file_name_and_content_size = (SendFileRequest.SIZE_CONTENT_SIZE +
-                                          SendFileRequest.SIZE_ORIGINAL_FILE_SIZE +
-                                          SendFileRequest.SIZE_PACKET_NUMBER +
-                                          SendFileRequest.SIZE_TOTAL_PACKETS)
-        raw_data = connection.recv(pre_file_name_and_content_size)
-        (content_size,
-         original_file_size,
-         packet_number,
-         total_packets) = struct.unpack(SendFileRequest.UNPACK_PRE_FILE_NAME_AND_CONTENT_STRUCT, raw_data)
-        raw_data = connection.recv(SendFileRequest.SIZE_FILE_NAME)
+    def get_send_file_payload(self, payload: bytes, header: RequestHeader) -> Request:
+        offset = None
+        if header.client_version >= SendFileRequest.LARGE_FILES_VERSION:
+            pre_file_name_and_content_size = (SendFileRequest.SIZE_CONTENT_SIZE_V4 +
+                                              SendFileRequest.SIZE_ORIGINAL_FILE_SIZE_V4 +
+                                              SendFileRequest.SIZE_OFFSET_V4 +
+                                              SendFileRequest.SIZE_PACKET_NUMBER_V4 +
+                                              SendFileRequest.SIZE_TOTAL_PACKETS_V4)
+            (content_size,
+             original_file_size,
+             offset,
+             packet_number,
+             total_packets) = struct.unpack(SendFileRequest.UNPACK_PRE_FILE_NAME_AND_CONTENT_STRUCT_V4,
+                                            payload[:pre_file_name_and_content_size])
+        else:
+            pre_file_name_and_content_size = (SendFileRequest.SIZE_CONTENT_SIZE +
+                                              SendFileRequest.SIZE_ORIGINAL_FILE_SIZE +
+                                              SendFileRequest.SIZE_PACKET_NUMBER +
+                                              SendFileRequest.SIZE_TOTAL_PACKETS)
+            (content_size,
+             original_file_size,
+             packet_number,
+             total_packets) = struct.unpack(SendFileRequest.UNPACK_PRE_FILE_NAME_AND_CONTENT_STRUCT,
+                                            payload[:pre_file_name_and_content_size])
+        content_offset = pre_file_name_and_content_size + SendFileRequest.SIZE_FILE_NAME
+        raw_data = payload[pre_file_name_and_content_size:content_offset]
         file_name = self._protocol_handler.remove_null(raw_data).decode()
-        encrypted_file_size = header.payload_size - pre_file_name_and_content_size - SendFileRequest.SIZE_FILE_NAME
-        file_content_encrypted = connection.recv(encrypted_file_size)
+        file_content_encrypted = payload[content_offset:]
         return SendFileRequest(
             header,
             content_size,
@@ -86,31 +88,75 @@ class NetworkManager:
             packet_number,
             total_packets,
             file_name,
-            file_content_encrypted
+            file_content_encrypted,
+            offset
         )
 
-    def get_crc_ok_payload(self, connection: socket.socket, header: RequestHeader) -> Request:
-        raw_data = connection.recv(CRCOkRequest.SIZE_FILE_NAME)
+    def get_negotiate_checksum_payload(self, payload: bytes, header: RequestHeader) -> Request:
+        raw_data = payload[:NegotiateChecksumRequest.SIZE_FILE_NAME]
+        file_name = self._protocol_handler.remove_null(raw_data).decode()
+        algorithms = payload[NegotiateChecksumRequest.SIZE_FILE_NAME:
+                             NegotiateChecksumRequest.SIZE_FILE_NAME + NegotiateChecksumRequest.SIZE_ALGORITHMS]
+        return NegotiateChecksumRequest(header, file_name, algorithms)
+
+    def get_zero_ranges_payload(self, payload: bytes, header: RequestHeader) -> Request:
+        raw_data = payload[:SendZeroRangesRequest.SIZE_FILE_NAME]
+        file_name = self._protocol_handler.remove_null(raw_data).decode()
+        ranges_offset = (SendZeroRangesRequest.SIZE_FILE_NAME + SendZeroRangesRequest.SIZE_FIRST_INDEX +
+                         SendZeroRangesRequest.SIZE_COUNT)
+        first_index, count = struct.unpack(SendZeroRangesRequest.UNPACK_INDEX_AND_COUNT_STRUCT,
+                                           payload[SendZeroRangesRequest.SIZE_FILE_NAME:ranges_offset])
+        raw_ranges = payload[ranges_offset:ranges_offset + count * SendZeroRangesRequest.SIZE_RANGE]
+        ranges = list(struct.iter_unpack(SendZeroRangesRequest.UNPACK_RANGE_STRUCT,
+                                         raw_ranges[:len(raw_ranges) - len(raw_ranges) % SendZeroRangesRequest.SIZE_RANGE]))
+        return SendZeroRangesRequest(header, file_name, first_index, ranges)
+
+    def get_file_info_payload(self, payload: bytes, header: RequestHeader) -> Request:
+        raw_data = payload[:FileInfoRequest.SIZE_FILE_NAME]
+        file_name = self._protocol_handler.remove_null(raw_data).decode()
+        algorithms = payload[FileInfoRequest.SIZE_FILE_NAME:FileInfoRequest.SIZE_FILE_NAME + FileInfoRequest.SIZE_ALGORITHMS]
+        return FileInfoRequest(header, file_name, algorithms)
+
+    def get_read_range_payload(self, payload: bytes, header: RequestHeader) -> Request:
+        raw_data = payload[:ReadRangeRequest.SIZE_FILE_NAME]
+        file_name = self._protocol_handler.remove_null(raw_data).decode()
+        offset, length, algorithm = struct.unpack(ReadRangeRequest.UNPACK_RANGE_STRUCT,
+                                                  payload[ReadRangeRequest.SIZE_FILE_NAME:
+                                                          ReadRangeRequest.SIZE_FILE_NAME + ReadRangeRequest.SIZE_OFFSET +
+                                                          ReadRangeRequest.SIZE_LENGTH + ReadRangeRequest.SIZE_ALGORITHM])
+        return ReadRangeRequest(header, file_name, offset, length, algorithm)
+
+    def get_crc_ok_payload(self, payload: bytes, header: RequestHeader) -> Request:
+        raw_data = payload[:CRCOkRequest.SIZE_FILE_NAME]
         file_name = self._protocol_handler.remove_null(raw_data).decode()
         return CRCOkRequest(header, file_name)
 
-    def bad_crc_requests(self, connection: socket.socket, header: RequestHeader, send_confirm: bool) -> Request:
-        raw_data = connection.recv(TransferredFile.SIZE_FILE_NAME)
+    def bad_crc_requests(self, payload: bytes, header: RequestHeader, send_confirm: bool) -> Request:
+        raw_data = payload[:TransferredFile.SIZE_FILE_NAME]
         file_name = self._protocol_handler.remove_null(raw_data).decode()
         if send_confirm:
             return CRCNotOkRequest(header, file_name)
         return CRCTerminateRequest(header, file_name)
 
-    def infer_payload(self, connection: socket.socket, header: RequestHeader) -> Request:
+    def infer_payload(self, payload: bytes, header: RequestHeader) -> Request:
+        """Build the request out of a fully received payload."""
         if header.code == RequestHeader.OPCODE_REGISTER:
-            return self.get_register_payload(connection, header)
+            return self.get_register_payload(payload, header)
         elif header.code == RequestHeader.OPCODE_SEND_PUBLIC_KEY:
-            return self.get_public_key_payload(connection, header)
+            return self.get_public_key_payload(payload, header)
         elif header.code == RequestHeader.OPCODE_RECONNECT:
-            return self.get_reconnect_payload(connection, header)
+            return self.get_reconnect_payload(payload, header)
         elif header.code == RequestHeader.OPCODE_SEND_FILE:
-            return self.get_send_file_payload(connection, header)
+            return self.get_send_file_payload(payload, header)
+        elif header.code == RequestHeader.OPCODE_NEGOTIATE_CHECKSUM:
+            return self.get_negotiate_checksum_payload(payload, header)
+        elif header.code == RequestHeader.OPCODE_SEND_ZERO_RANGES:
+            return self.get_zero_ranges_payload(payload, header)
+        elif header.code == RequestHeader.OPCODE_FILE_INFO:
+            return self.get_file_info_payload(payload, header)
+        elif header.code == RequestHeader.OPCODE_READ_RANGE:
+            return self.get_read_range_payload(payload, header)
         elif header.code == RequestHeader.OPCODE_CRC_OK:
-            return self.get_crc_ok_payload(connection, header)
+            return self.get_crc_ok_payload(payload, header)
         elif header.code == RequestHeader.OPCODE_CRC_NOT_OK or header.code == RequestHeader.OPCODE_CRC_TERMINATE:
-            return self.bad_crc_requests(connection, header, False)
+            return self.bad_crc_requests(payload, header, header.code == RequestHeader.OPCODE_CRC_NOT_OK)
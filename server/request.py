@@ -1,9 +1,12 @@
 from datetime import datetime
 
-import check_sum
+import checksums
+import jobs
 from response import Response, RegisterSuccessResponse, ResponseHeader, RegisterFailureResponse, PayloadResponse, \
-    AESKeyResponse, ReconnectResponse, ReconnectResponseFailure, AcceptedFileResponse, MessageConfirmResponse
+    AESKeyResponse, ReconnectResponse, ReconnectResponseFailure, AcceptedFileResponse, MessageConfirmResponse, \
+    ChecksumSelectedResponse, AcceptedFileDigestResponse, FileInfoResponse, RangeResponse
 from crypto_manager import CryptoManager
+from worker_pool import Deferred
 
 
 class RequestHeader:
@@ -19,6 +22,10 @@ class RequestHeader:
     OPCODE_SEND_PUBLIC_KEY = 826
     OPCODE_RECONNECT = 827
     OPCODE_SEND_FILE = 828
+    OPCODE_NEGOTIATE_CHECKSUM = 829
+    OPCODE_SEND_ZERO_RANGES = 830
+    OPCODE_FILE_INFO = 831
+    OPCODE_READ_RANGE = 832
     OPCODE_CRC_OK = 900
     OPCODE_CRC_NOT_OK = 901
     OPCODE_CRC_TERMINATE = 902
@@ -29,6 +36,10 @@ class RequestHeader:
         OPCODE_SEND_PUBLIC_KEY,
         OPCODE_RECONNECT,
         OPCODE_SEND_FILE,
+        OPCODE_NEGOTIATE_CHECKSUM,
+        OPCODE_SEND_ZERO_RANGES,
+        OPCODE_FILE_INFO,
+        OPCODE_READ_RANGE,
         OPCODE_CRC_OK,
         OPCODE_CRC_NOT_OK,
         OPCODE_CRC_TERMINATE,
@@ -48,7 +59,8 @@ class Request:
     def __init__(self, header: RequestHeader):
         self._header = header
 
-    def execute(self) -> Response:
+    def execute(self) -> Response | Deferred | None:
+        """Returns the response, or a Deferred when CPU-heavy work has to finish in the worker pool first."""
         pass
 
     def get_name(self):
@@ -103,27 +115,41 @@ class SendPublicKeyRequest(Request):
     def get_name(self):
         return "sending public key"
 
-    def execute(self) -> Response:
-        from server import Server
+    def execute(self) -> Response | Deferred:
         from database_manager import DatabaseManager
         db = DatabaseManager()
         client = db.get_client(self._header.client_id.hex(), self.name)
         if client:
             db.update_last_seen(self._header.client_id.hex(), str(datetime.now()))
             new_aes_key = CryptoManager().generate_aes()
-            encrypted_aes = CryptoManager().rsa_encrypt(self.public_key, new_aes_key)
-            db.update_rsa_public_key(self._header.client_id.hex(), self.public_key)
-            if encrypted_aes:
-                db.update_aes_key(self._header.client_id.hex(), new_aes_key)
-                return AESKeyResponse(
-                    ResponseHeader(
-                        Server.VERSION,
-                        ResponseHeader.CODE_SEND_AES,
-                        RequestHeader.SIZE_CLIENT_ID + len(encrypted_aes)
-                    ),
-                    self._header.client_id.hex(),
-                    encrypted_aes
-                )
+            return Deferred(
+                jobs.rsa_encrypt,
+                (self.public_key, new_aes_key),
+                lambda encrypted_aes: self._respond(new_aes_key, encrypted_aes)
+            )
+        return self._failure()
+
+    def _respond(self, new_aes_key: bytes, encrypted_aes: bytes | None) -> Response:
+        """Runs once the AES key was encrypted in the worker pool."""
+        from server import Server
+        from database_manager import DatabaseManager
+        db = DatabaseManager()
+        db.update_rsa_public_key(self._header.client_id.hex(), self.public_key)
+        if encrypted_aes:
+            db.update_aes_key(self._header.client_id.hex(), new_aes_key)
+            return AESKeyResponse(
+                ResponseHeader(
+                    Server.VERSION,
+                    ResponseHeader.CODE_SEND_AES,
+                    RequestHeader.SIZE_CLIENT_ID + len(encrypted_aes)
+                ),
+                self._header.client_id.hex(),
+                encrypted_aes
+            )
+        return self._failure()
+
+    def _failure(self) -> Response:
+        from server import Server
         return RegisterFailureResponse(
             ResponseHeader(
                 Server.VERSION,
@@ -143,8 +169,7 @@ class ReconnectRequest(Request):
     def get_name(self):
         return "reconnecting"
 
-    def execute(self) -> Response:
-        from server import Server
+    def execute(self) -> Response | Deferred:
         from database_manager import DatabaseManager
 
         db = DatabaseManager()
@@ -157,17 +182,23 @@ class ReconnectRequest(Request):
             if public_key:
                 new_aes_key = CryptoManager().generate_aes()
                 db.update_aes_key(client_id_hexified, new_aes_key)
-                encrypted_aes = CryptoManager().rsa_encrypt(public_key, new_aes_key)
-                if encrypted_aes:
-                    return ReconnectResponse(
-                        ResponseHeader(
-                            Server.VERSION,
-                            ResponseHeader.CODE_RECONNECT_SUCCESS,
-                            RequestHeader.SIZE_CLIENT_ID + len(encrypted_aes)
-                        ),
-                        client_id_hexified,
-                        encrypted_aes
-                    )
+                return Deferred(jobs.rsa_encrypt, (public_key, new_aes_key), self._respond)
+        return self._respond(None)
+
+    def _respond(self, encrypted_aes: bytes | None) -> Response:
+        """Runs once the AES key was encrypted in the worker pool (or right away if the client is unknown)."""
+        from server import Server
+        client_id_hexified = self._header.client_id.hex()
+        if encrypted_aes:
+            return ReconnectResponse(
+                ResponseHeader(
+                    Server.VERSION,
+                    ResponseHeader.CODE_RECONNECT_SUCCESS,
+                    RequestHeader.SIZE_CLIENT_ID + len(encrypted_aes)
+                ),
+                client_id_hexified,
+                encrypted_aes
+            )
         return ReconnectResponseFailure(
             ResponseHeader(
                 Server.VERSION,
@@ -188,6 +219,16 @@ class SendFileRequest(Request):
     # struct unpacking format for pre-content data
     UNPACK_PRE_FILE_NAME_AND_CONTENT_STRUCT = '<IIHH'
 
+    # from this client version on the sizes are 64-bit, followed by the 64-bit offset of the content in the encrypted
+    # file, and the packet number and count are 32-bit, so files are no longer limited to 4 GB and 65,535 packets
+    LARGE_FILES_VERSION = 4
+    SIZE_CONTENT_SIZE_V4 = 8
+    SIZE_ORIGINAL_FILE_SIZE_V4 = 8
+    SIZE_OFFSET_V4 = 8
+    SIZE_PACKET_NUMBER_V4 = 4
+    SIZE_TOTAL_PACKETS_V4 = 4
+    UNPACK_PRE_FILE_NAME_AND_CONTENT_STRUCT_V4 = '<QQQII'
+
     def __init__(
             self, header: RequestHeader,
             content_size: int,
@@ -195,7 +236,8 @@ class SendFileRequest(Request):
             packet_number: int,
             total_packets: int,
             file_name: str,
-            content: bytes
+            content: bytes,
+            offset: int | None = None
     ):
         super().__init__(header)
         self.content_size = content_size
@@ -204,12 +246,12 @@ class SendFileRequest(Request):
         self.packet_number = packet_number
         self.total_packets = total_packets
         self.content = content
+        self.offset = offset  # None for clients before LARGE_FILES_VERSION, their packets are appended
 
     def get_name(self):
         return "sending file"
 
-    def execute(self) -> Response | None:
-        from server import Server
+    def execute(self) -> Response | Deferred | None:
         from database_manager import DatabaseManager
         from protocol_handler import ProtocolHandler
         from file_handler import FileHandler
@@ -226,31 +268,232 @@ class SendFileRequest(Request):
             f"for file name: {self.file_name}.."
         )
         file_handler.save_in_dir(client_id_hexified, self.file_name, self.content,
-                                 "wb" if self.packet_number == 1 else "ab")
+                                 "wb" if self.packet_number == 1 else "ab", self.offset)
 
         if self.packet_number == self.total_packets:
-            # time to decrypt the file and store it in the db
+            # time to decrypt the file (in the worker pool) and store it in the db
             file_path = file_handler.get_path(client_id_hexified, self.file_name)  # joined proper path
             aes_key = db.get_aes_key(client_id_hexified)
-            file_handler.decrypt_file(file_path, aes_key)
-            db.create_file(client_id_hexified, self.file_name)
-            calculated_crc = check_sum.calculate(file_path)
-            print(f"<Info>: ID: {client_id_hexified} has fully sent the file: {self.file_name}")
-            return AcceptedFileResponse(
+            algorithm = checksums.selected(client_id_hexified, self.file_name)
+            zero_ranges = file_handler.take_zero_ranges(client_id_hexified, self.file_name)
+            return Deferred(
+                jobs.finalize_file,
+                (file_path, aes_key, algorithm, zero_ranges, self.original_file_size, file_handler.master_key),
+                lambda calculated_crc: self._respond(algorithm, calculated_crc)
+            )
+        return None  # packet number != total packets
+
+    def _respond(self, algorithm: int, calculated_crc: int) -> Response:
+        """Runs once the file was decrypted and its checksum calculated in the worker pool."""
+        from server import Server
+        from database_manager import DatabaseManager
+        client_id_hexified = self._header.client_id.hex()
+        DatabaseManager().create_file(client_id_hexified, self.file_name)
+        print(f"<Info>: ID: {client_id_hexified} has fully sent the file: {self.file_name}")
+        if algorithm != checksums.CKSUM:
+            return AcceptedFileDigestResponse(
                 ResponseHeader(
                     Server.VERSION,
-                    ResponseHeader.CODE_ACCEPTED_FILE,
+                    ResponseHeader.CODE_ACCEPTED_FILE_DIGEST,
                     RequestHeader.SIZE_CLIENT_ID +
-                    AcceptedFileResponse.SIZE_CONTENT_SIZE +
-                    AcceptedFileResponse.SIZE_FILE_NAME +
-                    AcceptedFileResponse.SIZE_CRC
+                    AcceptedFileDigestResponse.SIZE_CONTENT_SIZE +
+                    AcceptedFileDigestResponse.SIZE_FILE_NAME +
+                    AcceptedFileDigestResponse.SIZE_ALGORITHM +
+                    AcceptedFileDigestResponse.SIZE_CHECKSUM
                 ),
                 client_id_hexified,
                 self.content_size,
                 self.file_name,
+                algorithm,
                 calculated_crc
             )
-        return None  # packet number != total packets
+        return AcceptedFileResponse(
+            ResponseHeader(
+                Server.VERSION,
+                ResponseHeader.CODE_ACCEPTED_FILE,
+                RequestHeader.SIZE_CLIENT_ID +
+                AcceptedFileResponse.SIZE_CONTENT_SIZE +
+                AcceptedFileResponse.SIZE_FILE_NAME +
+                AcceptedFileResponse.SIZE_CRC
+            ),
+            client_id_hexified,
+            self.content_size,
+            self.file_name,
+            calculated_crc
+        )
+
+
+class NegotiateChecksumRequest(Request):
+    """Proposes checksum algorithms for a file, best first. Clients only send it to servers from NEGOTIATE_VERSION on,
+    older ones verify every file with cksum."""
+    # the first protocol version that takes the request
+    NEGOTIATE_VERSION = 4
+    SIZE_FILE_NAME = 255
+    SIZE_ALGORITHMS = 8
+
+    def __init__(self, header: RequestHeader, file_name: str, algorithms: bytes):
+        super().__init__(header)
+        self.file_name = file_name
+        self.algorithms = algorithms  # the client's preference, best first, zero padded (0 is cksum)
+
+    def get_name(self):
+        return "negotiating checksum"
+
+    def execute(self) -> Response:
+        from database_manager import DatabaseManager
+        from server import Server
+        client_id_hexified = self._header.client_id.hex()
+        DatabaseManager().update_last_seen(client_id_hexified, str(datetime.now()))
+        algorithm = checksums.select(client_id_hexified, self.file_name, self.algorithms)
+        print(f"<Info>: ID: {client_id_hexified} will verify {self.file_name} with {checksums.NAMES[algorithm]}")
+        return ChecksumSelectedResponse(
+            ResponseHeader(
+                Server.VERSION,
+                ResponseHeader.CODE_CHECKSUM_SELECTED,
+                RequestHeader.SIZE_CLIENT_ID + ChecksumSelectedResponse.SIZE_ALGORITHM
+            ),
+            client_id_hexified,
+            algorithm
+        )
+
+
+class SendZeroRangesRequest(Request):
+    """Zero ranges of a file the client left out of the encrypted stream (protocol 5), they stay holes in the stored
+    file. Every attempt to send a file starts with one, first_index 0 starts the file's list over."""
+    SIZE_FILE_NAME = 255
+    SIZE_FIRST_INDEX = 4
+    SIZE_COUNT = 4
+    SIZE_RANGE = 16  # 64-bit offset and length in the original file
+    UNPACK_INDEX_AND_COUNT_STRUCT = '<II'
+    UNPACK_RANGE_STRUCT = '<QQ'
+
+    def __init__(self, header: RequestHeader, file_name: str, first_index: int, ranges: list[tuple[int, int]]):
+        super().__init__(header)
+        self.file_name = file_name
+        self.first_index = first_index
+        self.ranges = ranges
+
+    def get_name(self):
+        return "sending zero ranges"
+
+    def execute(self) -> None:
+        from file_handler import FileHandler
+        client_id_hexified = self._header.client_id.hex()
+        if not FileHandler().add_zero_ranges(client_id_hexified, self.file_name, self.first_index, self.ranges):
+            # the file's checksum will not match, and the client sends it again
+            print(f"<Error>: ID: {client_id_hexified} sent zero ranges for {self.file_name} out of order.")
+        return None  # like the packets, no response
+
+
+class FileInfoRequest(Request):
+    """Asks for a stored file before downloading it (protocol 6): its size, and the checksum algorithm its ranges are
+    checked with, picked out of the proposed ones like NegotiateChecksumRequest. Only verified files can be downloaded."""
+    SIZE_FILE_NAME = 255
+    SIZE_ALGORITHMS = 8
+
+    def __init__(self, header: RequestHeader, file_name: str, algorithms: bytes):
+        super().__init__(header)
+        self.file_name = file_name
+        self.algorithms = algorithms
+
+    def get_name(self):
+        return "file info"
+
+    def execute(self) -> Response:
+        from database_manager import DatabaseManager
+        from file_handler import FileHandler
+        from protocol_handler import ProtocolHandler
+        from server import Server
+        db = DatabaseManager()
+        file_handler = FileHandler()
+        client_id_hexified = self._header.client_id.hex()
+        db.update_last_seen(client_id_hexified, str(datetime.now()))
+        file_path = file_handler.get_path(client_id_hexified, self.file_name)
+        if not db.is_file_verified(file_path):
+            print(f"<Error>: ID: {client_id_hexified} has no verified file named {self.file_name}.")
+            return ProtocolHandler().create_failure_response()
+        try:
+            size, data_size, modified = file_handler.stat_stored(file_path)
+        except (OSError, ValueError) as e:
+            print(f"<Error>: Could not read {self.file_name} of ID: {client_id_hexified}: {e}")
+            return ProtocolHandler().create_failure_response()
+        algorithm = checksums.pick(self.algorithms)
+        return FileInfoResponse(
+            ResponseHeader(
+                Server.VERSION,
+                ResponseHeader.CODE_FILE_INFO,
+                RequestHeader.SIZE_CLIENT_ID + FileInfoResponse.SIZE_FIELDS
+            ),
+            client_id_hexified,
+            size,
+            data_size,
+            modified,
+            algorithm
+        )
+
+
+class ReadRangeRequest(Request):
+    """Asks for a range of a stored file's plaintext (protocol 6). It is read (and decrypted, for a file stored
+    encrypted) in the worker pool and sent encrypted with the client's AES key, with its checksum; clients keep several
+    of these in flight and spread them over connections."""
+    SIZE_FILE_NAME = 255
+    SIZE_OFFSET = 8
+    SIZE_LENGTH = 4
+    SIZE_ALGORITHM = 1
+    UNPACK_RANGE_STRUCT = '<QIB'
+    MAX_LENGTH = 4 << 20
+
+    def __init__(self, header: RequestHeader, file_name: str, offset: int, length: int, algorithm: int):
+        super().__init__(header)
+        self.file_name = file_name
+        self.offset = offset
+        self.length = length
+        self.algorithm = algorithm
+
+    def get_name(self):
+        return "read range"
+
+    def execute(self) -> Response | Deferred:
+        from database_manager import DatabaseManager
+        from file_handler import FileHandler
+        from protocol_handler import ProtocolHandler
+        db = DatabaseManager()
+        file_handler = FileHandler()
+        client_id_hexified = self._header.client_id.hex()
+        file_path = file_handler.get_path(client_id_hexified, self.file_name)
+        if not db.is_file_verified(file_path):  # like FileInfoRequest, also while the file is sent again
+            print(f"<Error>: ID: {client_id_hexified} has no verified file named {self.file_name}.")
+            return ProtocolHandler().create_failure_response()
+        aes_key = db.get_aes_key(client_id_hexified)
+        if not aes_key or not 0 < self.length <= ReadRangeRequest.MAX_LENGTH or not checksums.is_available(self.algorithm):
+            return ProtocolHandler().create_failure_response()
+        return Deferred(
+            jobs.read_range,
+            (file_path, self.offset, self.length, self.algorithm, aes_key, file_handler.master_key),
+            self._respond
+        )
+
+    def _respond(self, read: tuple[int, int, bytes, bytes] | None) -> Response:
+        """Runs once the range was read and encrypted in the worker pool, read is None past the end of the file."""
+        from protocol_handler import ProtocolHandler
+        from server import Server
+        if read is None:
+            print(f"<Error>: ID: {self._header.client_id.hex()} asked for a range past the end of {self.file_name}.")
+            return ProtocolHandler().create_failure_response()
+        length, checksum, iv, ciphertext = read
+        return RangeResponse(
+            ResponseHeader(
+                Server.VERSION,
+                ResponseHeader.CODE_RANGE,
+                RequestHeader.SIZE_CLIENT_ID + RangeResponse.SIZE_FIELDS + len(ciphertext)
+            ),
+            self._header.client_id.hex(),
+            self.offset,
+            length,
+            checksum,
+            iv,
+            ciphertext
+        )
 
 
 class CRCOkRequest(Request):
@@ -271,6 +514,7 @@ class CRCOkRequest(Request):
         file_handler = FileHandler()
         db.update_last_seen(self._header.client_id.hex(), str(datetime.now()))
         db.verify_file(file_handler.get_path(self._header.client_id.hex(), self.file_name))
+        checksums.forget(self._header.client_id.hex(), self.file_name)
         print(f"<Info>: ID: {self._header.client_id.hex()} verified file: {self.file_name}")
         return MessageConfirmResponse(
             ResponseHeader(
@@ -308,6 +552,7 @@ class CRCTerminateRequest(Request):
         from server import Server
         db = DatabaseManager()
         db.update_last_seen(self._header.client_id.hex(), str(datetime.now()))
+        checksums.forget(self._header.client_id.hex(), self.file_name)
         return MessageConfirmResponse(
             ResponseHeader(
                 Server.VERSION,
@@ -1,5 +1,9 @@
 import struct
 
+# the accepted file responses carry the encrypted size in 32 bits, larger files (protocol 4) report this maximum; the
+# client checks the transfer by its checksum
+MAX_CONTENT_SIZE = 0xFFFFFFFF
+
 
 class ResponseHeader:
     # Response codes
@@ -11,6 +15,10 @@ class ResponseHeader:
     CODE_RECONNECT_SUCCESS = 1605
     CODE_RECONNECT_FAILURE = 1606
     CODE_FAILURE = 1607
+    CODE_CHECKSUM_SELECTED = 1608
+    CODE_ACCEPTED_FILE_DIGEST = 1609
+    CODE_FILE_INFO = 1610
+    CODE_RANGE = 1611
 
     RESPONSE_HEADER_STRUCT = "<BHI"
 
@@ -127,11 +135,100 @@ class AcceptedFileResponse(PayloadResponse):
 
     def create_packet(self) -> bytes:
         return (super().create_packet() +
-                struct.pack("<I", self.content_size) +
+                struct.pack("<I", min(self.content_size, MAX_CONTENT_SIZE)) +
                 self.file_name.encode().ljust(AcceptedFileResponse.SIZE_FILE_NAME, b'\0') +
                 struct.pack("<I", self.checksum)
                 )
 
+
+class AcceptedFileDigestResponse(PayloadResponse):
+    """Like AcceptedFileResponse, for files verified with a negotiated algorithm other than cksum (64-bit value)."""
+    SIZE_CONTENT_SIZE = 4
+    SIZE_FILE_NAME = 255
+    SIZE_ALGORITHM = 1
+    SIZE_CHECKSUM = 8
+
+    def __init__(self, header: ResponseHeader, client_id: str, content_size: int, file_name: str, algorithm: int,
+                 checksum: int):
+        super().__init__(header, client_id)
+        self.content_size = content_size
+        self.file_name = file_name
+        self.algorithm = algorithm
+        self.checksum = checksum
+
+    def get_name(self):
+        return "accepted file, sent digest"
+
+    def create_packet(self) -> bytes:
+        return (super().create_packet() +
+                struct.pack("<I", min(self.content_size, MAX_CONTENT_SIZE)) +
+                self.file_name.encode().ljust(AcceptedFileDigestResponse.SIZE_FILE_NAME, b'\0') +
+                struct.pack("<BQ", self.algorithm, self.checksum)
+                )
+
+
+class ChecksumSelectedResponse(PayloadResponse):
+    SIZE_ALGORITHM = 1
+
+    def __init__(self, header: ResponseHeader, client_id: str, algorithm: int):
+        super().__init__(header, client_id)
+        self.algorithm = algorithm
+
+    def get_name(self):
+        return "checksum selected"
+
+    def create_packet(self) -> bytes:
+        return super().create_packet() + struct.pack("<B", self.algorithm)
+
+
+class FileInfoResponse(PayloadResponse):
+    """A stored file about to be downloaded: its size, the bytes outside its zero ranges (the client preallocates only a
+    file without any), its modification time, which tells a client resuming a download that the file was not sent
+    again meanwhile, and the checksum algorithm of its ranges."""
+    SIZE_FIELDS = 25  # size, data size, modification time, algorithm
+
+    def __init__(self, header: ResponseHeader, client_id: str, size: int, data_size: int, modified: int, algorithm: int):
+        super().__init__(header, client_id)
+        self.size = size
+        self.data_size = data_size
+        self.modified = modified
+        self.algorithm = algorithm
+
+    def get_name(self):
+        return "file info"
+
+    def create_packet(self) -> bytes:
+        return super().create_packet() + struct.pack("<QQQB", self.size, self.data_size, self.modified, self.algorithm)
+
+
+class RangeResponse(PayloadResponse):
+    """A range of a stored file: its offset and length, flags, the checksum of its plaintext, and the plaintext
+    encrypted with the client's AES key under a fresh IV. A range of zeros (FLAG_ZEROS) carries no ciphertext."""
+    SIZE_FIELDS = 37  # offset, length, flags, checksum, IV
+    SIZE_IV = 16
+    FLAG_ZEROS = 1
+
+    def __init__(self, header: ResponseHeader, client_id: str, offset: int, length: int, checksum: int, iv: bytes,
+                 ciphertext: bytes):
+        super().__init__(header, client_id)
+        self.offset = offset
+        self.length = length
+        self.checksum = checksum
+        self.iv = iv
+        self.ciphertext = ciphertext
+
+    def get_name(self):
+        return "range"
+
+    def create_packet(self) -> bytes:
+        flags = 0 if self.ciphertext else RangeResponse.FLAG_ZEROS
+        return (super().create_packet() +
+                struct.pack("<QIBQ", self.offset, self.length, flags, self.checksum) +
+                self.iv.ljust(RangeResponse.SIZE_IV, b'\0') +
+                self.ciphertext
+                )
+
+
 class MessageConfirmResponse(PayloadResponse):
 
     def __init__(self, header: ResponseHeader, client_id: str):
@@ -0,0 +1,43 @@
+"""
+Writes the plaintext of a transferred file to a path of your choice. A file the server stored encrypted
+(main.py --store-encrypted) is decrypted now, with its key unwrapped by the master key; zero ranges of a sparse file stay
+holes. Run it from the server directory.
+
+usage: python retrieve.py <client id> <file name> <output path> [--master-key master.key]
+"""
+import argparse
+import os
+import sys
+
+from crypto_manager import CryptoManager
+from file_handler import FileHandler
+
+
+def main():
+    parser = argparse.ArgumentParser(description='write the plaintext of a transferred file')
+    parser.add_argument('client_id', help='the client id, in hex')
+    parser.add_argument('file_name', help='the file name the client sent')
+    parser.add_argument('output', help='where to write the plaintext')
+    parser.add_argument('--master-key', metavar='PATH', default='master.key',
+                        help='the server\'s master key, for files stored encrypted (default: master.key)')
+    args = parser.parse_args()
+    file_handler = FileHandler()
+    file_path = file_handler.get_path(args.client_id, args.file_name)
+    if not os.path.exists(file_path):
+        print(f"<Error>: No file {args.file_name} of client {args.client_id}.")
+        sys.exit(1)
+    sealed = file_handler.is_sealed(file_path)
+    if sealed and not os.path.exists(args.master_key):  # load_master_key would create one
+        print(f"<Error>: {args.file_name} is stored encrypted and {args.master_key} does not exist.")
+        sys.exit(1)
+    try:
+        master_key = CryptoManager().load_master_key(args.master_key) if sealed else None
+        file_handler.export_plain(file_path, args.output, master_key)
+    except ValueError as e:  # not a key, another master key, or a damaged envelope or file
+        print(f"<Error>: Could not decrypt {args.file_name}: {e}")
+        sys.exit(1)
+    print(f"<Info>: {args.file_name} written to {args.output}.")
+
+
+if __name__ == '__main__':
+    main()
@@ -1,24 +1,46 @@
+import os
 import socket
 import selectors
+import struct
+from functools import partial
 
+from connection import Connection, ShmConnection
+from crypto_manager import CryptoManager
 from database_manager import DatabaseManager
+from file_handler import FileHandler
 from network_manager import NetworkManager
 from request import RequestHeader, Request
 from response import Response
+from worker_pool import Deferred, WorkerPool
 
 
 class Server:
     """Server class for handling all server operations and delegating them to responsible instances."""
 
     # current server version
-    VERSION = 3
+    VERSION = 6
 
-    def __init__(self, host: str, port: int):
+    def __init__(self, host: str, port: int, workers: int = 1, worker_index: int = 0, lazy_db: bool = False,
+                 unix_path: str | None = None, master_key_path: str | None = None):
+        """workers > 1 means this is one of several processes sharing the port (and the database), lazy_db that the
+        database records are read on demand instead of all at startup, unix_path a Unix domain socket to listen on as
+        well, for clients on the same host (the unix and shm transports), master_key_path that received files are
+        stored encrypted, with their keys wrapped with the key in that file (created if missing)."""
         self._host = host
         self._port = port
+        self._workers = workers
+        self._worker_index = worker_index
+        self._lazy_db = lazy_db
+        self._unix_path = unix_path
+        self._unix_socket: socket.socket | None = None
         self._socket = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+        if workers > 1:
+            self._socket.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEPORT, 1)
         self._net_manager = NetworkManager()
         self._db_manager = DatabaseManager()
+        self._worker_pool = WorkerPool()
+        if master_key_path:
+            FileHandler().master_key = CryptoManager().load_master_key(master_key_path)
 
     def _print_request_info(self, header: RequestHeader, request: Request):
         if header.code != RequestHeader.OPCODE_REGISTER:
@@ -37,29 +59,114 @@ class Server:
         else:
             print(f"<Info>: Responding to a client with a {response.get_name()} response..")
 
-    def _read(self, connection, mask):
-        try:
-            header: RequestHeader = self._net_manager.get_header(self._selector, connection)
-            if not header:
-                return
+    def _dispatch(self, state: Connection):
+        """Execute every request that has fully arrived on the connection."""
+        while not state.paused and (frame := state.next_frame()):
+            header, payload = frame
             if not self._net_manager.is_valid_header(header):
                 response = self._net_manager.create_failure_response()
-                self._net_manager.send_response(connection, response)
-                return
-            request = self._net_manager.infer_payload(connection, header)
+                self._net_manager.send_response(state, response)
+                continue
+            try:
+                request = self._net_manager.infer_payload(payload, header)
+            except (struct.error, UnicodeDecodeError):
+                self._net_manager.send_response(state, self._net_manager.create_failure_response())
+                continue
             self._print_request_info(header, request)
             response = request.execute()
+            if isinstance(response, Deferred):
+                state.paused = True
+                self._worker_pool.submit(response, partial(self._complete, state, header))
+                return
             if response:
                 self._print_response_info(header, response)
-                self._net_manager.send_response(connection, response)
+                self._net_manager.send_response(state, response)
+
+    def _complete(self, state: Connection, header: RequestHeader, response: Response | None):
+        """Called on the selector thread once a deferred request finished in the worker pool."""
+        try:
+            self._selector.get_key(state.socket)
+        except (KeyError, ValueError):
+            return  # the client left while its request was running
+        try:
+            if response:
+                self._print_response_info(header, response)
+                self._net_manager.send_response(state, response)
+            state.paused = False
+            self._dispatch(state)
+            self._update_interest(state)
+
+        except (ConnectionResetError, ConnectionAbortedError, BrokenPipeError):
+            self._net_manager.close_connection(self._selector, state, "Connection error")
+
+    def _update_interest(self, state: Connection):
+        """Only ask for EVENT_WRITE while there is queued output, otherwise the selector would spin."""
+        events = selectors.EVENT_READ
+        if state.wants_write_event():
+            events |= selectors.EVENT_WRITE
+        key = self._selector.get_key(state.socket)
+        if key.events != events:
+            self._selector.modify(state.socket, events, key.data)
 
-        except (ConnectionResetError, ConnectionAbortedError):
-            self._net_manager.close_connection(self._selector, connection, "Connection error")
+    def _service(self, state: Connection, connection, mask):
+        try:
+            self._selector.get_key(connection)
+        except (KeyError, ValueError):
+            return  # another file of the connection (shm) was serviced first in the same select and closed it
+        try:
+            if mask & selectors.EVENT_WRITE:
+                state.flush()
+            if mask & selectors.EVENT_READ:
+                if not state.receive():
+                    self._net_manager.close_connection(self._selector, state,
+                                                       "Client left the server (no data received)")
+                    return
+                self._dispatch(state)
+            self._update_interest(state)
+
+        except (ConnectionResetError, ConnectionAbortedError, BrokenPipeError):
+            self._net_manager.close_connection(self._selector, state, "Connection error")
 
     def _accept(self, sock, mask):
         connection, addr = sock.accept()
         print('<Info>: A client incoming from:', addr, "..")
-        self._selector.register(connection, selectors.EVENT_READ, self._read)
+        connection.setblocking(False)
+        state = Connection(connection, addr)
+        self._selector.register(connection, selectors.EVENT_READ, partial(self._service, state))
+
+    def _accept_unix(self, sock, mask):
+        connection, _ = sock.accept()
+        print('<Info>: A client incoming from:', self._unix_path, "..")
+        connection.setblocking(False)
+        self._selector.register(connection, selectors.EVENT_READ, self._identify)
+
+    def _identify(self, connection, mask):
+        """The first message on the Unix domain socket tells the transport: the shared memory (shm), or the start of a
+        request (unix)."""
+        try:
+            received, fds, _, _ = socket.recv_fds(connection, Connection.RECV_SIZE, ShmConnection.FD_COUNT)
+        except (BlockingIOError, InterruptedError):
+            return
+        except OSError:
+            received, fds = b'', []
+        self._selector.unregister(connection)
+        if not received and not fds:
+            print("<Info>: A connection is being closed, reason: Client left the server (no data received)")
+            connection.close()
+            return
+        try:
+            state = ShmConnection(connection, self._unix_path, received, fds) if fds else \
+                Connection(connection, self._unix_path, received)
+        except (OSError, ValueError, ConnectionAbortedError) as e:
+            print(f"<Info>: A connection is being closed, reason: {e}")
+            return
+        for fileobj in state.fileobjs():
+            self._selector.register(fileobj, selectors.EVENT_READ, partial(self._service, state))
+        try:
+            self._dispatch(state)
+            self._update_interest(state)
+        except (ConnectionResetError, ConnectionAbortedError, BrokenPipeError):
+            self._net_manager.close_connection(self._selector, state, "Connection error")
 
     def _internal_initialize(self):
         # Bind the socket to the host and port
@@ -70,17 +177,48 @@ class Server:
         # selector setting up
         self._selector = selectors.DefaultSelector()
         self._selector.register(self._socket, selectors.EVENT_READ, self._accept)
+        if self._unix_path:
+            if os.path.exists(self._unix_path):
+                os.unlink(self._unix_path)  # left behind by a server that did not exit cleanly
+            self._unix_socket = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+            self._unix_socket.bind(self._unix_path)
+            self._unix_socket.listen()
+            self._unix_socket.setblocking(False)
+            self._selector.register(self._unix_socket, selectors.EVENT_READ, self._accept_unix)
+
+        # CPU-heavy request stages (RSA, file decryption and checksum) run here, off the selector thread,
+        # the cores are split between the server processes
+        self._worker_pool.start(self._selector, max(1, (os.cpu_count() or 1) // self._workers))
 
-        # Load up the database (inc. connection, data, etc..)
-        self._db_manager.load_up()
+        # Load up the database (inc. connection, data, etc..), only the first process prints its content
+        self._db_manager.load_up(shared=self._workers > 1, print_content=self._worker_index == 0, lazy=self._lazy_db)
+        if self._worker_index == 0 and FileHandler().has_legacy_layout():
+            print(f"<Warning>: {FileHandler.ROOT_DIR} holds files in the old per-client layout, "
+                  f"stop the server and run migrate_layout.py to move them.")
 
     def start(self):
-        print('Server started at', self._port)
+        if self._workers > 1:
+            print(f'Server worker {self._worker_index + 1}/{self._workers} started at', self._port)
+        else:
+            print('Server started at', self._port)
         self._internal_initialize()
+        if self._unix_path:
+            print('<Info>: Also listening on the Unix domain socket', self._unix_path)
+        if FileHandler().master_key:
+            print('<Info>: Received files are stored encrypted')
         print("<Info>: Server fully initialized and waiting for requests..")
 
-        while True:
-            events = self._selector.select()
-            for key, mask in events:
-                callback = key.data
-                callback(key.fileobj, mask)
+        try:
+            while True:
+                # wakes up at least once per flush interval to write the batched database updates
+                events = self._selector.select(timeout=DatabaseManager.LAST_SEEN_FLUSH_INTERVAL)
+                for key, mask in events:
+                    callback = key.data
+                    callback(key.fileobj, mask)
+                self._db_manager.flush_if_due()
+        finally:
+            self._worker_pool.shutdown()
+            self._db_manager.flush()
+            if self._unix_socket:
+                self._unix_socket.close()
+                os.unlink(self._unix_path)
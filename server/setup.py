@@ -0,0 +1,17 @@
+"""Builds the optional native checksum module: python setup.py build_ext --inplace"""
+import os
+
+from setuptools import setup, Extension
+
+setup(
+    name='gyf-server-native',
+    ext_modules=[
+        Extension(
+            '_check_sum',
+            sources=['_check_sum.cpp'],
+            include_dirs=['../client'],  # shares CRCCore with the client
+            language='c++',
+            extra_compile_args=['/std:c++17', '/O2'] if os.name == 'nt' else ['-std=c++17', '-O3'],
+        )
+    ],
+)
@@ -0,0 +1,70 @@
+"""Checks of ShmConnection against a client that writes nonsense into the shared memory, they need no running server.
+usage (from server/): python -m unittest discover tests"""
+import fcntl
+import os
+import socket
+import struct
+import sys
+import unittest
+
+sys.path.insert(0, os.path.dirname(os.path.dirname(os.path.abspath(__file__))))
+
+from connection import ShmConnection  # noqa: E402
+
+RING_SIZE = 4096
+
+
+class HostileRingTest(unittest.TestCase):
+
+    def connect(self, ring_size: int = RING_SIZE) -> ShmConnection:
+        """Hand over memory the way the client does (shm_transport.cpp), this side keeps it mapped to play the client."""
+        memory_fd = os.memfd_create("gyf-test", os.MFD_ALLOW_SEALING)
+        os.ftruncate(memory_fd, ShmConnection.DATA_OFFSET + 2 * max(ring_size, 1))
+        os.pwrite(memory_fd, ShmConnection.MAGIC + struct.pack('<I', ring_size), 0)
+        fcntl.fcntl(memory_fd, fcntl.F_ADD_SEALS, ShmConnection.SIZE_SEALS)
+        self.client_memory = os.fdopen(os.dup(memory_fd), 'r+b', buffering=0)
+        self.addCleanup(self.client_memory.close)
+        server_side, client_side = socket.socketpair()
+        self.addCleanup(client_side.close)
+        connection = ShmConnection(server_side, "test", ShmConnection.MAGIC,
+                                   [memory_fd, os.eventfd(0, os.EFD_NONBLOCK), os.eventfd(0, os.EFD_NONBLOCK)])
+        self.addCleanup(connection.close)
+        return connection
+
+    def write_counter(self, ring: int, field: int, value: int) -> None:
+        self.client_memory.seek(ShmConnection.RING_OFFSET + ring * ShmConnection.RING_CONTROL_SIZE + field)
+        self.client_memory.write(struct.pack('<Q', value))
+
+    def test_honest_ring_is_read(self):
+        connection = self.connect()
+        self.client_memory.seek(ShmConnection.DATA_OFFSET)
+        self.client_memory.write(b'hello')
+        self.write_counter(0, 0, 5)
+        self.assertTrue(connection.receive())
+        self.assertEqual(bytes(connection._in_buffer), b'hello')
+
+    def test_head_beyond_the_ring_is_refused(self):
+        connection = self.connect()
+        self.write_counter(0, 0, 1 << 40)
+        with self.assertRaises(ConnectionAbortedError):
+            connection.receive()
+
+    def test_head_behind_the_tail_is_refused(self):
+        connection = self.connect()
+        self.write_counter(0, 64, 16)
+        with self.assertRaises(ConnectionAbortedError):
+            connection.receive()
+
+    def test_tail_ahead_of_the_head_is_refused_on_write(self):
+        connection = self.connect()
+        self.write_counter(1, 64, 1 << 40)
+        with self.assertRaises(ConnectionAbortedError):
+            connection.queue(b'response')
+
+    def test_empty_ring_is_refused(self):
+        with self.assertRaises(ConnectionAbortedError):
+            self.connect(ring_size=0)
+
+
+if __name__ == '__main__':
+    unittest.main()
@@ -0,0 +1,71 @@
+import multiprocessing
+import queue
+import selectors
+import socket
+from concurrent.futures import Future, ProcessPoolExecutor
+
+from crypto_manager import SingletonMeta
+
+
+class Deferred:
+    """
+    Returned by Request.execute when part of the work is CPU-bound: job(*args) runs in the worker pool,
+    then continuation(result) runs back on the selector thread and returns the actual response (or None).
+    """
+
+    def __init__(self, job, args: tuple, continuation):
+        self.job = job
+        self.args = args
+        self.continuation = continuation
+
+
+class WorkerPool(metaclass=SingletonMeta):
+    """Runs CPU-heavy jobs in worker processes and posts their results back to the selector thread."""
+
+    def __init__(self):
+        self._executor: ProcessPoolExecutor | None = None
+        self._completed = queue.SimpleQueue()  # filled by the executor's thread, drained by the selector thread
+        self._wakeup_receiver, self._wakeup_sender = socket.socketpair()
+
+    def start(self, selector: selectors.BaseSelector, workers: int | None = None) -> None:
+        """Spawn the workers and hook the wakeup socket into the selector (workers=None means one per core)."""
+        # spawn (as on Windows) so workers never inherit the listening socket, the selector or the database connection
+        self._executor = ProcessPoolExecutor(max_workers=workers, mp_context=multiprocessing.get_context('spawn'))
+        self._wakeup_receiver.setblocking(False)
+        self._wakeup_sender.setblocking(False)
+        selector.register(self._wakeup_receiver, selectors.EVENT_READ, self._drain)
+
+    def submit(self, deferred: Deferred, on_done) -> None:
+        """Run the deferred job, on_done(response) is called on the selector thread once it is finished."""
+        future = self._executor.submit(deferred.job, *deferred.args)
+        future.add_done_callback(lambda finished: self._post(finished, deferred, on_done))
+
+    def _post(self, future: Future, deferred: Deferred, on_done) -> None:
+        self._completed.put((future, deferred, on_done))
+        try:
+            self._wakeup_sender.send(b'\0')
+        except BlockingIOError:
+            pass  # the socket is full of wakeups already, the selector will drain everything anyway
+
+    def _drain(self, sock: socket.socket, mask) -> None:
+        from protocol_handler import ProtocolHandler  # Did this to avoid circular import
+        try:
+            while sock.recv(4096):
+                pass
+        except BlockingIOError:
+            pass
+        while True:
+            try:
+                future, deferred, on_done = self._completed.get_nowait()
+            except queue.Empty:
+                return
+            try:
+                response = deferred.continuation(future.result())
+            except (Exception, SystemExit) as e:
+                print(f"<Error>: A background job failed: {e!r}")
+                response = ProtocolHandler().create_failure_response()
+            on_done(response)
+
+    def shutdown(self) -> None:
+        if self._executor:
+            self._executor.shutdown(cancel_futures=True)